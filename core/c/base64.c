@@ -128,7 +128,7 @@ int mpw_base64_encode(char *b64Text, const uint8_t *plainBuf, size_t plainSize)
 
     size_t plainCursor = 0;
     char *b64Cursor = b64Text;
-    for (; plainCursor < plainSize - 2; plainCursor += 3) {
+    for (; plainCursor + 2 < plainSize; plainCursor += 3) {
         *b64Cursor++ = basis_64[((plainBuf[plainCursor] >> 2)) & 0x3F];
         *b64Cursor++ = basis_64[((plainBuf[plainCursor] & 0x3) << 4) |
                                 ((plainBuf[plainCursor + 1] & 0xF0) >> 4)];
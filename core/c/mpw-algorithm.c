@@ -86,56 +86,107 @@ const char *mpw_siteResult(
     trc( "resultType: %d (%s)\n", resultType, mpw_nameForType( resultType ) );
     trc( "resultParam: %s\n", resultParam );
 
-    char *sitePassword = NULL;
+    const char *sitePassword = NULL;
     if (resultType & MPResultTypeClassTemplate) {
         switch (algorithmVersion) {
             case MPAlgorithmVersion0:
-                return mpw_sitePasswordFromTemplate_v0( masterKey, siteKey, resultType, resultParam );
+                sitePassword = mpw_sitePasswordFromTemplate_v0( masterKey, siteKey, resultType, resultParam );
+                break;
             case MPAlgorithmVersion1:
-                return mpw_sitePasswordFromTemplate_v1( masterKey, siteKey, resultType, resultParam );
+                sitePassword = mpw_sitePasswordFromTemplate_v1( masterKey, siteKey, resultType, resultParam );
+                break;
             case MPAlgorithmVersion2:
-                return mpw_sitePasswordFromTemplate_v2( masterKey, siteKey, resultType, resultParam );
+                sitePassword = mpw_sitePasswordFromTemplate_v2( masterKey, siteKey, resultType, resultParam );
+                break;
             case MPAlgorithmVersion3:
-                return mpw_sitePasswordFromTemplate_v3( masterKey, siteKey, resultType, resultParam );
+                sitePassword = mpw_sitePasswordFromTemplate_v3( masterKey, siteKey, resultType, resultParam );
+                break;
             default:
                 err( "Unsupported version: %d\n", algorithmVersion );
-                return NULL;
+                break;
         }
     }
     else if (resultType & MPResultTypeClassStateful) {
         switch (algorithmVersion) {
             case MPAlgorithmVersion0:
-                return mpw_sitePasswordFromCrypt_v0( masterKey, siteKey, resultType, resultParam );
+                sitePassword = mpw_sitePasswordFromCrypt_v0( masterKey, siteKey, resultType, resultParam );
+                break;
             case MPAlgorithmVersion1:
-                return mpw_sitePasswordFromCrypt_v1( masterKey, siteKey, resultType, resultParam );
+                sitePassword = mpw_sitePasswordFromCrypt_v1( masterKey, siteKey, resultType, resultParam );
+                break;
             case MPAlgorithmVersion2:
-                return mpw_sitePasswordFromCrypt_v2( masterKey, siteKey, resultType, resultParam );
+                sitePassword = mpw_sitePasswordFromCrypt_v2( masterKey, siteKey, resultType, resultParam );
+                break;
             case MPAlgorithmVersion3:
-                return mpw_sitePasswordFromCrypt_v3( masterKey, siteKey, resultType, resultParam );
+                sitePassword = mpw_sitePasswordFromCrypt_v3( masterKey, siteKey, resultType, resultParam );
+                break;
             default:
                 err( "Unsupported version: %d\n", algorithmVersion );
-                return NULL;
+                break;
         }
     }
     else if (resultType & MPResultTypeClassDerive) {
         switch (algorithmVersion) {
             case MPAlgorithmVersion0:
-                return mpw_sitePasswordFromDerive_v0( masterKey, siteKey, resultType, resultParam );
+                sitePassword = mpw_sitePasswordFromDerive_v0( masterKey, siteKey, resultType, resultParam );
+                break;
             case MPAlgorithmVersion1:
-                return mpw_sitePasswordFromDerive_v1( masterKey, siteKey, resultType, resultParam );
+                sitePassword = mpw_sitePasswordFromDerive_v1( masterKey, siteKey, resultType, resultParam );
+                break;
             case MPAlgorithmVersion2:
-                return mpw_sitePasswordFromDerive_v2( masterKey, siteKey, resultType, resultParam );
+                sitePassword = mpw_sitePasswordFromDerive_v2( masterKey, siteKey, resultType, resultParam );
+                break;
             case MPAlgorithmVersion3:
-                return mpw_sitePasswordFromDerive_v3( masterKey, siteKey, resultType, resultParam );
+                sitePassword = mpw_sitePasswordFromDerive_v3( masterKey, siteKey, resultType, resultParam );
+                break;
             default:
                 err( "Unsupported version: %d\n", algorithmVersion );
-                return NULL;
+                break;
         }
     }
     else {
         err( "Unsupported password type: %d\n", resultType );
     }
 
+    mpw_free( siteKey, MPSiteKeySize );
+
+    return sitePassword;
+}
+
+const char *mpw_sitePolicyResult(
+        MPMasterKey masterKey, const char *siteName, const MPCounterValue siteCounter,
+        const MPKeyPurpose keyPurpose, const char *keyContext,
+        const MPTemplatePolicy *policy, const MPAlgorithmVersion algorithmVersion) {
+
+    if (!policy || !policy->templates_count)
+        return NULL;
+    MPSiteKey siteKey = mpw_siteKey( masterKey, siteName, siteCounter, keyPurpose, keyContext, algorithmVersion );
+    if (!siteKey)
+        return NULL;
+
+    trc( "-- mpw_sitePolicyResult (algorithm: %u)\n", algorithmVersion );
+    trc( "policy: %zu templates\n", policy->templates_count );
+
+    const char *sitePassword = NULL;
+    switch (algorithmVersion) {
+        case MPAlgorithmVersion0:
+            sitePassword = mpw_sitePasswordFromPolicy_v0( masterKey, siteKey, policy );
+            break;
+        case MPAlgorithmVersion1:
+            sitePassword = mpw_sitePasswordFromPolicy_v1( masterKey, siteKey, policy );
+            break;
+        case MPAlgorithmVersion2:
+            sitePassword = mpw_sitePasswordFromPolicy_v2( masterKey, siteKey, policy );
+            break;
+        case MPAlgorithmVersion3:
+            sitePassword = mpw_sitePasswordFromPolicy_v3( masterKey, siteKey, policy );
+            break;
+        default:
+            err( "Unsupported version: %d\n", algorithmVersion );
+            break;
+    }
+    mpw_free( siteKey, MPSiteKeySize );
+
     return sitePassword;
 }
 
@@ -152,20 +203,30 @@ const char *mpw_siteState(
     trc( "-- mpw_siteState (algorithm: %u)\n", algorithmVersion );
     trc( "resultType: %d (%s)\n", resultType, mpw_nameForType( resultType ) );
     trc( "state: %s\n", state );
-    if (!masterKey || !state)
+    if (!masterKey || !state) {
+        mpw_free( siteKey, MPSiteKeySize );
         return NULL;
+    }
 
+    const char *siteState = NULL;
     switch (algorithmVersion) {
         case MPAlgorithmVersion0:
-            return mpw_siteState_v0( masterKey, siteKey, resultType, state );
+            siteState = mpw_siteState_v0( masterKey, siteKey, resultType, state );
+            break;
         case MPAlgorithmVersion1:
-            return mpw_siteState_v1( masterKey, siteKey, resultType, state );
+            siteState = mpw_siteState_v1( masterKey, siteKey, resultType, state );
+            break;
         case MPAlgorithmVersion2:
-            return mpw_siteState_v2( masterKey, siteKey, resultType, state );
+            siteState = mpw_siteState_v2( masterKey, siteKey, resultType, state );
+            break;
         case MPAlgorithmVersion3:
-            return mpw_siteState_v3( masterKey, siteKey, resultType, state );
+            siteState = mpw_siteState_v3( masterKey, siteKey, resultType, state );
+            break;
         default:
             err( "Unsupported version: %d\n", algorithmVersion );
-            return NULL;
+            break;
     }
+    mpw_free( siteKey, MPSiteKeySize );
+
+    return siteState;
 }
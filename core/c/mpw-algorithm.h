@@ -56,6 +56,14 @@ const char *mpw_siteResult(
         const MPResultType resultType, const char *resultParam,
         const MPAlgorithmVersion algorithmVersion);
 
+/** Encode a password for the site from the given site key with a template policy compiled by mpw_templatePolicy.
+ * Use this to encode many passwords with the same policy without compiling it for each of them.
+ * @return A newly allocated string or NULL if an error occurred. */
+const char *mpw_sitePolicyResult(
+        MPMasterKey masterKey, const char *siteName, const MPCounterValue siteCounter,
+        const MPKeyPurpose keyPurpose, const char *keyContext,
+        const MPTemplatePolicy *policy, const MPAlgorithmVersion algorithmVersion);
+
 /** Perform symmetric encryption on a secret token's plainText.
  * @return The newly allocated cipherText of the secret token encrypted by the masterKey. */
 const char *mpw_siteState(
@@ -38,13 +38,21 @@ static const char *mpw_templateForType_v0(MPResultType type, uint16_t seedByte)
     return template;
 }
 
-static const char mpw_characterFromClass_v0(char characterClass, uint16_t seedByte) {
+static const char *mpw_sitePasswordFromClasses_v0(
+        MPSiteKey siteKey, const MPTemplate *template) {
 
-    const char *classCharacters = mpw_charactersInClass( characterClass );
-    if (!classCharacters)
-        return '\0';
+    // Encode the password from the seed using the template's table of classes.
+    const char *_siteKey = (const char *)siteKey;
+    char *sitePassword = calloc( template->length + 1, sizeof( char ) );
+    for (size_t c = 0; c < template->length; ++c) {
+        uint16_t seedByte = htons( _siteKey[c + 1] );
+        sitePassword[c] = template->classes[c].characters[seedByte % template->classes[c].size];
+        trc( "  - class: %zu characters, index: %5u (0x%02hX) => character: %c\n",
+                template->classes[c].size, seedByte, seedByte, sitePassword[c] );
+    }
+    trc( "  => password: %s\n", sitePassword );
 
-    return classCharacters[seedByte % strlen( classCharacters )];
+    return sitePassword;
 }
 
 // Algorithm version overrides.
@@ -124,30 +132,43 @@ static MPSiteKey mpw_siteKey_v0(
     return siteKey;
 }
 
+static const char *mpw_sitePasswordFromPolicy_v0(
+        MPMasterKey masterKey, MPSiteKey siteKey, const MPTemplatePolicy *policy) {
+
+    // Determine the template.
+    const char *_siteKey = (const char *)siteKey;
+    size_t templateIndex = htons( _siteKey[0] ) % policy->templates_count;
+    trc( "template: %u => %zu of %zu\n", htons( _siteKey[0] ), templateIndex + 1, policy->templates_count );
+
+    return mpw_sitePasswordFromClasses_v0( siteKey, &policy->templates[templateIndex] );
+}
+
 static const char *mpw_sitePasswordFromTemplate_v0(
         MPMasterKey masterKey, MPSiteKey siteKey, const MPResultType resultType, const char *resultParam) {
 
+    if (resultType == MPResultTypeTemplateCustom) {
+        const MPTemplatePolicy *policy = mpw_templatePolicy( resultParam );
+        if (!policy) {
+            err( "Invalid template policy: %s\n", resultParam );
+            return NULL;
+        }
+
+        const char *sitePassword = mpw_sitePasswordFromPolicy_v0( masterKey, siteKey, policy );
+        mpw_templatePolicy_free( policy );
+        return sitePassword;
+    }
+
     // Determine the template.
     const char *_siteKey = (const char *)siteKey;
-    const char *template = mpw_templateForType_v0( resultType, htons( _siteKey[0] ) );
-    trc( "template: %u => %s\n", htons( _siteKey[0] ), template );
-    if (!template)
-        return NULL;
-    if (strlen( template ) > MPSiteKeySize) {
-        err( "Template too long for password seed: %zu\n", strlen( template ) );
+    const char *templateString = mpw_templateForType_v0( resultType, htons( _siteKey[0] ) );
+    trc( "template: %u => %s\n", htons( _siteKey[0] ), templateString );
+    MPTemplate template;
+    if (!templateString || !mpw_template( &template, templateString )) {
+        err( "Invalid template: %s\n", templateString );
         return NULL;
     }
 
-    // Encode the password from the seed using the template.
-    char *sitePassword = calloc( strlen( template ) + 1, sizeof( char ) );
-    for (size_t c = 0; c < strlen( template ); ++c) {
-        sitePassword[c] = mpw_characterFromClass_v0( template[c], htons( _siteKey[c + 1] ) );
-        trc( "  - class: %c, index: %5u (0x%02hX) => character: %c\n",
-                template[c], htons( _siteKey[c + 1] ), htons( _siteKey[c + 1] ), sitePassword[c] );
-    }
-    trc( "  => password: %s\n", sitePassword );
-
-    return sitePassword;
+    return mpw_sitePasswordFromClasses_v0( siteKey, &template );
 }
 
 static const char *mpw_sitePasswordFromCrypt_v0(
@@ -54,29 +54,56 @@ static MPSiteKey mpw_siteKey_v1(
     return mpw_siteKey_v0( masterKey, siteName, siteCounter, keyPurpose, keyContext );
 }
 
+static const char *mpw_sitePasswordFromClasses_v1(
+        MPSiteKey siteKey, const MPTemplate *template) {
+
+    // Encode the password from the seed using the template's table of classes.
+    char *const sitePassword = calloc( template->length + 1, sizeof( char ) );
+    for (size_t c = 0; c < template->length; ++c) {
+        sitePassword[c] = template->classes[c].characters[siteKey[c + 1] % template->classes[c].size];
+        trc( "  - class: %zu characters, index: %3u (0x%02hhX) => character: %c\n",
+                template->classes[c].size, siteKey[c + 1], siteKey[c + 1], sitePassword[c] );
+    }
+    trc( "  => password: %s\n", sitePassword );
+
+    return sitePassword;
+}
+
+static const char *mpw_sitePasswordFromPolicy_v1(
+        MPMasterKey masterKey, MPSiteKey siteKey, const MPTemplatePolicy *policy) {
+
+    // Determine the template.
+    size_t templateIndex = siteKey[0] % policy->templates_count;
+    trc( "template: %u => %zu of %zu\n", siteKey[0], templateIndex + 1, policy->templates_count );
+
+    return mpw_sitePasswordFromClasses_v1( siteKey, &policy->templates[templateIndex] );
+}
+
 static const char *mpw_sitePasswordFromTemplate_v1(
         MPMasterKey masterKey, MPSiteKey siteKey, const MPResultType resultType, const char *resultParam) {
 
-    // Determine the template.
-    const char *template = mpw_templateForType( resultType, siteKey[0] );
-    trc( "template: %u => %s\n", siteKey[0], template );
-    if (!template)
-        return NULL;
-    if (strlen( template ) > MPSiteKeySize) {
-        err( "Template too long for password seed: %zu\n", strlen( template ) );
-        return NULL;
+    if (resultType == MPResultTypeTemplateCustom) {
+        const MPTemplatePolicy *policy = mpw_templatePolicy( resultParam );
+        if (!policy) {
+            err( "Invalid template policy: %s\n", resultParam );
+            return NULL;
+        }
+
+        const char *sitePassword = mpw_sitePasswordFromPolicy_v1( masterKey, siteKey, policy );
+        mpw_templatePolicy_free( policy );
+        return sitePassword;
     }
 
-    // Encode the password from the seed using the template.
-    char *const sitePassword = calloc( strlen( template ) + 1, sizeof( char ) );
-    for (size_t c = 0; c < strlen( template ); ++c) {
-        sitePassword[c] = mpw_characterFromClass( template[c], siteKey[c + 1] );
-        trc( "  - class: %c, index: %3u (0x%02hhX) => character: %c\n",
-                template[c], siteKey[c + 1], siteKey[c + 1], sitePassword[c] );
+    // Determine the template.
+    const char *templateString = mpw_templateForType( resultType, siteKey[0] );
+    trc( "template: %u => %s\n", siteKey[0], templateString );
+    MPTemplate template;
+    if (!templateString || !mpw_template( &template, templateString )) {
+        err( "Invalid template: %s\n", templateString );
+        return NULL;
     }
-    trc( "  => password: %s\n", sitePassword );
 
-    return sitePassword;
+    return mpw_sitePasswordFromClasses_v1( siteKey, &template );
 }
 
 static const char *mpw_sitePasswordFromCrypt_v1(
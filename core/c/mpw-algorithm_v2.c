@@ -32,6 +32,8 @@ MPMasterKey mpw_masterKey_v1(
         const char *fullName, const char *masterPassword);
 const char *mpw_sitePasswordFromTemplate_v1(
         MPMasterKey masterKey, MPSiteKey siteKey, const MPResultType resultType, const char *resultParam);
+const char *mpw_sitePasswordFromPolicy_v1(
+        MPMasterKey masterKey, MPSiteKey siteKey, const MPTemplatePolicy *policy);
 const char *mpw_sitePasswordFromCrypt_v1(
         MPMasterKey masterKey, MPSiteKey siteKey, const MPResultType resultType, const char *cipherText);
 const char *mpw_sitePasswordFromDerive_v1(
@@ -95,6 +97,12 @@ static const char *mpw_sitePasswordFromTemplate_v2(
     return mpw_sitePasswordFromTemplate_v1( masterKey, siteKey, resultType, resultParam );
 }
 
+static const char *mpw_sitePasswordFromPolicy_v2(
+        MPMasterKey masterKey, MPSiteKey siteKey, const MPTemplatePolicy *policy) {
+
+    return mpw_sitePasswordFromPolicy_v1( masterKey, siteKey, policy );
+}
+
 static const char *mpw_sitePasswordFromCrypt_v2(
         MPMasterKey masterKey, MPSiteKey siteKey, const MPResultType resultType, const char *cipherText) {
 
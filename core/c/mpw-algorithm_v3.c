@@ -33,6 +33,8 @@ MPSiteKey mpw_siteKey_v2(
         const MPKeyPurpose keyPurpose, const char *keyContext);
 const char *mpw_sitePasswordFromTemplate_v2(
         MPMasterKey masterKey, MPSiteKey siteKey, const MPResultType resultType, const char *resultParam);
+const char *mpw_sitePasswordFromPolicy_v2(
+        MPMasterKey masterKey, MPSiteKey siteKey, const MPTemplatePolicy *policy);
 const char *mpw_sitePasswordFromCrypt_v2(
         MPMasterKey masterKey, MPSiteKey siteKey, const MPResultType resultType, const char *cipherText);
 const char *mpw_sitePasswordFromDerive_v2(
@@ -87,6 +89,12 @@ static const char *mpw_sitePasswordFromTemplate_v3(
     return mpw_sitePasswordFromTemplate_v2( masterKey, siteKey, resultType, resultParam );
 }
 
+static const char *mpw_sitePasswordFromPolicy_v3(
+        MPMasterKey masterKey, MPSiteKey siteKey, const MPTemplatePolicy *policy) {
+
+    return mpw_sitePasswordFromPolicy_v2( masterKey, siteKey, policy );
+}
+
 static const char *mpw_sitePasswordFromCrypt_v3(
         MPMasterKey masterKey, MPSiteKey siteKey, const MPResultType resultType, const char *cipherText) {
 
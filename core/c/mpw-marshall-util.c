@@ -100,8 +100,15 @@ bool mpw_update_masterKey(MPMasterKey *masterKey, MPAlgorithmVersion *masterKeyA
         const char *fullName, const char *masterPassword) {
 
     if (*masterKeyAlgorithm != targetKeyAlgorithm) {
-        mpw_free( *masterKey, MPMasterKeySize );
+        // V0 - V2 share the same master key, V3 only differs from them for multi-byte full names.
+        bool sameKey = *masterKey && *masterKeyAlgorithm <= MPAlgorithmVersionLast && (
+                (*masterKeyAlgorithm <= MPAlgorithmVersion2 && targetKeyAlgorithm <= MPAlgorithmVersion2) ||
+                strlen( fullName ) == mpw_utf8_strlen( fullName ));
         *masterKeyAlgorithm = targetKeyAlgorithm;
+        if (sameKey)
+            return true;
+
+        mpw_free( *masterKey, MPMasterKeySize );
         *masterKey = mpw_masterKey(
                 fullName, masterPassword, *masterKeyAlgorithm );
         if (!*masterKey) {
@@ -61,6 +61,7 @@ bool mpw_get_json_boolean(
 /// mpw.
 
 /** Calculate a master key if the target master key algorithm is different from the given master key algorithm.
+  * The given master key is kept if it is identical to the target algorithm's master key for the user.
   * @return false if an error occurred during the derivation of the master key. */
 bool mpw_update_masterKey(
         MPMasterKey *masterKey, MPAlgorithmVersion *masterKeyAlgorithm, MPAlgorithmVersion targetKeyAlgorithm,
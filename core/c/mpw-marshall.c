@@ -178,7 +178,12 @@ static bool mpw_marshall_write_flat(
             continue;
 
         const char *content = NULL;
-        if (!user->redacted) {
+        if (site->type == MPResultTypeTemplateCustom) {
+            // There is no room for both, so even clear-text flat exports hold the template policy rather than the password.
+            if (site->content && strlen( site->content ))
+                content = strdup( site->content );
+        }
+        else if (!user->redacted) {
             // Clear Text
             if (!mpw_update_masterKey( &masterKey, &masterKeyAlgorithm, site->algorithm, user->fullName, user->masterPassword )) {
                 *error = (MPMarshallError){ MPMarshallErrorInternal, "Couldn't derive master key." };
@@ -311,11 +316,16 @@ static bool mpw_marshall_write_json(
         json_object_object_add( json_site, "_ext_mpw", json_site_mpw );
         if (site->url)
             json_object_object_add( json_site_mpw, "url", json_object_new_string( site->url ) );
+        if (!user->redacted && site->type == MPResultTypeTemplateCustom && site->content)
+            // Clear-text exports hold the password in place of the template policy.
+            json_object_object_add( json_site_mpw, "template", json_object_new_string( site->content ) );
 
         mpw_free_string( content );
     }
 
+    mpw_stage_begin( "json-serialize" );
     mpw_string_pushf( out, "%s\n", json_object_to_json_string_ext( json_file, JSON_C_TO_STRING_PRETTY | JSON_C_TO_STRING_SPACED ) );
+    mpw_stage_end( "json-serialize" );
     mpw_free( masterKey, MPMasterKeySize );
     json_object_put( json_file );
 
@@ -570,7 +580,12 @@ static MPMarshalledUser *mpw_marshall_read_flat(
             site->loginName = siteLoginName? strdup( siteLoginName ): NULL;
             site->uses = (unsigned int)atoi( str_uses );
             site->lastUsed = siteLastUsed;
-            if (siteContent && strlen( siteContent )) {
+            if (site->type == MPResultTypeTemplateCustom) {
+                // Both redacted and clear-text flat exports hold the template policy.
+                if (siteContent && strlen( siteContent ))
+                    site->content = strdup( siteContent );
+            }
+            else if (siteContent && strlen( siteContent )) {
                 if (!user->redacted) {
                     // Clear Text
                     if (!mpw_update_masterKey( &masterKey, &masterKeyAlgorithm, site->algorithm, fullName, masterPassword )) {
@@ -616,7 +631,9 @@ static void mpw_marshall_read_json_info(
 
     // Parse JSON.
     enum json_tokener_error json_error = json_tokener_success;
+    mpw_stage_begin( "json-parse" );
     json_object *json_file = json_tokener_parse_verbose( in, &json_error );
+    mpw_stage_end( "json-parse" );
     if (!json_file || json_error != json_tokener_success)
         return;
 
@@ -647,7 +664,9 @@ static MPMarshalledUser *mpw_marshall_read_json(
 
     // Parse JSON.
     enum json_tokener_error json_error = json_tokener_success;
+    mpw_stage_begin( "json-parse" );
     json_object *json_file = json_tokener_parse_verbose( in, &json_error );
+    mpw_stage_end( "json-parse" );
     if (!json_file || json_error != json_tokener_success) {
         *error = (MPMarshallError){ MPMarshallErrorStructure, mpw_str( "JSON error: %s", json_tokener_error_desc( json_error ) ) };
         return NULL;
@@ -743,6 +762,7 @@ static MPMarshalledUser *mpw_marshall_read_json(
 
         json_object *json_site_mpw = mpw_get_json_section( json_site.val, "_ext_mpw" );
         const char *siteURL = mpw_get_json_string( json_site_mpw, "url", NULL );
+        const char *siteTemplate = mpw_get_json_string( json_site_mpw, "template", NULL );
 
         MPMarshalledSite *site = mpw_marshall_site( user, siteName, siteType, siteCounter, siteAlgorithm );
         if (!site) {
@@ -755,7 +775,12 @@ static MPMarshalledUser *mpw_marshall_read_json(
         site->url = siteURL? strdup( siteURL ): NULL;
         site->uses = siteUses;
         site->lastUsed = siteLastUsed;
-        if (siteContent && strlen( siteContent )) {
+        if (site->type == MPResultTypeTemplateCustom) {
+            // Redacted exports hold the template policy as the site's content, clear-text exports hold it separately.
+            const char *sitePolicy = user->redacted? siteContent: siteTemplate;
+            site->content = sitePolicy && strlen( sitePolicy )? strdup( sitePolicy ): NULL;
+        }
+        else if (siteContent && strlen( siteContent )) {
             if (!user->redacted) {
                 // Clear Text
                 if (!mpw_update_masterKey( &masterKey, &masterKeyAlgorithm, site->algorithm, fullName, masterPassword )) {
@@ -34,6 +34,8 @@ typedef enum( unsigned int, MPMarshallFormat ) {
             MPMarshallFormatJSON,
 
     MPMarshallFormatDefault = MPMarshallFormatJSON,
+    MPMarshallFormatFirst = MPMarshallFormatFlat,
+    MPMarshallFormatLast = MPMarshallFormatJSON,
 };
 
 typedef enum( unsigned int, MPMarshallErrorType ) {
@@ -51,6 +51,8 @@ const MPResultType mpw_typeWithName(const char *typeName) {
             return MPResultTypeStatefulPersonal;
         if ('D' == typeName[0])
             return MPResultTypeStatefulDevice;
+        if ('c' == typeName[0])
+            return MPResultTypeTemplateCustom;
         if ('k' == typeName[0])
             return MPResultTypeDeriveKey;
     }
@@ -82,6 +84,8 @@ const MPResultType mpw_typeWithName(const char *typeName) {
         return MPResultTypeTemplateName;
     if (strncmp( mpw_nameForType( MPResultTypeTemplatePhrase ), stdTypeName, strlen( stdTypeName ) ) == 0)
         return MPResultTypeTemplatePhrase;
+    if (strncmp( mpw_nameForType( MPResultTypeTemplateCustom ), stdTypeName, strlen( stdTypeName ) ) == 0)
+        return MPResultTypeTemplateCustom;
     if (strncmp( mpw_nameForType( MPResultTypeStatefulPersonal ), stdTypeName, strlen( stdTypeName ) ) == 0)
         return MPResultTypeStatefulPersonal;
     if (strncmp( mpw_nameForType( MPResultTypeStatefulDevice ), stdTypeName, strlen( stdTypeName ) ) == 0)
@@ -112,6 +116,8 @@ const char *mpw_nameForType(MPResultType resultType) {
             return "name";
         case MPResultTypeTemplatePhrase:
             return "phrase";
+        case MPResultTypeTemplateCustom:
+            return "custom";
         case MPResultTypeStatefulPersonal:
             return "personal";
         case MPResultTypeStatefulDevice:
@@ -163,6 +169,10 @@ const char **mpw_templatesForType(MPResultType type, size_t *count) {
         case MPResultTypeTemplatePhrase:
             return mpw_alloc_array( count, const char *,
                     "cvcc cvc cvccvcv cvc", "cvc cvccvcvcv cvcv", "cv cvccv cvc cvcvccv" );
+        case MPResultTypeTemplateCustom: {
+            dbg( "Custom templates come from the site's template policy.\n" );
+            return NULL;
+        }
         default: {
             dbg( "Unknown generated type: %d\n", type );
             return NULL;
@@ -270,3 +280,111 @@ const char mpw_characterFromClass(char characterClass, uint8_t seedByte) {
 
     return classCharacters[seedByte % strlen( classCharacters )];
 }
+
+bool mpw_template(MPTemplate *template, const char *templateString) {
+
+    size_t length = templateString? strlen( templateString ): 0;
+    if (!length || length > MPTemplateLengthMax) {
+        dbg( "Unsupported template length: %zu\n", length );
+        return false;
+    }
+
+    template->length = length;
+    for (size_t c = 0; c < length; ++c) {
+        const char *classCharacters = mpw_charactersInClass( templateString[c] );
+        if (!classCharacters)
+            return false;
+
+        template->classes[c] = (MPTemplateClass){ .characters = classCharacters, .size = strlen( classCharacters ) };
+    }
+
+    return true;
+}
+
+static const MPTemplatePolicy *mpw_templatePolicy_invalid(MPTemplatePolicy *templatePolicy, const char *policy, const char *reason) {
+
+    dbg( "Invalid template policy: %s: %s\n", reason, policy );
+    mpw_templatePolicy_free( templatePolicy );
+
+    return NULL;
+}
+
+const MPTemplatePolicy *mpw_templatePolicy(const char *policy) {
+
+    if (!policy || !strlen( policy )) {
+        dbg( "Missing template policy.\n" );
+        return NULL;
+    }
+
+    // The characters of the sets take no more room than the policy itself, so the classes can point into a single buffer.
+    MPTemplatePolicy *templatePolicy = calloc( 1, sizeof( MPTemplatePolicy ) );
+    if (!templatePolicy || !(templatePolicy->sets = calloc( strlen( policy ) + 1, sizeof( char ) )))
+        return mpw_templatePolicy_invalid( templatePolicy, policy, "Couldn't allocate policy" );
+
+    char *sets = templatePolicy->sets;
+    MPTemplate *template = NULL;
+    for (const char *p = policy;; ++p) {
+        if (!template) {
+            MPTemplate *templates = realloc( templatePolicy->templates, (templatePolicy->templates_count + 1) * sizeof( MPTemplate ) );
+            if (!templates)
+                return mpw_templatePolicy_invalid( templatePolicy, policy, "Couldn't allocate template" );
+            template = &(templatePolicy->templates = templates)[templatePolicy->templates_count++];
+            template->length = 0;
+        }
+
+        if (!*p || *p == ',') {
+            if (!template->length)
+                return mpw_templatePolicy_invalid( templatePolicy, policy, "Empty template" );
+            if (!*p)
+                break;
+
+            template = NULL;
+            continue;
+        }
+        if (template->length >= MPTemplateLengthMax)
+            return mpw_templatePolicy_invalid( templatePolicy, policy, "Template too long for password seed" );
+
+        if (*p != '[') {
+            const char *classCharacters = mpw_charactersInClass( *p );
+            if (!classCharacters)
+                return mpw_templatePolicy_invalid( templatePolicy, policy, "Unknown character class" );
+
+            template->classes[template->length++] = (MPTemplateClass){
+                    .characters = classCharacters, .size = strlen( classCharacters ) };
+            continue;
+        }
+
+        const char *set = sets;
+        for (++p; *p != ']'; ++p) {
+            if (*p == '\\' && *(p + 1))
+                ++p;
+            if (!*p)
+                return mpw_templatePolicy_invalid( templatePolicy, policy, "Unterminated character set" );
+            if (*p < ' ' || *p > '~')
+                return mpw_templatePolicy_invalid( templatePolicy, policy, "Not a printable ASCII character in set" );
+            if (memchr( set, *p, (size_t)(sets - set) ))
+                return mpw_templatePolicy_invalid( templatePolicy, policy, "Duplicate character in set" );
+
+            *sets++ = *p;
+        }
+        if (sets == set)
+            return mpw_templatePolicy_invalid( templatePolicy, policy, "Empty character set" );
+
+        template->classes[template->length++] = (MPTemplateClass){ .characters = set, .size = (size_t)(sets - set) };
+    }
+
+    return templatePolicy;
+}
+
+bool mpw_templatePolicy_free(const MPTemplatePolicy *policy) {
+
+    if (!policy)
+        return false;
+
+    MPTemplatePolicy *templatePolicy = (MPTemplatePolicy *)policy;
+    free( templatePolicy->templates );
+    free( templatePolicy->sets );
+    free( templatePolicy );
+
+    return true;
+}
@@ -84,6 +84,8 @@ typedef enum( uint32_t, MPResultType ) {
             MPResultTypeTemplateName = 0xE | MPResultTypeClassTemplate | 0x0,
     /** bir yennoquce fefi */
             MPResultTypeTemplatePhrase = 0xF | MPResultTypeClassTemplate | 0x0,
+    /** A template policy of the site's own, see mpw_templatePolicy. */
+            MPResultTypeTemplateCustom = 0x6 | MPResultTypeClassTemplate | MPSiteFeatureExportContent,
 
     /** Custom saved password. */
             MPResultTypeStatefulPersonal = 0x0 | MPResultTypeClassStateful | MPSiteFeatureExportContent,
@@ -153,4 +155,45 @@ const char *mpw_charactersInClass(char characterClass);
  */
 const char mpw_characterFromClass(char characterClass, uint8_t seedByte);
 
+//// Templates.
+
+/** The maximum length of a template: every position is encoded from a byte of the site key after the one that picks the template. */
+#define MPTemplateLengthMax (MPSiteKeySize - 1)
+
+/** The characters that a position of a template encodes from. */
+typedef struct MPTemplateClass {
+    const char *characters;
+    size_t size;
+} MPTemplateClass;
+
+/** A template compiled into a table of the characters that each position of the password is encoded from. */
+typedef struct MPTemplate {
+    size_t length;
+    MPTemplateClass classes[MPTemplateLengthMax];
+} MPTemplate;
+
+/** A template policy compiled into the templates that a site key picks from. */
+typedef struct MPTemplatePolicy {
+    size_t templates_count;
+    MPTemplate *templates;
+    /** The characters of the policy's own character sets, which its templates' classes point into. */
+    char *sets;
+} MPTemplatePolicy;
+
+/**
+ * Compile a template of character classes, such as those of mpw_templatesForType.
+ * @return false if the template is empty, too long or uses an unknown character class.
+ */
+bool mpw_template(MPTemplate *template, const char *templateString);
+/**
+ * Compile a template policy for MPResultTypeTemplateCustom.
+ * A policy holds one or more templates separated by commas, the site key picks one of them like it does for the built-in types.
+ * Each position of a template is a character class of mpw_charactersInClass or a set of printable ASCII characters between
+ * brackets, in which a backslash escapes the next character.  eg. "nnnnnn" or "Cvcv[!#$]nnxx,nnCvcv[!#$]xx".
+ * @return A newly allocated policy that needs to be free'ed with mpw_templatePolicy_free, or NULL if the policy is not valid.
+ */
+const MPTemplatePolicy *mpw_templatePolicy(const char *policy);
+/** Free a template policy and its templates. */
+bool mpw_templatePolicy_free(const MPTemplatePolicy *policy);
+
 #endif // _MPW_TYPES_H
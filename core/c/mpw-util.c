@@ -38,6 +38,7 @@
 #ifdef inf_level
 int mpw_verbosity = inf_level;
 #endif
+MPStageObserver mpw_stage_observer = NULL;
 
 bool mpw_push_buf(uint8_t **const buffer, size_t *const bufferSize, const void *pushBuffer, const size_t pushSize) {
 
@@ -132,19 +133,23 @@ uint8_t const *mpw_kdf_scrypt(const size_t keySize, const char *secret, const ui
     if (!key)
         return NULL;
 
+    mpw_stage_begin( "scrypt" );
 #if HAS_CPERCIVA
     if (crypto_scrypt( (const uint8_t *)secret, strlen( secret ), salt, saltSize, N, r, p, key, keySize ) < 0) {
+        mpw_stage_end( "scrypt" );
         mpw_free( key, keySize );
         return NULL;
     }
 #elif HAS_SODIUM
     if (crypto_pwhash_scryptsalsa208sha256_ll( (const uint8_t *)secret, strlen( secret ), salt, saltSize, N, r, p, key, keySize ) != 0) {
+        mpw_stage_end( "scrypt" );
         mpw_free( key, keySize );
         return NULL;
     }
 #else
 #error No crypto support for mpw_scrypt.
 #endif
+    mpw_stage_end( "scrypt" );
 
     return key;
 }
@@ -204,19 +209,24 @@ uint8_t const *mpw_hash_hmac_sha256(const uint8_t *key, const size_t keySize, co
     if (!mac)
         return NULL;
 
+    mpw_stage_begin( "hmac-sha256" );
     HMAC_SHA256_Buf( key, keySize, message, messageSize, mac );
+    mpw_stage_end( "hmac-sha256" );
 #elif HAS_SODIUM
     uint8_t *const mac = malloc( crypto_auth_hmacsha256_BYTES );
     if (!mac)
         return NULL;
 
+    mpw_stage_begin( "hmac-sha256" );
     crypto_auth_hmacsha256_state state;
     if (crypto_auth_hmacsha256_init( &state, key, keySize ) != 0 ||
         crypto_auth_hmacsha256_update( &state, message, messageSize ) != 0 ||
         crypto_auth_hmacsha256_final( &state, mac ) != 0) {
+        mpw_stage_end( "hmac-sha256" );
         mpw_free( mac, crypto_auth_hmacsha256_BYTES );
         return NULL;
     }
+    mpw_stage_end( "hmac-sha256" );
 #else
 #error No crypto support for mpw_hmac_sha256.
 #endif
@@ -443,3 +453,115 @@ const size_t mpw_utf8_strlen(const char *utf8String) {
 
     return charlen;
 }
+
+#if MPW_ALLOC_STATS && defined(__GLIBC__)
+#include <malloc.h>
+
+// Interpose the C library's allocator so we can count the process' allocations and the bytes they hold.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *buffer, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *buffer);
+
+static size_t mpw_allocations, mpw_allocated, mpw_inUse, mpw_peak;
+
+static void *mpw_alloc_count(void *buffer) {
+
+    if (!buffer)
+        return NULL;
+
+    size_t size = malloc_usable_size( buffer );
+    __atomic_add_fetch( &mpw_allocations, 1, __ATOMIC_RELAXED );
+    __atomic_add_fetch( &mpw_allocated, size, __ATOMIC_RELAXED );
+
+    // Raise the peak if this allocation pushed the bytes in use beyond it.
+    size_t inUse = __atomic_add_fetch( &mpw_inUse, size, __ATOMIC_RELAXED );
+    for (size_t peak = __atomic_load_n( &mpw_peak, __ATOMIC_RELAXED ); inUse > peak;)
+        if (__atomic_compare_exchange_n( &mpw_peak, &peak, inUse, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED ))
+            break;
+
+    return buffer;
+}
+
+static void mpw_alloc_uncount(void *buffer) {
+
+    if (buffer)
+        __atomic_sub_fetch( &mpw_inUse, malloc_usable_size( buffer ), __ATOMIC_RELAXED );
+}
+
+void *malloc(size_t size) {
+
+    return mpw_alloc_count( __libc_malloc( size ) );
+}
+
+void *calloc(size_t count, size_t size) {
+
+    return mpw_alloc_count( __libc_calloc( count, size ) );
+}
+
+void *realloc(void *buffer, size_t size) {
+
+    // The old block is released when it is resized or when the new size is 0, but not when the resize fails.
+    size_t oldSize = buffer? malloc_usable_size( buffer ): 0;
+    void *resized = __libc_realloc( buffer, size );
+    if (resized || !size)
+        __atomic_sub_fetch( &mpw_inUse, oldSize, __ATOMIC_RELAXED );
+
+    return mpw_alloc_count( resized );
+}
+
+void *memalign(size_t alignment, size_t size) {
+
+    return mpw_alloc_count( __libc_memalign( alignment, size ) );
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+
+    return mpw_alloc_count( __libc_memalign( alignment, size ) );
+}
+
+int posix_memalign(void **buffer, size_t alignment, size_t size) {
+
+    if (!alignment || alignment % sizeof( void * ) || alignment & (alignment - 1))
+        return EINVAL;
+    if (!(*buffer = mpw_alloc_count( __libc_memalign( alignment, size ) )))
+        return ENOMEM;
+
+    return 0;
+}
+
+void free(void *buffer) {
+
+    mpw_alloc_uncount( buffer );
+    __libc_free( buffer );
+}
+
+bool mpw_alloc_stats(MPAllocStats *stats) {
+
+    if (!stats)
+        return false;
+
+    *stats = (MPAllocStats){
+            .allocations = __atomic_load_n( &mpw_allocations, __ATOMIC_RELAXED ),
+            .allocated = __atomic_load_n( &mpw_allocated, __ATOMIC_RELAXED ),
+            .inUse = __atomic_load_n( &mpw_inUse, __ATOMIC_RELAXED ),
+            .peak = __atomic_load_n( &mpw_peak, __ATOMIC_RELAXED ),
+    };
+    return true;
+}
+
+void mpw_alloc_stats_reset_peak() {
+
+    __atomic_store_n( &mpw_peak, __atomic_load_n( &mpw_inUse, __ATOMIC_RELAXED ), __ATOMIC_RELAXED );
+}
+#else
+
+bool mpw_alloc_stats(MPAllocStats *stats) {
+
+    return false;
+}
+
+void mpw_alloc_stats_reset_peak() {
+}
+#endif
@@ -186,4 +186,35 @@ const char *mpw_identicon(const char *fullName, const char *masterPassword);
 /** @return The amount of display characters in the given UTF-8 string. */
 const size_t mpw_utf8_strlen(const char *utf8String);
 
+//// Profiling.
+
+/** A function that is notified when the core begins or ends a stage of work, such as a key derivation. */
+typedef void (*MPStageObserver)(const char *stage, const bool begin);
+/** The observer to notify of the core's stages of work, or NULL (the default) to not notify anyone. */
+extern MPStageObserver mpw_stage_observer;
+#define mpw_stage_begin(stage) ({ \
+    if (mpw_stage_observer) \
+        mpw_stage_observer( stage, true ); })
+#define mpw_stage_end(stage) ({ \
+    if (mpw_stage_observer) \
+        mpw_stage_observer( stage, false ); })
+
+typedef struct MPAllocStats {
+    /** The amount of allocations (malloc, calloc, realloc & aligned allocation calls) made by the process so far. */
+    size_t allocations;
+    /** The amount of bytes allocated by the process so far, including the bytes of blocks that were freed since. */
+    size_t allocated;
+    /** The amount of bytes in blocks that are currently allocated. */
+    size_t inUse;
+    /** The highest amount of bytes in use at once since the process started or the peak was last reset. */
+    size_t peak;
+} MPAllocStats;
+/** Obtain the process' heap allocation statistics.
+  * Statistics are only gathered when built with MPW_ALLOC_STATS on a supported C library (glibc).
+  * Byte counts are those of the allocator's usable block sizes, which may exceed the requested sizes.
+  * @return false if allocation statistics are not available. */
+bool mpw_alloc_stats(MPAllocStats *stats);
+/** Reset the peak of the process' heap use to the bytes currently in use, to measure the peak of a stage of work. */
+void mpw_alloc_stats_reset_peak(void);
+
 #endif // _MPW_UTIL_H
@@ -93,7 +93,13 @@ public enum MPSiteType {
     StoredDevicePrivate( "Device", "AES-encrypted, not exported.", //
                          ImmutableList.of( "device" ), // NON-NLS
                          ImmutableList.<MPTemplate>of(), //
-                         MPSiteTypeClass.Stored, 0x1, MPSiteFeature.DevicePrivate );
+                         MPSiteTypeClass.Stored, 0x1, MPSiteFeature.DevicePrivate ),
+
+    // Last, since the ordinals of the other types are persisted.
+    GeneratedCustom( "Custom", "Template policy of the site's own.", //
+                     ImmutableList.of( "c", "custom" ), // NON-NLS
+                     ImmutableList.<MPTemplate>of(), //
+                     MPSiteTypeClass.Generated, 0x6, MPSiteFeature.ExportContent );
 
     static final Logger logger = Logger.get( MPSiteType.class );
 
@@ -188,13 +194,14 @@ public enum MPSiteType {
     /**
      * @param typeClass The class for which we look up types.
      *
-     * @return All types that support the given class.
+     * @return All types that support the given class, except for {@link #GeneratedCustom}, whose template policy is the site's own and
+     * can't be generated from here.
      */
     public static ImmutableList<MPSiteType> forClass(final MPSiteTypeClass typeClass) {
 
         ImmutableList.Builder<MPSiteType> types = ImmutableList.builder();
         for (final MPSiteType type : values())
-            if (type.getTypeClass() == typeClass)
+            if ((type.getTypeClass() == typeClass) && (type != GeneratedCustom))
                 types.add( type );
 
         return types.build();
@@ -231,6 +238,9 @@ public enum MPSiteType {
     }
 
     public MPTemplate getTemplateAtRollingIndex(final int templateIndex) {
+        if (templates.isEmpty())
+            throw logger.bug( "No templates for type: %s", this );
+
         return templates.get( templateIndex % templates.size() );
     }
 }
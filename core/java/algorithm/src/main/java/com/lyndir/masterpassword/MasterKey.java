@@ -22,11 +22,17 @@ import static com.lyndir.lhunath.opal.system.util.StringUtils.strf;
 
 import com.google.common.base.Preconditions;
 import com.google.common.primitives.UnsignedInteger;
+import com.google.common.util.concurrent.*;
 import com.lyndir.lhunath.opal.system.*;
 import com.lyndir.lhunath.opal.system.logging.Logger;
-import java.util.Arrays;
+import java.security.GeneralSecurityException;
+import java.util.*;
+import java.util.concurrent.*;
 import javax.annotation.Nonnull;
 import javax.annotation.Nullable;
+import javax.crypto.Mac;
+import javax.crypto.SecretKey;
+import javax.crypto.spec.SecretKeySpec;
 
 
 /**
@@ -38,12 +44,24 @@ public abstract class MasterKey {
     private static final Logger  logger               = Logger.get( MasterKey.class );
     private static       boolean allowNativeByDefault = true;
 
+    /**
+     * Every derivation holds tens of MiB of scrypt memory, so only a few run at once.
+     */
+    private static final int                      KDF_THREADS = Math.max( 1, Math.min( 2, Runtime.getRuntime().availableProcessors() / 2 ) );
+    private static final ThreadPoolExecutor       kdfThreads  = new ThreadPoolExecutor(
+            KDF_THREADS, KDF_THREADS, 0, TimeUnit.MILLISECONDS, new LinkedBlockingQueue<Runnable>(),
+            new ThreadFactoryBuilder().setNameFormat( "mpw-kdf-%d" ).setDaemon( true ).build() );
+    private static final ListeningExecutorService kdfExecutor = MoreExecutors.listeningDecorator( kdfThreads );
+    private static final List<Derivation>         derivations = new LinkedList<>();
+
     @Nonnull
     private final String fullName;
     private boolean allowNative = allowNativeByDefault;
 
     @Nullable
-    private byte[] masterKey;
+    private          byte[]   masterKey;
+    @Nullable
+    private volatile SiteMacs siteMacs;
 
     @SuppressWarnings("MethodCanBeVariableArityMethod")
     public static MasterKey create(final String fullName, final char[] masterPassword) {
@@ -55,15 +73,56 @@ public abstract class MasterKey {
     @SuppressWarnings("MethodCanBeVariableArityMethod")
     public static MasterKey create(final Version version, final String fullName, final char[] masterPassword) {
 
+        return newKey( version, fullName ).revalidate( masterPassword );
+    }
+
+    /**
+     * Derive the master key on a dedicated executor that runs only a few derivations at once.
+     * <p/>
+     * Identical requests that are in flight share a single derivation, but each gets a key of its own, so that invalidating or
+     * revalidating one doesn't affect the others.
+     * Cancellation is cooperative: a derivation is only cancelled when all its requests are.  If it hasn't started yet, it never
+     * will.  scrypt itself can't be interrupted, so a derivation that is running completes, but its key is invalidated rather
+     * than delivered.
+     *
+     * @return A future for the master key, cancelling it abandons the request.
+     */
+    @Nonnull
+    @SuppressWarnings("MethodCanBeVariableArityMethod")
+    public static ListenableFuture<MasterKey> createAsync(final Version version, final String fullName, final char[] masterPassword) {
+
+        synchronized (derivations) {
+            for (final Derivation derivation : derivations)
+                if (derivation.isFor( version, fullName, masterPassword ))
+                    return derivation.subscribe();
+
+            Derivation derivation = new Derivation( version, fullName, masterPassword );
+            derivations.add( derivation );
+            return derivation.start().subscribe();
+        }
+    }
+
+    @Nonnull
+    private static MasterKey newKey(final Version version, final String fullName) {
+
+        if (allowNativeByDefault && MasterKeyJNI.isAvailable() && MasterKeyJNI.isCompatible( version, fullName ))
+            return new MasterKeyJNI( version, fullName );
+
+        return newJavaKey( version, fullName );
+    }
+
+    @Nonnull
+    static MasterKey newJavaKey(final Version version, final String fullName) {
+
         switch (version) {
             case V0:
-                return new MasterKeyV0( fullName ).revalidate( masterPassword );
+                return new MasterKeyV0( fullName );
             case V1:
-                return new MasterKeyV1( fullName ).revalidate( masterPassword );
+                return new MasterKeyV1( fullName );
             case V2:
-                return new MasterKeyV2( fullName ).revalidate( masterPassword );
+                return new MasterKeyV2( fullName );
             case V3:
-                return new MasterKeyV3( fullName ).revalidate( masterPassword );
+                return new MasterKeyV3( fullName );
         }
 
         throw new UnsupportedOperationException( strf( "Unsupported version: %s", version ) );
@@ -78,7 +137,9 @@ public abstract class MasterKey {
      * Sometimes, however, we may prefer to use Java-only code.
      * For instance, for auditability / trust or because the native code doesn't work on our CPU/platform.
      * <p/>
-     * This setter affects the default setting for any newly created {@link MasterKey}s.
+     * This setter affects the default setting for any newly created {@link MasterKey}s,
+     * including whether they are implemented by the C core through {@link MasterKeyJNI} when it is available and derives the
+     * same results as the Java implementation.
      *
      * @param allowNative false to disallow the use of native libraries.
      */
@@ -96,6 +157,11 @@ public abstract class MasterKey {
     @SuppressWarnings("MethodCanBeVariableArityMethod")
     protected abstract byte[] deriveKey(char[] masterPassword);
 
+    /**
+     * @return The salt that the master key is derived with.  Keys for the user whose salts are equal have the same master key.
+     */
+    protected abstract byte[] masterKeySalt();
+
     public abstract Version getAlgorithmVersion();
 
     @Nonnull
@@ -128,18 +194,91 @@ public abstract class MasterKey {
     public abstract String encode(@Nonnull String siteName, MPSiteType siteType, @Nonnull UnsignedInteger siteCounter,
                                   MPSiteVariant siteVariant, @Nullable String siteContext);
 
+    /**
+     * Sign site information with the master key.  Each thread keys its own MAC with the master key once, so that encoding many
+     * sites doesn't re-key the HMAC for every site.
+     *
+     * @return The HMAC-SHA-256 of the site information, keyed with the master key.
+     */
+    protected byte[] siteSeed(final byte[] siteInfo) {
+        SiteMacs macs = siteMacs;
+        if (macs == null)
+            synchronized (this) {
+                if ((macs = siteMacs) == null)
+                    siteMacs = macs = new SiteMacs( getKey() );
+            }
+
+        return macs.sign( siteInfo );
+    }
+
     public boolean isValid() {
         return masterKey != null;
     }
 
     public void invalidate() {
 
+        SiteMacs macs = siteMacs;
+        siteMacs = null;
+        if (macs != null)
+            macs.wipe();
         if (masterKey != null) {
             Arrays.fill( masterKey, (byte) 0 );
             masterKey = null;
         }
     }
 
+    /**
+     * Get a key for another algorithm version without deriving it, which is possible when that version derives its master key
+     * with the same salt: V0 through V2 always do, V3 does too unless the full name has multi-byte characters.
+     *
+     * @return A key for the algorithm version with this key's master key, or {@code null} if this key isn't valid or the version
+     * derives a different master key.
+     */
+    @Nullable
+    public MasterKey forVersion(final Version algorithmVersion) {
+        if (algorithmVersion == getAlgorithmVersion())
+            return this;
+        if (!isValid())
+            return null;
+
+        MasterKey versionKey = newVersionKey( algorithmVersion );
+        if (!Arrays.equals( masterKeySalt(), versionKey.masterKeySalt() ))
+            return null;
+
+        versionKey.setAllowNative( isAllowNative() );
+        versionKey.adoptKey( this );
+        return versionKey;
+    }
+
+    /**
+     * @return A new, invalid key for the user of this key with the given algorithm version, of the same implementation as this key.
+     */
+    @Nonnull
+    protected MasterKey newVersionKey(final Version algorithmVersion) {
+        return newJavaKey( algorithmVersion, fullName );
+    }
+
+    /**
+     * @return A new key of the same version and implementation as this key, with a copy of this key's master key if it is valid.
+     */
+    @Nonnull
+    private MasterKey copy() {
+        MasterKey copy = newVersionKey( getAlgorithmVersion() );
+        copy.setAllowNative( isAllowNative() );
+        if (isValid())
+            copy.adoptKey( this );
+
+        return copy;
+    }
+
+    /**
+     * Take on a copy of the master key of a key with the same salt.
+     */
+    protected void adoptKey(final MasterKey key) {
+        invalidate();
+        masterKey = key.getKey().clone();
+    }
+
     @SuppressWarnings("MethodCanBeVariableArityMethod")
     public MasterKey revalidate(final char[] masterPassword) {
         invalidate();
@@ -164,6 +303,237 @@ public abstract class MasterKey {
 
     protected abstract byte[] idForBytes(byte[] bytes);
 
+    /**
+     * The MACs that threads sign site information with, keyed with the master key.
+     * <p/>
+     * The MACs are keyed from the master key itself rather than from a copy, and wiping them re-keys each of them with a blank key,
+     * so an invalidated key leaves no key material behind in them.  Keying a MAC hands the provider a copy of the key, which the
+     * SunJCE provider wipes once it is done with it.
+     */
+    private static final class SiteMacs extends ThreadLocal<Mac> {
+
+        private final SecretKey key;
+        private final List<Mac> macs = new LinkedList<>();
+        private volatile boolean wiped;
+
+        @SuppressWarnings("MethodCanBeVariableArityMethod")
+        SiteMacs(final byte[] key) {
+            this.key = new SiteKey( key );
+        }
+
+        @Override
+        protected Mac initialValue() {
+            try {
+                Mac mac = Mac.getInstance( key.getAlgorithm() );
+                synchronized (macs) {
+                    Preconditions.checkState( !wiped, "Master key was invalidated." );
+                    mac.init( key );
+                    macs.add( mac );
+                }
+
+                return mac;
+            }
+            catch (final GeneralSecurityException e) {
+                throw logger.bug( e );
+            }
+        }
+
+        byte[] sign(final byte[] siteInfo) {
+            Mac mac = get();
+            synchronized (mac) {
+                Preconditions.checkState( !wiped, "Master key was invalidated." );
+                return mac.doFinal( siteInfo );
+            }
+        }
+
+        void wipe() {
+            wiped = true;
+            synchronized (macs) {
+                for (final Mac mac : macs)
+                    synchronized (mac) {
+                        try {
+                            mac.init( new SecretKeySpec( new byte[1], key.getAlgorithm() ) );
+                        }
+                        catch (final GeneralSecurityException e) {
+                            throw logger.bug( e );
+                        }
+                    }
+                macs.clear();
+            }
+        }
+    }
+
+
+    /**
+     * The master key of a {@link MasterKey} as a {@link SecretKey}, without the copy that a {@link SecretKeySpec} keeps.
+     */
+    private static final class SiteKey implements SecretKey {
+
+        private static final long serialVersionUID = 1L;
+
+        private final byte[] key;
+
+        @SuppressWarnings("MethodCanBeVariableArityMethod")
+        SiteKey(final byte[] key) {
+            this.key = key;
+        }
+
+        @Override
+        public String getAlgorithm() {
+            return MPConstant.mpw_digest.name();
+        }
+
+        @Override
+        public String getFormat() {
+            return "RAW";
+        }
+
+        @Override
+        public byte[] getEncoded() {
+            return key.clone();
+        }
+    }
+
+
+    /**
+     * A master key derivation on the KDF executor, shared by the requests for it.  Guarded by {@link #derivations}.
+     */
+    private static final class Derivation implements Callable<MasterKey> {
+
+        private final Version version;
+        private final String  fullName;
+        private final char[]  masterPassword;
+
+        private ListenableFuture<MasterKey> future;
+        private int                         subscribers;
+        private int                         deliveries;
+        private boolean                     started;
+        private boolean                     cancelled;
+
+        @SuppressWarnings("MethodCanBeVariableArityMethod")
+        Derivation(final Version version, final String fullName, final char[] masterPassword) {
+            this.version = version;
+            this.fullName = fullName;
+            this.masterPassword = masterPassword.clone();
+        }
+
+        @SuppressWarnings("MethodCanBeVariableArityMethod")
+        boolean isFor(final Version version, final String fullName, final char[] masterPassword) {
+            return (this.version == version) && this.fullName.equals( fullName ) && Arrays.equals( this.masterPassword, masterPassword );
+        }
+
+        Derivation start() {
+            future = kdfExecutor.submit( this );
+            return this;
+        }
+
+        ListenableFuture<MasterKey> subscribe() {
+            Subscription subscription = new Subscription( this );
+            ++subscribers;
+            ++deliveries;
+            Futures.addCallback( future, subscription );
+
+            return subscription;
+        }
+
+        /**
+         * @return A copy of the derived key for a subscription, or {@code null} if it no longer wants one.  The derived key itself is
+         * invalidated once every subscription has been handed its copy.
+         */
+        @Nullable
+        MasterKey deliver(final MasterKey masterKey, final boolean wanted) {
+            try {
+                return wanted? masterKey.copy(): null;
+            }
+            finally {
+                synchronized (derivations) {
+                    if (--deliveries == 0)
+                        masterKey.invalidate();
+                }
+            }
+        }
+
+        void unsubscribe() {
+            synchronized (derivations) {
+                if (--subscribers > 0)
+                    return;
+
+                derivations.remove( this );
+                cancelled = true;
+                if (!started)
+                    Arrays.fill( masterPassword, (char) 0 );
+            }
+
+            future.cancel( true );
+            kdfThreads.purge();
+        }
+
+        @Override
+        public MasterKey call()
+                throws InterruptedException {
+            synchronized (derivations) {
+                if (cancelled)
+                    throw new InterruptedException( "Master key derivation was cancelled before it started." );
+                started = true;
+            }
+
+            try {
+                MasterKey masterKey = newKey( version, fullName ).revalidate( masterPassword );
+
+                synchronized (derivations) {
+                    if (cancelled || Thread.interrupted()) {
+                        masterKey.invalidate();
+                        throw new InterruptedException( "Master key derivation was cancelled." );
+                    }
+                }
+
+                return masterKey;
+            }
+            finally {
+                synchronized (derivations) {
+                    derivations.remove( this );
+                    Arrays.fill( masterPassword, (char) 0 );
+                }
+            }
+        }
+    }
+
+
+    /**
+     * One request's view of a shared derivation.
+     */
+    private static final class Subscription extends AbstractFuture<MasterKey> implements FutureCallback<MasterKey> {
+
+        private final Derivation derivation;
+
+        Subscription(final Derivation derivation) {
+            this.derivation = derivation;
+        }
+
+        @Override
+        public boolean cancel(final boolean mayInterruptIfRunning) {
+            if (!super.cancel( mayInterruptIfRunning ))
+                return false;
+
+            derivation.unsubscribe();
+            return true;
+        }
+
+        @Override
+        public void onSuccess(@Nullable final MasterKey result) {
+            set( (result == null)? null: derivation.deliver( result, !isCancelled() ) );
+        }
+
+        @Override
+        public void onFailure(@Nonnull final Throwable t) {
+            if (t instanceof CancellationException)
+                super.cancel( false );
+            else
+                setException( t );
+        }
+    }
+
+
     public enum Version {
         /**
          * bugs:
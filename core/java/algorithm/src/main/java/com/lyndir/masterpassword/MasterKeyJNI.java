@@ -0,0 +1,367 @@
+//==============================================================================
+// This file is part of Master Password.
+// Copyright (c) 2011-2017, Maarten Billemont.
+//
+// Master Password is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Master Password is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You can find a copy of the GNU General Public License in the
+// LICENSE file.  Alternatively, see <http://www.gnu.org/licenses/>.
+//==============================================================================
+
+package com.lyndir.masterpassword;
+
+import static com.lyndir.lhunath.opal.system.util.StringUtils.strf;
+
+import com.google.common.base.Preconditions;
+import com.google.common.primitives.UnsignedInteger;
+import com.lyndir.lhunath.opal.system.logging.Logger;
+import java.nio.*;
+import java.util.Arrays;
+import java.util.concurrent.locks.ReadWriteLock;
+import java.util.concurrent.locks.ReentrantReadWriteLock;
+import javax.annotation.Nonnull;
+import javax.annotation.Nullable;
+
+
+/**
+ * A master key that is derived and used by the C implementation of the algorithm, through the {@code mpw-jni} library.
+ * <p/>
+ * The key never enters the Java heap: it is held in locked native memory that is referenced by a handle, and strings
+ * are passed to the native code in direct buffers so they needn't be copied.
+ * {@link MasterKey#create(Version, String, char[])} uses this implementation when native libraries are allowed,
+ * {@code mpw-jni} can be found on the {@code java.library.path} and the C core derives the same results as the Java
+ * implementation for the key, see {@link #isCompatible(Version, String)}.
+ */
+public class MasterKeyJNI extends MasterKey {
+
+    private static final int MP_intLen = 32;
+
+    @SuppressWarnings("UnusedDeclaration")
+    private static final Logger  logger    = Logger.get( MasterKeyJNI.class );
+    private static final boolean available = load();
+
+    /**
+     * Direct buffers for the site name and context of each thread, reused between encodings.
+     */
+    private static final ThreadLocal<ByteBuffer[]> buffers = new ThreadLocal<ByteBuffer[]>() {
+        @Override
+        protected ByteBuffer[] initialValue() {
+            return new ByteBuffer[2];
+        }
+    };
+
+    private final Version       algorithmVersion;
+    private final ReadWriteLock handleLock = new ReentrantReadWriteLock();
+    private       long          handle;
+
+    /**
+     * @return true if the {@code mpw-jni} library is loaded.
+     */
+    public static boolean isAvailable() {
+        return available;
+    }
+
+    /**
+     * The C core counts strings in code points where the Java implementation counts them in UTF-16 units or bytes: before V3
+     * for the full name, and before V2 for site names and contexts too.  Keys for those derive results that differ from the
+     * ones the user's sites were created with.
+     *
+     * @return true if the C core derives the same master key for the user as the Java implementation, and the same results
+     * for any site.
+     */
+    public static boolean isCompatible(final Version algorithmVersion, final String fullName) {
+        if (algorithmVersion.compareTo( Version.V2 ) < 0)
+            return false;
+        if (algorithmVersion.compareTo( Version.V3 ) < 0)
+            return fullName.codePointCount( 0, fullName.length() ) == fullName.length();
+
+        return true;
+    }
+
+    private static boolean load() {
+        try {
+            System.loadLibrary( "mpw-jni" );
+            return true;
+        }
+        catch (final UnsatisfiedLinkError e) {
+            logger.dbg( "Native master key implementation is not available: %s", e.getLocalizedMessage() );
+            return false;
+        }
+    }
+
+    public MasterKeyJNI(final Version algorithmVersion, @Nonnull final String fullName) {
+        super( fullName );
+
+        Preconditions.checkState( available, "The mpw-jni library is not available." );
+        this.algorithmVersion = algorithmVersion;
+    }
+
+    @Override
+    public Version getAlgorithmVersion() {
+
+        return algorithmVersion;
+    }
+
+    @Nullable
+    @Override
+    protected byte[] deriveKey(final char[] masterPassword) {
+        throw new UnsupportedOperationException( "The master key is derived in native memory." );
+    }
+
+    @Nonnull
+    @Override
+    protected byte[] getKey() {
+        throw new UnsupportedOperationException( "The master key is held in native memory." );
+    }
+
+    @Override
+    protected byte[] masterKeySalt() {
+        // The salt of the Java key, which the C core derives with too as long as the key is compatible.
+        return newJavaKey( algorithmVersion, getFullName() ).masterKeySalt();
+    }
+
+    @Nullable
+    @Override
+    public MasterKey forVersion(final Version algorithmVersion) {
+        if ((algorithmVersion != this.algorithmVersion) && !isCompatible( algorithmVersion, getFullName() ))
+            return null;
+
+        return super.forVersion( algorithmVersion );
+    }
+
+    @Nonnull
+    @Override
+    protected MasterKey newVersionKey(final Version algorithmVersion) {
+        return new MasterKeyJNI( algorithmVersion, getFullName() );
+    }
+
+    @Override
+    protected void adoptKey(final MasterKey key) {
+        MasterKeyJNI nativeKey = (MasterKeyJNI) key;
+        invalidate();
+
+        long newHandle;
+        nativeKey.handleLock.readLock().lock();
+        try {
+            Preconditions.checkState( nativeKey.handle != 0 );
+            newHandle = copy( nativeKey.handle, algorithmVersion.toInt() );
+        }
+        finally {
+            nativeKey.handleLock.readLock().unlock();
+        }
+
+        handleLock.writeLock().lock();
+        try {
+            handle = newHandle;
+        }
+        finally {
+            handleLock.writeLock().unlock();
+        }
+    }
+
+    @Override
+    public byte[] getKeyID() {
+
+        handleLock.readLock().lock();
+        try {
+            Preconditions.checkState( handle != 0 );
+            return keyID( handle );
+        }
+        finally {
+            handleLock.readLock().unlock();
+        }
+    }
+
+    @Override
+    public String encode(@Nonnull final String siteName, final MPSiteType siteType, @Nonnull UnsignedInteger siteCounter,
+                         final MPSiteVariant siteVariant, @Nullable final String siteContext) {
+        Preconditions.checkArgument( siteType.getTypeClass() == MPSiteTypeClass.Generated );
+        Preconditions.checkArgument( !siteName.isEmpty() );
+
+        if (siteCounter.longValue() == 0)
+            siteCounter = UnsignedInteger.valueOf( (System.currentTimeMillis() / (MPConstant.mpw_counter_timeout * 1000)) * MPConstant.mpw_counter_timeout );
+
+        ByteBuffer[] threadBuffers = buffers.get();
+        ByteBuffer siteNameBuffer = threadBuffers[0] = string( threadBuffers[0], siteName );
+        ByteBuffer siteContextBuffer = ((siteContext == null) || siteContext.isEmpty())? null:
+                (threadBuffers[1] = string( threadBuffers[1], siteContext ));
+
+        handleLock.readLock().lock();
+        try {
+            Preconditions.checkState( handle != 0 );
+            return Preconditions.checkNotNull(
+                    siteResult( handle, siteNameBuffer, siteCounter.longValue(), keyPurpose( siteVariant ), siteContextBuffer,
+                                resultType( siteType ) ), "Couldn't encode site: %s", siteName );
+        }
+        finally {
+            handleLock.readLock().unlock();
+        }
+    }
+
+    @Override
+    public boolean isValid() {
+
+        handleLock.readLock().lock();
+        try {
+            return handle != 0;
+        }
+        finally {
+            handleLock.readLock().unlock();
+        }
+    }
+
+    @Override
+    public void invalidate() {
+
+        handleLock.writeLock().lock();
+        try {
+            if (handle != 0) {
+                free( handle );
+                handle = 0;
+            }
+        }
+        finally {
+            handleLock.writeLock().unlock();
+        }
+    }
+
+    @Override
+    @SuppressWarnings("MethodCanBeVariableArityMethod")
+    public MasterKey revalidate(final char[] masterPassword) {
+        invalidate();
+
+        long start = System.currentTimeMillis();
+        ByteBuffer masterPasswordBytes = MPConstant.mpw_charset.encode( CharBuffer.wrap( masterPassword ) );
+        ByteBuffer masterPasswordBuffer = ByteBuffer.allocateDirect( masterPasswordBytes.remaining() + 1 );
+        masterPasswordBuffer.put( masterPasswordBytes ).put( (byte) 0 );
+        Arrays.fill( masterPasswordBytes.array(), (byte) 0 );
+
+        try {
+            long newHandle = masterKey( string( null, getFullName() ), masterPasswordBuffer, algorithmVersion.toInt() );
+
+            handleLock.writeLock().lock();
+            try {
+                handle = newHandle;
+            }
+            finally {
+                handleLock.writeLock().unlock();
+            }
+        }
+        finally {
+            masterPasswordBuffer.clear();
+            while (masterPasswordBuffer.hasRemaining())
+                masterPasswordBuffer.put( (byte) 0 );
+        }
+
+        if (!isValid())
+            logger.dbg( "masterKey calculation failed after %.2fs.", (double) (System.currentTimeMillis() - start) / MPConstant.MS_PER_S );
+        else
+            logger.trc( "masterKey derived natively in %.2fs.", (double) (System.currentTimeMillis() - start) / MPConstant.MS_PER_S );
+
+        return this;
+    }
+
+    @Override
+    protected byte[] bytesForInt(final int number) {
+        return ByteBuffer.allocate( MP_intLen / Byte.SIZE ).order( MPConstant.mpw_byteOrder ).putInt( number ).array();
+    }
+
+    @Override
+    protected byte[] bytesForInt(@Nonnull final UnsignedInteger number) {
+        return ByteBuffer.allocate( MP_intLen / Byte.SIZE ).order( MPConstant.mpw_byteOrder ).putInt( number.intValue() ).array();
+    }
+
+    @Override
+    protected byte[] idForBytes(final byte[] bytes) {
+        return MPConstant.mpw_hash.of( bytes );
+    }
+
+    @Override
+    @SuppressWarnings("FinalizeDeclaration")
+    protected void finalize()
+            throws Throwable {
+        try {
+            invalidate();
+        }
+        finally {
+            super.finalize();
+        }
+    }
+
+    /**
+     * @return A direct buffer with the string as NUL-terminated UTF-8, the given buffer if it is large enough.
+     */
+    private static ByteBuffer string(@Nullable final ByteBuffer buffer, final String string) {
+        byte[] bytes = string.getBytes( MPConstant.mpw_charset );
+
+        ByteBuffer stringBuffer = buffer;
+        if ((stringBuffer == null) || (stringBuffer.capacity() < (bytes.length + 1)))
+            stringBuffer = ByteBuffer.allocateDirect( Math.max( bytes.length + 1, (stringBuffer == null)? 0: stringBuffer.capacity() * 2 ) );
+
+        stringBuffer.clear();
+        stringBuffer.put( bytes ).put( (byte) 0 );
+        return stringBuffer;
+    }
+
+    /**
+     * @return The C core's {@code MPKeyPurpose} for the site variant.
+     */
+    private static int keyPurpose(final MPSiteVariant siteVariant) {
+        switch (siteVariant) {
+            case Password:
+                return 0;
+            case Login:
+                return 1;
+            case Answer:
+                return 2;
+        }
+
+        throw new UnsupportedOperationException( strf( "Unsupported variant: %s", siteVariant ) );
+    }
+
+    /**
+     * @return The C core's {@code MPResultType} for the site type, whose template indexes differ from {@link MPSiteType}'s.
+     */
+    private static int resultType(final MPSiteType siteType) {
+        switch (siteType) {
+            case GeneratedMaximum:
+                return 0x10;
+            case GeneratedLong:
+                return 0x11;
+            case GeneratedMedium:
+                return 0x12;
+            case GeneratedBasic:
+                return 0x14;
+            case GeneratedShort:
+                return 0x13;
+            case GeneratedPIN:
+                return 0x15;
+            case GeneratedName:
+                return 0x1E;
+            case GeneratedPhrase:
+                return 0x1F;
+        }
+
+        throw new UnsupportedOperationException( strf( "Unsupported type: %s", siteType ) );
+    }
+
+    private static native long masterKey(ByteBuffer fullName, ByteBuffer masterPassword, int algorithmVersion);
+
+    private static native long copy(long handle, int algorithmVersion);
+
+    private static native byte[] keyID(long handle);
+
+    @Nullable
+    private static native String siteResult(long handle, ByteBuffer siteName, long siteCounter, int keyPurpose,
+                                            @Nullable ByteBuffer keyContext, int resultType);
+
+    private static native void free(long handle);
+}
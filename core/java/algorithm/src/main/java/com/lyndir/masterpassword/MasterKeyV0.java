@@ -59,13 +59,8 @@ public class MasterKeyV0 extends MasterKey {
     @Nullable
     @Override
     protected byte[] deriveKey(final char[] masterPassword) {
-        String fullName = getFullName();
-        byte[] fullNameBytes = fullName.getBytes( MPConstant.mpw_charset );
-        byte[] fullNameLengthBytes = bytesForInt( fullName.length() );
-
-        String mpKeyScope = MPSiteVariant.Password.getScope();
-        byte[] masterKeySalt = Bytes.concat( mpKeyScope.getBytes( MPConstant.mpw_charset ), fullNameLengthBytes, fullNameBytes );
-        logger.trc( "key scope: %s", mpKeyScope );
+        byte[] masterKeySalt = masterKeySalt();
+        logger.trc( "key scope: %s", MPSiteVariant.Password.getScope() );
         logger.trc( "masterKeySalt ID: %s", CodeUtils.encodeHex( idForBytes( masterKeySalt ) ) );
 
         ByteBuffer mpBytesBuf = MPConstant.mpw_charset.encode( CharBuffer.wrap( masterPassword ) );
@@ -76,6 +71,16 @@ public class MasterKeyV0 extends MasterKey {
         return scrypt( masterKeySalt, mpBytes );
     }
 
+    @Override
+    protected byte[] masterKeySalt() {
+        String fullName = getFullName();
+        byte[] fullNameBytes = fullName.getBytes( MPConstant.mpw_charset );
+        byte[] fullNameLengthBytes = bytesForInt( fullName.length() );
+
+        String mpKeyScope = MPSiteVariant.Password.getScope();
+        return Bytes.concat( mpKeyScope.getBytes( MPConstant.mpw_charset ), fullNameLengthBytes, fullNameBytes );
+    }
+
     @Nullable
     protected byte[] scrypt(final byte[] masterKeySalt, final byte[] mpBytes) {
         try {
@@ -123,7 +128,7 @@ public class MasterKeyV0 extends MasterKey {
             sitePasswordInfo = Bytes.concat( sitePasswordInfo, siteContextLengthBytes, siteContextBytes );
         logger.trc( "sitePasswordInfo ID: %s", CodeUtils.encodeHex( idForBytes( sitePasswordInfo ) ) );
 
-        byte[] sitePasswordSeedBytes = MPConstant.mpw_digest.of( getKey(), sitePasswordInfo );
+        byte[] sitePasswordSeedBytes = siteSeed( sitePasswordInfo );
         int[] sitePasswordSeed = new int[sitePasswordSeedBytes.length];
         for (int i = 0; i < sitePasswordSeedBytes.length; ++i) {
             ByteBuffer buf = ByteBuffer.allocate( Integer.SIZE / Byte.SIZE ).order( ByteOrder.BIG_ENDIAN );
@@ -19,12 +19,7 @@
 package com.lyndir.masterpassword;
 
 import com.google.common.primitives.Bytes;
-import com.lyndir.lhunath.opal.system.CodeUtils;
 import com.lyndir.lhunath.opal.system.logging.Logger;
-import java.nio.ByteBuffer;
-import java.nio.CharBuffer;
-import java.util.Arrays;
-import javax.annotation.Nullable;
 
 
 /**
@@ -48,22 +43,12 @@ public class MasterKeyV3 extends MasterKeyV2 {
         return Version.V3;
     }
 
-    @Nullable
     @Override
-    protected byte[] deriveKey(final char[] masterPassword) {
+    protected byte[] masterKeySalt() {
         byte[] fullNameBytes = getFullName().getBytes( MPConstant.mpw_charset );
         byte[] fullNameLengthBytes = bytesForInt( fullNameBytes.length );
 
         String mpKeyScope = MPSiteVariant.Password.getScope();
-        byte[] masterKeySalt = Bytes.concat( mpKeyScope.getBytes( MPConstant.mpw_charset ), fullNameLengthBytes, fullNameBytes );
-        logger.trc( "key scope: %s", mpKeyScope );
-        logger.trc( "masterKeySalt ID: %s", CodeUtils.encodeHex( idForBytes( masterKeySalt ) ) );
-
-        ByteBuffer mpBytesBuf = MPConstant.mpw_charset.encode( CharBuffer.wrap( masterPassword ) );
-        byte[] mpBytes = new byte[mpBytesBuf.remaining()];
-        mpBytesBuf.get( mpBytes, 0, mpBytes.length );
-        Arrays.fill( mpBytesBuf.array(), (byte) 0 );
-
-        return scrypt( masterKeySalt, mpBytes );
+        return Bytes.concat( mpKeyScope.getBytes( MPConstant.mpw_charset ), fullNameLengthBytes, fullNameBytes );
     }
 }
@@ -0,0 +1,144 @@
+//==============================================================================
+// This file is part of Master Password.
+// Copyright (c) 2011-2017, Maarten Billemont.
+//
+// Master Password is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Master Password is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You can find a copy of the GNU General Public License in the
+// LICENSE file.  Alternatively, see <http://www.gnu.org/licenses/>.
+//==============================================================================
+
+
+package com.lyndir.masterpassword;
+
+import com.google.common.collect.Iterables;
+import java.util.*;
+import org.openjdk.jmh.infra.BenchmarkParams;
+import org.openjdk.jmh.results.*;
+import org.openjdk.jmh.runner.Runner;
+import org.openjdk.jmh.runner.options.*;
+import org.openjdk.jmh.util.Statistics;
+
+
+/**
+ * Runs the benchmarks with JMH.
+ *
+ * <p>With {@code --json}, the results are printed in the format of {@code mpw-bench --json}, with the same case names and
+ * fixtures, so the Java and C implementations can be compared on the same machine.  Any other arguments are passed on to JMH.</p>
+ */
+public final class MPBench {
+
+    static final String fullName       = "Robert Lee Mitchel";
+    static final String masterPassword = "banana colored duckling";
+    static final String siteName       = "masterpasswordapp.com";
+
+    public static void main(final String... args)
+            throws Exception {
+        boolean json = false;
+        List<String> jmhArgs = new ArrayList<>();
+        for (final String arg : args)
+            if ("--json".equals( arg ))
+                json = true;
+            else
+                jmhArgs.add( arg );
+
+        ChainedOptionsBuilder options = new OptionsBuilder().parent( new CommandLineOptions( jmhArgs.toArray( new String[0] ) ) );
+        if (json)
+            options.verbosity( VerboseMode.SILENT );
+        Collection<RunResult> results = new Runner( options.build() ).run();
+        if (!json)
+            return;
+
+        StringBuilder output = new StringBuilder();
+        output.append( String.format( Locale.ROOT, "{ \"machine\": \"%s\", \"implementation\": \"java\", \"cases\": [", machine() ) );
+        boolean first = true;
+        for (final RunResult result : results) {
+            Statistics statistics = result.getPrimaryResult().getStatistics();
+            long iterations = 0;
+            for (final BenchmarkResult benchmarkResult : result.getBenchmarkResults())
+                for (final IterationResult iterationResult : benchmarkResult.getIterationResults())
+                    iterations += iterationResult.getMetadata().getMeasuredOps();
+            double ci95 = statistics.getMeanErrorAt( 0.95 );
+
+            output.append( String.format( Locale.ROOT, "%s\n  { \"name\": \"%s\", \"samples\": %d, \"iterations\": %d, "
+                                                       + "\"min_ns\": %.1f, \"median_ns\": %.1f, \"p99_ns\": %.1f, \"mean_ns\": %.1f, "
+                                                       + "\"ci95_ns\": %.1f, \"throughput\": %.3f, \"peak_rss_kb\": null, "
+                                                       + "\"allocations\": null, \"allocated_bytes\": null, \"peak_heap_bytes\": null }",
+                                          first? "": ",", caseName( result.getParams() ), statistics.getN(), iterations,
+                                          statistics.getMin(), statistics.getPercentile( 50 ), statistics.getPercentile( 99 ),
+                                          statistics.getMean(), Double.isNaN( ci95 )? 0: ci95,
+                                          items( result.getParams() ) * 1e9 / statistics.getMean() ) );
+            first = false;
+        }
+        output.append( "\n] }" );
+        System.out.println( output );
+    }
+
+    /**
+     * @return The name {@code mpw-bench} gives the same case, suffixed with {@code /java} if the native code wasn't allowed.
+     */
+    private static String caseName(final BenchmarkParams params) {
+        String benchmark = params.getBenchmark().substring( params.getBenchmark().lastIndexOf( '.' ) + 1 );
+        String name;
+        switch (benchmark) {
+            case "masterKey":
+                name = String.format( Locale.ROOT, "master-key/v%d", MasterKey.Version.valueOf( params.getParam( "version" ) ).toInt() );
+                break;
+            case "siteResult":
+                name = String.format( Locale.ROOT, "site-result/%s/v%d", //
+                                      Iterables.getLast( MPSiteType.valueOf( params.getParam( "type" ) ).getOptions() ),
+                                      MasterKey.Version.valueOf( params.getParam( "version" ) ).toInt() );
+                break;
+            case "marshallWrite":
+            case "marshallRead":
+            case "marshallInfo":
+                name = String.format( Locale.ROOT, "marshall-%s/flat/%s/%s", //
+                                      benchmark.substring( "marshall".length() ).toLowerCase( Locale.ROOT ),
+                                      params.getParam( "redaction" ), params.getParam( "sites" ) );
+                break;
+            default:
+                name = benchmark;
+        }
+
+        if ("false".equals( params.getParam( "allowNative" ) ))
+            name += "/java";
+
+        return name;
+    }
+
+    /**
+     * @return The amount of items a case handles per operation, ie. the sites marshalled.
+     */
+    private static long items(final BenchmarkParams params) {
+        String sites = params.getParam( "sites" );
+
+        return (sites == null)? 1: Long.parseLong( sites );
+    }
+
+    /**
+     * @return The class of this machine, named like {@code mpw-bench} does: its operating system, architecture and amount of
+     * processors.
+     */
+    private static String machine() {
+        String system = System.getProperty( "os.name" ).toLowerCase( Locale.ROOT );
+        if (system.startsWith( "mac os x" ))
+            system = "darwin";
+        else if (system.startsWith( "windows" ))
+            system = "windows";
+        String architecture = System.getProperty( "os.arch" ).toLowerCase( Locale.ROOT );
+        if ("amd64".equals( architecture ))
+            architecture = "x86_64";
+        else if ("aarch64".equals( architecture ) && "darwin".equals( system ))
+            architecture = "arm64";
+
+        return String.format( Locale.ROOT, "%s-%s-%dcpu", system, architecture, Runtime.getRuntime().availableProcessors() );
+    }
+}
@@ -0,0 +1,135 @@
+//==============================================================================
+// This file is part of Master Password.
+// Copyright (c) 2011-2017, Maarten Billemont.
+//
+// Master Password is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Master Password is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You can find a copy of the GNU General Public License in the
+// LICENSE file.  Alternatively, see <http://www.gnu.org/licenses/>.
+//==============================================================================
+
+
+package com.lyndir.masterpassword;
+
+import com.google.common.base.Charsets;
+import com.google.common.primitives.UnsignedInteger;
+import com.lyndir.masterpassword.model.*;
+import java.io.*;
+import java.nio.file.Files;
+import java.util.concurrent.TimeUnit;
+import org.openjdk.jmh.annotations.*;
+
+
+/**
+ * The marshalling of a synthetic user's sites in the flat format, named {@code marshall-<op>/flat/<redaction>/<sites>} like in
+ * {@code mpw-bench}, which generates its synthetic user the same way: from the same random draws, in the same order.
+ * <p/>
+ * The model has no URLs, questions, generated logins or stored passwords, so those draws are made but not used, and the
+ * {@link MPSiteType#StoredPersonal} sites export no content.  The model also sets the sites' last use to now.
+ * <p/>
+ * Neither benchmark times the master key derivation: the key is derived here during setup, while {@code mpw-bench} subtracts the
+ * derivations from its marshalling cases.
+ */
+@State(Scope.Benchmark)
+@BenchmarkMode(Mode.AverageTime)
+@OutputTimeUnit(TimeUnit.NANOSECONDS)
+@Warmup(iterations = 3, time = 1)
+@Measurement(iterations = 10, time = 1)
+@Fork(1)
+public class MarshallBenchmarks {
+
+    private static final String[]     words = {
+            "mail", "bank", "shop", "news", "cloud", "social", "forum", "games", "travel", "photo", //
+            "music", "video", "work", "school", "health", "energy", "phone", "insurance", "jobs", "tickets" };
+    private static final String[]     tlds  = { "com", "com", "com", "org", "net", "io", "co.uk", "de", "fr", "be" };
+    private static final MPSiteType[] types = {
+            MPSiteType.GeneratedLong, MPSiteType.GeneratedLong, MPSiteType.GeneratedLong, MPSiteType.GeneratedLong,
+            MPSiteType.GeneratedLong, MPSiteType.GeneratedLong, MPSiteType.GeneratedLong, MPSiteType.GeneratedMaximum,
+            MPSiteType.GeneratedMaximum, MPSiteType.GeneratedMedium, MPSiteType.GeneratedBasic, MPSiteType.GeneratedPIN,
+            MPSiteType.GeneratedShort, MPSiteType.GeneratedName, MPSiteType.GeneratedPhrase, MPSiteType.StoredPersonal };
+
+    @Param({ "10", "1000" })
+    public int sites;
+
+    @Param({ "redacted", "clear" })
+    public String redaction;
+
+    private MPUser    user;
+    private MasterKey masterKey;
+    private String    export;
+    private File      exportFile;
+
+    @Setup
+    public void setup()
+            throws IOException {
+        masterKey = MasterKey.create( MPBench.fullName, MPBench.masterPassword.toCharArray() );
+        user = new MPUser( MPBench.fullName, masterKey.getKeyID() );
+
+        long seed = sites;
+        for (int s = 0; s < sites; ++s) {
+            String word = words[(int) ((seed = random( seed )) % 20)];
+            String tld = tlds[(int) ((seed = random( seed )) % 10)];
+            long algorithm = (seed = random( seed )) % 10;
+            long counter = (seed = random( seed )) % 10;
+            MPSite site = new MPSite( user, word + s + '.' + tld, types[(int) ((seed = random( seed )) % 16)], //
+                                      (counter < 7)? MPSite.DEFAULT_COUNTER: UnsignedInteger.valueOf( counter - 5 ) );
+            site.setAlgorithmVersion( (algorithm < 8)? MasterKey.Version.CURRENT: //
+                                              (algorithm == 8)? MasterKey.Version.V2: MasterKey.Version.V1 );
+            if ((seed = random( seed )) % 10 < 3)
+                site.setLoginName( "user" + (seed = random( seed )) % 1000 + "@example.com" );
+            seed = random( seed ); // url
+            seed = random( seed ); // question
+            site.setUses( (int) ((seed = random( seed )) % 100) );
+            seed = random( seed ); // lastUsed
+            user.addSite( site );
+        }
+
+        export = marshall().getExport();
+        exportFile = File.createTempFile( "mpw-bench", ".mpsites" );
+        exportFile.deleteOnExit();
+        Files.write( exportFile.toPath(), export.getBytes( Charsets.UTF_8 ) );
+    }
+
+    @TearDown
+    public void tearDown() {
+        masterKey.invalidate();
+        if (!exportFile.delete())
+            exportFile.deleteOnExit();
+    }
+
+    @Benchmark
+    public String marshallWrite() {
+        return marshall().getExport();
+    }
+
+    @Benchmark
+    public MPUser marshallRead()
+            throws IOException {
+        return MPSiteUnmarshaller.unmarshall( new StringReader( export ) ).getUser();
+    }
+
+    @Benchmark
+    public MPUser marshallInfo()
+            throws IOException {
+        return MPSiteUnmarshaller.unmarshallHeader( exportFile ).getUser();
+    }
+
+    private MPSiteMarshaller marshall() {
+        return "clear".equals( redaction )? MPSiteMarshaller.marshallVisible( user, masterKey ): MPSiteMarshaller.marshallSafe( user );
+    }
+
+    /**
+     * The same sequence as {@code mpw_bench_random}, in unsigned 32-bit arithmetic.
+     */
+    private static long random(final long seed) {
+        return (seed * 1103515245L + 12345L) & 0xFFFFFFFFL;
+    }
+}
@@ -0,0 +1,58 @@
+//==============================================================================
+// This file is part of Master Password.
+// Copyright (c) 2011-2017, Maarten Billemont.
+//
+// Master Password is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Master Password is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You can find a copy of the GNU General Public License in the
+// LICENSE file.  Alternatively, see <http://www.gnu.org/licenses/>.
+//==============================================================================
+
+
+package com.lyndir.masterpassword;
+
+import java.util.concurrent.TimeUnit;
+import org.openjdk.jmh.annotations.*;
+
+
+/**
+ * The derivation of master keys, named {@code master-key/v<version>} like in {@code mpw-bench}.
+ */
+@State(Scope.Benchmark)
+@BenchmarkMode(Mode.AverageTime)
+@OutputTimeUnit(TimeUnit.NANOSECONDS)
+@Warmup(iterations = 1, time = 2)
+@Measurement(iterations = 5, time = 2)
+@Fork(1)
+public class MasterKeyBenchmarks {
+
+    @Param({ "V0", "V1", "V2", "V3" })
+    public MasterKey.Version version;
+
+    /**
+     * Whether the native C core or scrypt implementation may be used, or only Java.
+     */
+    @Param({ "true", "false" })
+    public boolean allowNative;
+
+    @Setup
+    public void setup() {
+        MasterKey.setAllowNativeByDefault( allowNative );
+    }
+
+    @Benchmark
+    public MasterKey masterKey() {
+        MasterKey masterKey = MasterKey.create( version, MPBench.fullName, MPBench.masterPassword.toCharArray() );
+        masterKey.invalidate();
+
+        return masterKey;
+    }
+}
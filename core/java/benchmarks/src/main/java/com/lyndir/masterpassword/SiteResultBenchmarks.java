@@ -0,0 +1,69 @@
+//==============================================================================
+// This file is part of Master Password.
+// Copyright (c) 2011-2017, Maarten Billemont.
+//
+// Master Password is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Master Password is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You can find a copy of the GNU General Public License in the
+// LICENSE file.  Alternatively, see <http://www.gnu.org/licenses/>.
+//==============================================================================
+
+
+package com.lyndir.masterpassword;
+
+import com.google.common.primitives.UnsignedInteger;
+import java.util.concurrent.TimeUnit;
+import org.openjdk.jmh.annotations.*;
+
+
+/**
+ * The encoding of site passwords with a master key, named {@code site-result/<type>/v<version>} like in {@code mpw-bench}.
+ */
+@State(Scope.Benchmark)
+@BenchmarkMode(Mode.AverageTime)
+@OutputTimeUnit(TimeUnit.NANOSECONDS)
+@Warmup(iterations = 3, time = 1)
+@Measurement(iterations = 10, time = 1)
+@Fork(1)
+public class SiteResultBenchmarks {
+
+    @Param({ "V0", "V1", "V2", "V3" })
+    public MasterKey.Version version;
+
+    @Param({
+            "GeneratedMaximum", "GeneratedLong", "GeneratedMedium", "GeneratedBasic", "GeneratedShort", "GeneratedPIN", "GeneratedName",
+            "GeneratedPhrase" })
+    public MPSiteType type;
+
+    /**
+     * Whether the native C core may be used, or only Java.
+     */
+    @Param({ "true", "false" })
+    public boolean allowNative;
+
+    private MasterKey masterKey;
+
+    @Setup
+    public void setup() {
+        MasterKey.setAllowNativeByDefault( allowNative );
+        masterKey = MasterKey.create( version, MPBench.fullName, MPBench.masterPassword.toCharArray() );
+    }
+
+    @TearDown
+    public void tearDown() {
+        masterKey.invalidate();
+    }
+
+    @Benchmark
+    public String siteResult() {
+        return masterKey.encode( MPBench.siteName, type, UnsignedInteger.ONE, MPSiteVariant.Password, null );
+    }
+}
@@ -0,0 +1,62 @@
+package com.lyndir.masterpassword.model;
+
+import com.lyndir.lhunath.opal.system.logging.Logger;
+import com.lyndir.masterpassword.MPSiteType;
+import com.lyndir.masterpassword.MasterKey;
+import java.io.File;
+import java.io.IOException;
+import javax.annotation.Nullable;
+import org.joda.time.ReadableInstant;
+
+
+/**
+ * A user read from the header of its file, whose sites are unmarshalled from the file when they're first needed.
+ */
+public class MPFileUser extends MPUser {
+
+    @SuppressWarnings("UnusedDeclaration")
+    private static final Logger logger = Logger.get( MPFileUser.class );
+
+    private File    file;
+    private boolean sitesLoaded;
+
+    public MPFileUser(final File file, final String fullName, @Nullable final byte[] keyID, final MasterKey.Version algorithmVersion,
+                      final int avatar, final MPSiteType defaultType, final ReadableInstant lastUsed) {
+        super( fullName, keyID, algorithmVersion, avatar, defaultType, lastUsed );
+
+        this.file = file;
+    }
+
+    @Override
+    protected synchronized boolean loadSites() {
+        if (sitesLoaded)
+            return true;
+
+        // Unmarshalling adds the sites to this user, which mustn't load them again nor count as a change.
+        boolean dirty = isDirty();
+        sitesLoaded = true;
+        try {
+            MPSiteUnmarshaller.unmarshallSites( file, this );
+        }
+        catch (final IOException e) {
+            logger.err( e, "Couldn't read sites for user: %s, from: %s", this, file );
+            sitesLoaded = false;
+        }
+        finally {
+            setDirty( dirty );
+        }
+
+        return sitesLoaded;
+    }
+
+    /**
+     * @return The file this user was read from, or last saved to.
+     */
+    public File getFile() {
+        return file;
+    }
+
+    void setFile(final File file) {
+        this.file = file;
+    }
+}
@@ -25,6 +25,8 @@ public class MPSite {
     private       UnsignedInteger   siteCounter;
     private       int               uses;
     private       String            loginName;
+    @Nullable
+    private       String            templatePolicy;
 
     public MPSite(final MPUser user, final String siteName) {
         this( user, siteName, DEFAULT_TYPE, DEFAULT_COUNTER );
@@ -50,9 +52,19 @@ public class MPSite {
         this.siteCounter = siteCounter;
         this.uses = uses;
         this.loginName = loginName;
+        if (siteType == MPSiteType.GeneratedCustom)
+            templatePolicy = importContent;
     }
 
+    /**
+     * @return The site's password, or for the sites whose password the master key doesn't generate (stored and custom sites), the
+     * content that is exported for them, if any.
+     */
+    @Nullable
     public String resultFor(final MasterKey masterKey) {
+        if ((siteType.getTypeClass() != MPSiteTypeClass.Generated) || (siteType == MPSiteType.GeneratedCustom))
+            return exportContent();
+
         return resultFor( masterKey, MPSiteVariant.Password, null );
     }
 
@@ -64,9 +76,13 @@ public class MPSite {
         return user;
     }
 
+    /**
+     * @return The content of the site that is exported as-is, which is only the template policy of {@link MPSiteType#GeneratedCustom}
+     * sites, kept so that saving a user doesn't lose the policies of the sites it can't generate.
+     */
     @Nullable
     protected String exportContent() {
-        return null;
+        return (siteType == MPSiteType.GeneratedCustom)? templatePolicy: null;
     }
 
     public MasterKey.Version getAlgorithmVersion() {
@@ -75,6 +91,7 @@ public class MPSite {
 
     public void setAlgorithmVersion(final MasterKey.Version mpVersion) {
         this.algorithmVersion = mpVersion;
+        user.setDirty( true );
     }
 
     public Instant getLastUsed() {
@@ -92,6 +109,7 @@ public class MPSite {
 
     public void setSiteName(final String siteName) {
         this.siteName = siteName;
+        user.setDirty( true );
     }
 
     public MPSiteType getSiteType() {
@@ -100,6 +118,7 @@ public class MPSite {
 
     public void setSiteType(final MPSiteType siteType) {
         this.siteType = siteType;
+        user.setDirty( true );
     }
 
     public UnsignedInteger getSiteCounter() {
@@ -108,6 +127,7 @@ public class MPSite {
 
     public void setSiteCounter(final UnsignedInteger siteCounter) {
         this.siteCounter = siteCounter;
+        user.setDirty( true );
     }
 
     public int getUses() {
@@ -116,6 +136,7 @@ public class MPSite {
 
     public void setUses(final int uses) {
         this.uses = uses;
+        user.setDirty( true );
     }
 
     public String getLoginName() {
@@ -124,6 +145,7 @@ public class MPSite {
 
     public void setLoginName(final String loginName) {
         this.loginName = loginName;
+        user.setDirty( true );
     }
 
     @Override
@@ -1,13 +1,17 @@
 package com.lyndir.masterpassword.model;
 
-import static com.lyndir.lhunath.opal.system.util.ObjectUtils.ifNotNullElse;
-import static com.lyndir.lhunath.opal.system.util.StringUtils.strf;
-
 import com.google.common.base.Preconditions;
+import com.google.common.collect.ImmutableList;
+import com.google.common.collect.Lists;
+import com.lyndir.lhunath.opal.system.logging.Logger;
 import com.lyndir.masterpassword.MasterKey;
+import java.io.IOException;
+import java.io.Writer;
+import java.util.List;
 import javax.annotation.Nonnull;
 import javax.annotation.Nullable;
 import org.joda.time.Instant;
+import org.joda.time.ReadableInstant;
 import org.joda.time.format.DateTimeFormatter;
 import org.joda.time.format.ISODateTimeFormat;
 
@@ -17,14 +21,62 @@ import org.joda.time.format.ISODateTimeFormat;
  */
 public class MPSiteMarshaller {
 
-    private static final DateTimeFormatter rfc3339 = ISODateTimeFormat.dateTimeNoMillis();
+    @SuppressWarnings("UnusedDeclaration")
+    private static final Logger            logger        = Logger.get( MPSiteMarshaller.class );
+    private static final DateTimeFormatter rfc3339       = ISODateTimeFormat.dateTimeNoMillis();
+    private static final char[]            spaces        = "                         ".toCharArray();
+    /**
+     * The amount of sites whose passwords a visible export computes at once.
+     */
+    private static final int               RESULTS_BATCH = 1024;
 
-    private final StringBuilder export      = new StringBuilder();
+    private final Appendable    export;
+    private final StringBuilder line        = new StringBuilder( 128 );
+    private       char[]        lineChars   = new char[128];
     private       ContentMode   contentMode = ContentMode.PROTECTED;
     private MasterKey masterKey;
 
+    private MPSiteMarshaller(final Appendable export) {
+        this.export = export;
+    }
+
     public static MPSiteMarshaller marshallSafe(final MPUser user) {
-        MPSiteMarshaller marshaller = new MPSiteMarshaller();
+        try {
+            return marshallSafe( user, new StringBuilder() );
+        }
+        catch (final IOException e) {
+            throw logger.bug( e );
+        }
+    }
+
+    public static MPSiteMarshaller marshallVisible(final MPUser user, final MasterKey masterKey) {
+        try {
+            return marshallVisible( user, masterKey, new StringBuilder() );
+        }
+        catch (final IOException e) {
+            throw logger.bug( e );
+        }
+    }
+
+    /**
+     * Write the export straight to a writer, site by site, instead of building it in memory.  The writer should be buffered.
+     */
+    public static MPSiteMarshaller marshallSafe(final MPUser user, final Writer writer)
+            throws IOException {
+        return marshallSafe( user, (Appendable) writer );
+    }
+
+    /**
+     * Write the export straight to a writer, site by site, instead of building it in memory.  The writer should be buffered.
+     */
+    public static MPSiteMarshaller marshallVisible(final MPUser user, final MasterKey masterKey, final Writer writer)
+            throws IOException {
+        return marshallVisible( user, masterKey, (Appendable) writer );
+    }
+
+    private static MPSiteMarshaller marshallSafe(final MPUser user, final Appendable export)
+            throws IOException {
+        MPSiteMarshaller marshaller = new MPSiteMarshaller( export );
         marshaller.marshallHeaderForSafeContent( user );
         for (final MPSite site : user.getSites())
             marshaller.marshallSite( site );
@@ -32,69 +84,106 @@ public class MPSiteMarshaller {
         return marshaller;
     }
 
-    public static MPSiteMarshaller marshallVisible(final MPUser user, final MasterKey masterKey) {
-        MPSiteMarshaller marshaller = new MPSiteMarshaller();
+    private static MPSiteMarshaller marshallVisible(final MPUser user, final MasterKey masterKey, final Appendable export)
+            throws IOException {
+        MPSiteMarshaller marshaller = new MPSiteMarshaller( export );
         marshaller.marshallHeaderForVisibleContentWithKey( user, masterKey );
-        for (final MPSite site : user.getSites())
-            marshaller.marshallSite( site );
+
+        // Compute the passwords in parallel, a batch at a time so that a written export still doesn't hold them all.
+        for (final List<MPSite> sites : Lists.partition( ImmutableList.copyOf( user.getSites() ), RESULTS_BATCH )) {
+            List<String> results = MPUser.resultsFor( masterKey, sites );
+            for (int s = 0; s < sites.size(); ++s)
+                marshaller.marshallSite( sites.get( s ), results.get( s ) );
+        }
 
         return marshaller;
     }
 
-    private String marshallHeaderForSafeContent(final MPUser user) {
-        return marshallHeader( ContentMode.PROTECTED, user, null );
+    private void marshallHeaderForSafeContent(final MPUser user)
+            throws IOException {
+        marshallHeader( ContentMode.PROTECTED, user, null );
     }
 
-    private String marshallHeaderForVisibleContentWithKey(final MPUser user, final MasterKey masterKey) {
-        return marshallHeader( ContentMode.VISIBLE, user, masterKey );
+    private void marshallHeaderForVisibleContentWithKey(final MPUser user, final MasterKey masterKey)
+            throws IOException {
+        marshallHeader( ContentMode.VISIBLE, user, masterKey );
     }
 
-    private String marshallHeader(final ContentMode contentMode, final MPUser user, @Nullable final MasterKey masterKey) {
+    private void marshallHeader(final ContentMode contentMode, final MPUser user, @Nullable final MasterKey masterKey)
+            throws IOException {
         this.contentMode = contentMode;
         this.masterKey = masterKey;
 
-        StringBuilder header = new StringBuilder();
-        header.append( "# Master Password site export\n" );
-        header.append( "#     " ).append( this.contentMode.description() ).append( '\n' );
-        header.append( "# \n" );
-        header.append( "##\n" );
-        header.append( "# Format: 1\n" );
-        header.append( "# Date: " ).append( rfc3339.print( new Instant() ) ).append( '\n' );
-        header.append( "# User Name: " ).append( user.getFullName() ).append( '\n' );
-        header.append( "# Full Name: " ).append( user.getFullName() ).append( '\n' );
-        header.append( "# Avatar: " ).append( user.getAvatar() ).append( '\n' );
-        header.append( "# Key ID: " ).append( user.exportKeyID() ).append( '\n' );
-        header.append( "# Version: " ).append( MasterKey.Version.CURRENT.toBundleVersion() ).append( '\n' );
-        header.append( "# Algorithm: " ).append( MasterKey.Version.CURRENT.toInt() ).append( '\n' );
-        header.append( "# Default Type: " ).append( user.getDefaultType().getType() ).append( '\n' );
-        header.append( "# Passwords: " ).append( this.contentMode.name() ).append( '\n' );
-        header.append( "##\n" );
-        header.append( "#\n" );
-        header.append( "#               Last     Times  Password                      Login\t                     Site\tSite\n" );
-        header.append( "#               used      used      type                       name\t                     name\tpassword\n" );
-
-        export.append( header );
-        return header.toString();
-    }
-
-    public String marshallSite(final MPSite site) {
-        String exportLine = strf( "%s  %8d  %8s  %25s\t%25s\t%s", //
-                                  rfc3339.print( site.getLastUsed() ), // lastUsed
-                                  site.getUses(), // uses
-                                  strf( "%d:%d:%d", //
-                                        site.getSiteType().getType(), // type
-                                        site.getAlgorithmVersion().toInt(), // algorithm
-                                        site.getSiteCounter().intValue() ), // counter
-                                  ifNotNullElse( site.getLoginName(), "" ), // loginName
-                                  site.getSiteName(), // siteName
-                                  ifNotNullElse( contentMode.contentForSite( site, masterKey ), "" ) // password
-        );
-        export.append( exportLine ).append( '\n' );
-
-        return exportLine;
+        line.setLength( 0 );
+        line.append( "# Master Password site export\n" );
+        line.append( "#     " ).append( this.contentMode.description() ).append( '\n' );
+        line.append( "# \n" );
+        line.append( "##\n" );
+        line.append( "# Format: 1\n" );
+        line.append( "# Date: " );
+        printInstant( line, new Instant() );
+        line.append( '\n' );
+        line.append( "# User Name: " ).append( user.getFullName() ).append( '\n' );
+        line.append( "# Full Name: " ).append( user.getFullName() ).append( '\n' );
+        line.append( "# Avatar: " ).append( user.getAvatar() ).append( '\n' );
+        line.append( "# Key ID: " ).append( user.exportKeyID() ).append( '\n' );
+        line.append( "# Version: " ).append( MasterKey.Version.CURRENT.toBundleVersion() ).append( '\n' );
+        line.append( "# Algorithm: " ).append( MasterKey.Version.CURRENT.toInt() ).append( '\n' );
+        line.append( "# Default Type: " ).append( user.getDefaultType().getType() ).append( '\n' );
+        line.append( "# Passwords: " ).append( this.contentMode.name() ).append( '\n' );
+        line.append( "##\n" );
+        line.append( "#\n" );
+        line.append( "#               Last     Times  Password                      Login\t                     Site\tSite\n" );
+        line.append( "#               used      used      type                       name\t                     name\tpassword\n" );
+
+        appendLine();
+    }
+
+    /**
+     * Append a site's line to the export.  Each line is formatted into the same buffer and appended as a whole.
+     */
+    public void marshallSite(final MPSite site)
+            throws IOException {
+        marshallSite( site, contentMode.contentForSite( site, masterKey ) );
+    }
+
+    private void marshallSite(final MPSite site, @Nullable final String content)
+            throws IOException {
+        line.setLength( 0 );
+        printInstant( line, site.getLastUsed() ); // lastUsed
+        line.append( "  " );
+        int start = line.length();
+        line.append( site.getUses() ); // uses
+        padStart( start, 8 );
+        line.append( "  " );
+        start = line.length();
+        line.append( site.getSiteType().getType() ).append( ':' ) // type
+            .append( site.getAlgorithmVersion().toInt() ).append( ':' ) // algorithm
+            .append( site.getSiteCounter().intValue() ); // counter
+        padStart( start, 8 );
+        line.append( "  " );
+        start = line.length();
+        String loginName = site.getLoginName();
+        if (loginName != null)
+            line.append( loginName ); // loginName
+        padStart( start, 25 );
+        line.append( '\t' );
+        start = line.length();
+        line.append( site.getSiteName() ); // siteName
+        padStart( start, 25 );
+        line.append( '\t' );
+        if (content != null)
+            line.append( content ); // password
+        line.append( '\n' );
+
+        appendLine();
     }
 
+    /**
+     * @return The export, if it was built in memory rather than written to a writer.
+     */
     public String getExport() {
+        Preconditions.checkState( export instanceof StringBuilder, "The export was written to a writer." );
         return export.toString();
     }
 
@@ -102,6 +191,71 @@ public class MPSiteMarshaller {
         return contentMode;
     }
 
+    /**
+     * Append the formatted line to the export.  Writers get it through a reusable array, rather than a new string for every line.
+     */
+    private void appendLine()
+            throws IOException {
+        if (!(export instanceof Writer)) {
+            export.append( line );
+            return;
+        }
+
+        if (lineChars.length < line.length())
+            lineChars = new char[Math.max( line.length(), lineChars.length * 2 )];
+        line.getChars( 0, line.length(), lineChars, 0 );
+        ((Writer) export).write( lineChars, 0, line.length() );
+    }
+
+    /**
+     * Right-align the text appended to the line since the start in a field of the given width, like {@code %<width>s}.
+     */
+    private void padStart(final int start, final int width) {
+        int padding = width - (line.length() - start);
+        if (padding > 0)
+            line.insert( start, spaces, 0, padding );
+    }
+
+    /**
+     * Append an instant in the format of {@link ISODateTimeFormat#dateTimeNoMillis()} in UTC, without allocating for the common
+     * case of a date from 1970 through 9999.
+     */
+    static void printInstant(final StringBuilder line, final ReadableInstant instant) {
+        long millis = instant.getMillis();
+        if ((millis < 0) || (millis >= 253402300800000L) || (instant.getZone().getOffset( millis ) != 0)) {
+            rfc3339.printTo( line, instant );
+            return;
+        }
+
+        // Civil from days: https://howardhinnant.github.io/date_algorithms.html
+        long seconds = millis / 1000;
+        int days = (int) (seconds / 86400), secondOfDay = (int) (seconds % 86400);
+        int z = days + 719468, era = z / 146097, dayOfEra = z - (era * 146097);
+        int yearOfEra = (dayOfEra - (dayOfEra / 1460) + (dayOfEra / 36524) - (dayOfEra / 146096)) / 365;
+        int dayOfYear = dayOfEra - ((365 * yearOfEra) + (yearOfEra / 4) - (yearOfEra / 100));
+        int monthIndex = ((5 * dayOfYear) + 2) / 153;
+        int day = (dayOfYear - (((153 * monthIndex) + 2) / 5)) + 1;
+        int month = (monthIndex < 10)? (monthIndex + 3): (monthIndex - 9);
+        int year = (yearOfEra + (era * 400)) + ((month <= 2)? 1: 0);
+
+        digits( line, year, 4 ).append( '-' );
+        digits( line, month, 2 ).append( '-' );
+        digits( line, day, 2 ).append( 'T' );
+        digits( line, secondOfDay / 3600, 2 ).append( ':' );
+        digits( line, (secondOfDay / 60) % 60, 2 ).append( ':' );
+        digits( line, secondOfDay % 60, 2 ).append( 'Z' );
+    }
+
+    private static StringBuilder digits(final StringBuilder line, final int value, final int count) {
+        int unit = 1;
+        for (int d = 1; d < count; ++d)
+            unit *= 10;
+        for (; unit > 0; unit /= 10)
+            line.append( (char) ('0' + ((value / unit) % 10)) );
+
+        return line;
+    }
+
     public enum ContentMode {
         PROTECTED( "Export of site names and stored passwords (unless device-private) encrypted with the master key." ) {
             @Override
@@ -112,6 +266,7 @@ public class MPSiteMarshaller {
         VISIBLE( "Export of site names and passwords in clear-text." ) {
             @Override
             public String contentForSite(final MPSite site, @Nonnull final MasterKey masterKey) {
+                // There is no room for both, so custom sites hold their template policy rather than their password.
                 return site.resultFor( Preconditions.checkNotNull( masterKey, "Master key is required when content mode is VISIBLE." ) );
             }
         };
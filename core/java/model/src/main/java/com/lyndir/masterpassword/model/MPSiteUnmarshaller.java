@@ -1,41 +1,42 @@
 package com.lyndir.masterpassword.model;
 
-import static com.lyndir.lhunath.opal.system.util.ObjectUtils.*;
-
 import com.google.common.base.Charsets;
+import com.google.common.base.Joiner;
 import com.google.common.base.Preconditions;
-import com.google.common.collect.ImmutableList;
-import com.google.common.io.CharStreams;
 import com.google.common.primitives.UnsignedInteger;
 import com.lyndir.lhunath.opal.system.CodeUtils;
 import com.lyndir.lhunath.opal.system.logging.Logger;
 import com.lyndir.lhunath.opal.system.util.ConversionUtils;
-import com.lyndir.lhunath.opal.system.util.NNOperation;
 import com.lyndir.masterpassword.MPSiteType;
 import com.lyndir.masterpassword.MasterKey;
 import java.io.*;
 import java.util.List;
-import java.util.regex.Matcher;
-import java.util.regex.Pattern;
 import javax.annotation.Nonnull;
 import javax.annotation.Nullable;
 import org.joda.time.DateTime;
+import org.joda.time.Instant;
 import org.joda.time.format.DateTimeFormatter;
 import org.joda.time.format.ISODateTimeFormat;
 
 
 /**
+ * Reads users and their sites from the flat {@code .mpsites} format.
+ * <p/>
+ * Files are read a line at a time and the lines are tokenized in place, so a file is never held in memory as a whole and reading a
+ * site only allocates its own fields.
+ *
  * @author lhunath, 14-12-07
  */
 public class MPSiteUnmarshaller {
 
     @SuppressWarnings("UnusedDeclaration")
-    private static final Logger            logger            = Logger.get( MPSite.class );
-    private static final DateTimeFormatter rfc3339           = ISODateTimeFormat.dateTimeNoMillis();
-    private static final Pattern[]         unmarshallFormats = {
-            Pattern.compile( "^([^ ]+) +(\\d+) +(\\d+)(:\\d+)? +([^\t]+)\t(.*)" ),
-            Pattern.compile( "^([^ ]+) +(\\d+) +(\\d+)(:\\d+)?(:\\d+)? +([^\t]*)\t *([^\t]+)\t(.*)" ) };
-    private static final Pattern           headerFormat      = Pattern.compile( "^#\\s*([^:]+): (.*)" );
+    private static final Logger            logger          = Logger.get( MPSite.class );
+    private static final DateTimeFormatter rfc3339         = ISODateTimeFormat.dateTimeNoMillis();
+    private static final int[]             daysInMonth     = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    private static final long              MS_PER_S        = 1000L;
+    private static final long              S_PER_DAY       = 24L * 60 * 60;
+    private static final int               DAYS_PER_ERA    = 146097;
+    private static final int               EPOCH_ERA_DAYS  = 719468;
 
     private final int     importFormat;
     @SuppressWarnings({ "FieldCanBeLocal", "unused" })
@@ -44,115 +45,206 @@ public class MPSiteUnmarshaller {
     private final boolean clearContent;
     private final MPUser  user;
 
+    /**
+     * The position of the tokenizer in the line being unmarshalled.
+     */
+    private int position;
+
     @Nonnull
     public static MPSiteUnmarshaller unmarshall(@Nonnull final File file)
             throws IOException {
-        try (Reader reader = new InputStreamReader( new FileInputStream( file ), Charsets.UTF_8 )) {
-            return unmarshall( CharStreams.readLines( reader ) );
+        try (InputStream inputStream = new FileInputStream( file )) {
+            return unmarshall( inputStream );
         }
     }
 
+    @Nonnull
+    public static MPSiteUnmarshaller unmarshall(@Nonnull final InputStream inputStream)
+            throws IOException {
+        return unmarshall( new InputStreamReader( inputStream, Charsets.UTF_8 ) );
+    }
+
+    @Nonnull
+    public static MPSiteUnmarshaller unmarshall(@Nonnull final Reader reader)
+            throws IOException {
+        MPSiteUnmarshaller marshaller = unmarshall( reader, null, null );
+        marshaller.getUser().setDirty( false );
+
+        return marshaller;
+    }
+
     @Nonnull
     public static MPSiteUnmarshaller unmarshall(@Nonnull final List<String> lines) {
+        try {
+            return unmarshall( new StringReader( Joiner.on( '\n' ).join( lines ) ) );
+        }
+        catch (final IOException e) {
+            throw logger.bug( e );
+        }
+    }
+
+    /**
+     * Read only the header of a user's file.  The sites are unmarshalled from the file when the user first needs them.
+     */
+    @Nonnull
+    public static MPSiteUnmarshaller unmarshallHeader(@Nonnull final File file)
+            throws IOException {
+        try (Reader reader = new InputStreamReader( new FileInputStream( file ), Charsets.UTF_8 )) {
+            return unmarshall( reader, file, null );
+        }
+    }
+
+    /**
+     * Unmarshall the sites in a user's file into the given user, whose header was read before.
+     */
+    @Nonnull
+    public static MPSiteUnmarshaller unmarshallSites(@Nonnull final File file, @Nonnull final MPUser user)
+            throws IOException {
+        try (Reader reader = new InputStreamReader( new FileInputStream( file ), Charsets.UTF_8 )) {
+            return unmarshall( reader, null, user );
+        }
+    }
+
+    /**
+     * @param userFile The file that holds the lines, to read a {@link MPFileUser} from its header only.
+     * @param user     The user to unmarshall the sites into, instead of a new user read from the header.
+     */
+    @Nonnull
+    private static MPSiteUnmarshaller unmarshall(@Nonnull final Reader reader, @Nullable final File userFile, @Nullable final MPUser user)
+            throws IOException {
         byte[] keyID = null;
         String fullName = null;
         int mpVersion = 0, importFormat = 0, avatar = 0;
         boolean clearContent = false, headerStarted = false;
         MPSiteType defaultType = MPSiteType.GeneratedLong;
         MPSiteUnmarshaller marshaller = null;
-        final ImmutableList.Builder<MPSite> sites = ImmutableList.builder();
 
-        for (final String line : lines)
+        BufferedReader lines = (reader instanceof BufferedReader)? (BufferedReader) reader: new BufferedReader( reader );
+        for (String line; (line = lines.readLine()) != null; )
             // Header delimitor.
             if (line.startsWith( "##" ))
                 if (!headerStarted)
                     // Starts the header.
                     headerStarted = true;
-                else
+                else {
                     // Ends the header.
-                    marshaller = new MPSiteUnmarshaller( importFormat, mpVersion, fullName, keyID, avatar, defaultType, clearContent );
+                    if (user != null)
+                        marshaller = new MPSiteUnmarshaller( importFormat, mpVersion, clearContent, user );
+                    else if (userFile != null)
+                        return new MPSiteUnmarshaller( importFormat, mpVersion, clearContent, new MPFileUser(
+                                userFile, fullName, keyID, MasterKey.Version.fromInt( mpVersion ), avatar, defaultType, new DateTime( 0 ) ) );
+                    else
+                        marshaller = new MPSiteUnmarshaller( importFormat, mpVersion, fullName, keyID, avatar, defaultType, clearContent );
+                }
 
                 // Comment.
             else if (line.startsWith( "#" )) {
                 if (headerStarted && (marshaller == null)) {
-                    // In header.
-                    Matcher headerMatcher = headerFormat.matcher( line );
-                    if (headerMatcher.matches()) {
-                        String name = headerMatcher.group( 1 ), value = headerMatcher.group( 2 );
-                        if ("Full Name".equalsIgnoreCase( name ) || "User Name".equalsIgnoreCase( name ))
-                            fullName = value;
-                        else if ("Key ID".equalsIgnoreCase( name ))
-                            keyID = CodeUtils.decodeHex( value );
-                        else if ("Algorithm".equalsIgnoreCase( name ))
-                            mpVersion = ConversionUtils.toIntegerNN( value );
-                        else if ("Format".equalsIgnoreCase( name ))
-                            importFormat = ConversionUtils.toIntegerNN( value );
-                        else if ("Avatar".equalsIgnoreCase( name ))
-                            avatar = ConversionUtils.toIntegerNN( value );
-                        else if ("Passwords".equalsIgnoreCase( name ))
-                            clearContent = "visible".equalsIgnoreCase( value );
-                        else if ("Default Type".equalsIgnoreCase( name ))
-                            defaultType = MPSiteType.forType( ConversionUtils.toIntegerNN( value ) );
-                    }
+                    // In header: "# <name>: <value>".
+                    int nameStart = 1;
+                    while ((nameStart < line.length()) && Character.isWhitespace( line.charAt( nameStart ) ))
+                        ++nameStart;
+                    int nameEnd = line.indexOf( ':', nameStart );
+                    if ((nameEnd <= nameStart) || ((nameEnd + 1) >= line.length()) || (line.charAt( nameEnd + 1 ) != ' '))
+                        continue;
+
+                    String value = line.substring( nameEnd + 2 );
+                    if (isHeader( line, nameStart, nameEnd, "Full Name" ) || isHeader( line, nameStart, nameEnd, "User Name" ))
+                        fullName = value;
+                    else if (isHeader( line, nameStart, nameEnd, "Key ID" ))
+                        keyID = CodeUtils.decodeHex( value );
+                    else if (isHeader( line, nameStart, nameEnd, "Algorithm" ))
+                        mpVersion = parseHeaderInt( value );
+                    else if (isHeader( line, nameStart, nameEnd, "Format" ))
+                        importFormat = parseHeaderInt( value );
+                    else if (isHeader( line, nameStart, nameEnd, "Avatar" ))
+                        avatar = parseHeaderInt( value );
+                    else if (isHeader( line, nameStart, nameEnd, "Passwords" ))
+                        clearContent = "visible".equalsIgnoreCase( value );
+                    else if (isHeader( line, nameStart, nameEnd, "Default Type" ))
+                        defaultType = MPSiteType.forType( parseHeaderInt( value ) );
                 }
             }
 
             // No comment.
             else if (marshaller != null)
-                ifNotNull( marshaller.unmarshallSite( line ), new NNOperation<MPSite>() {
-                    @Override
-                    public void apply(@Nonnull final MPSite site) {
-                        sites.add( site );
-                    }
-                } );
+                marshaller.unmarshallSite( line );
 
         return Preconditions.checkNotNull( marshaller, "No full header found in import file." );
     }
 
     protected MPSiteUnmarshaller(final int importFormat, final int mpVersion, final String fullName, final byte[] keyID, final int avatar,
                                  final MPSiteType defaultType, final boolean clearContent) {
+        this( importFormat, mpVersion, clearContent,
+              new MPUser( fullName, keyID, MasterKey.Version.fromInt( mpVersion ), avatar, defaultType, new DateTime( 0 ) ) );
+    }
+
+    protected MPSiteUnmarshaller(final int importFormat, final int mpVersion, final boolean clearContent, final MPUser user) {
         this.importFormat = importFormat;
         this.mpVersion = mpVersion;
         this.clearContent = clearContent;
-
-        user = new MPUser( fullName, keyID, MasterKey.Version.fromInt( mpVersion ), avatar, defaultType, new DateTime( 0 ) );
+        this.user = user;
     }
 
+    /**
+     * Format 0: {@code <lastUsed> <uses> <type>[:<algorithm>] <siteName>\t<content>}
+     * <br/>
+     * Format 1: {@code <lastUsed> <uses> <type>[:<algorithm>[:<counter>]] <loginName>\t<siteName>\t<content>}
+     * <p/>
+     * Fields are separated by any number of spaces, the padding around the tab-separated fields is not part of them.
+     *
+     * @return The site in the line, or {@code null} if the line doesn't hold a site in this unmarshaller's format.
+     */
     @Nullable
     public MPSite unmarshallSite(@Nonnull final String siteLine) {
-        Matcher siteMatcher = unmarshallFormats[importFormat].matcher( siteLine );
-        if (!siteMatcher.matches())
+        if ((importFormat != 0) && (importFormat != 1))
+            throw logger.bug( "Unexpected format: %d", importFormat );
+
+        position = 0;
+        int lastUsedEnd = siteLine.indexOf( ' ' );
+        if (lastUsedEnd <= 0)
             return null;
+        position = lastUsedEnd;
 
-        MPSite site;
-        switch (importFormat) {
-            case 0:
-                site = new MPSite( user, //
-                                   MasterKey.Version.fromInt( ConversionUtils.toIntegerNN( siteMatcher.group( 4 ).replace( ":", "" ) ) ), //
-                                   rfc3339.parseDateTime( siteMatcher.group( 1 ) ).toInstant(), //
-                                   siteMatcher.group( 5 ), //
-                                   MPSiteType.forType( ConversionUtils.toIntegerNN( siteMatcher.group( 3 ) ) ), MPSite.DEFAULT_COUNTER, //
-                                   ConversionUtils.toIntegerNN( siteMatcher.group( 2 ) ), //
-                                   null, //
-                                   siteMatcher.group( 6 ) );
-                break;
-
-            case 1:
-                site = new MPSite( user, //
-                                   MasterKey.Version.fromInt( ConversionUtils.toIntegerNN( siteMatcher.group( 4 ).replace( ":", "" ) ) ), //
-                                   rfc3339.parseDateTime( siteMatcher.group( 1 ) ).toInstant(), //
-                                   siteMatcher.group( 7 ), //
-                                   MPSiteType.forType( ConversionUtils.toIntegerNN( siteMatcher.group( 3 ) ) ),
-                                   UnsignedInteger.valueOf( siteMatcher.group( 5 ).replace( ":", "" ) ), //
-                                   ConversionUtils.toIntegerNN( siteMatcher.group( 2 ) ), //
-                                   siteMatcher.group( 6 ), //
-                                   siteMatcher.group( 8 ) );
-                break;
-
-            default:
-                throw logger.bug( "Unexpected format: %d", importFormat );
+        long uses = skipSpaces( siteLine )? parseNumber( siteLine ): -1;
+        long type = skipSpaces( siteLine )? parseNumber( siteLine ): -1;
+        if ((uses < 0) || (uses > Integer.MAX_VALUE) || (type < 0) || (type > Integer.MAX_VALUE))
+            return null;
+
+        long algorithm = mpVersion, counter = MPSite.DEFAULT_COUNTER.longValue();
+        if (skipChar( siteLine, ':' ) && ((algorithm = parseNumber( siteLine )) < 0))
+            return null;
+        if ((importFormat == 1) && skipChar( siteLine, ':' ) && ((counter = parseNumber( siteLine )) < 0))
+            return null;
+        if ((algorithm > Integer.MAX_VALUE) || (counter > UnsignedInteger.MAX_VALUE.longValue()) || !skipSpaces( siteLine ))
+            return null;
+
+        String loginName = null;
+        if (importFormat == 1) {
+            int loginNameEnd = siteLine.indexOf( '\t', position );
+            if (loginNameEnd < 0)
+                return null;
+            loginName = siteLine.substring( position, loginNameEnd );
+            position = loginNameEnd + 1;
+            skipSpaces( siteLine );
         }
 
+        int siteNameEnd = siteLine.indexOf( '\t', position );
+        if (siteNameEnd <= position)
+            return null;
+        String siteName = siteLine.substring( position, siteNameEnd );
+        String content = siteLine.substring( siteNameEnd + 1 );
+
+        MPSite site = new MPSite( user, //
+                                  MasterKey.Version.fromInt( (int) algorithm ), //
+                                  parseInstant( siteLine, 0, lastUsedEnd ), //
+                                  siteName, //
+                                  MPSiteType.forType( (int) type ), //
+                                  UnsignedInteger.valueOf( counter ), //
+                                  (int) uses, //
+                                  loginName, //
+                                  content );
+
         user.addSite( site );
         return site;
     }
@@ -160,4 +252,108 @@ public class MPSiteUnmarshaller {
     public MPUser getUser() {
         return user;
     }
+
+    /**
+     * Skip one or more spaces in the line.
+     *
+     * @return false if there was no space at the position.
+     */
+    private boolean skipSpaces(final String line) {
+        int start = position;
+        while ((position < line.length()) && (line.charAt( position ) == ' '))
+            ++position;
+
+        return position > start;
+    }
+
+    private boolean skipChar(final String line, final char c) {
+        if ((position >= line.length()) || (line.charAt( position ) != c))
+            return false;
+
+        ++position;
+        return true;
+    }
+
+    /**
+     * @return The value of the digits at the position, or -1 if there are no digits or their value doesn't fit.
+     */
+    private long parseNumber(final String line) {
+        int start = position;
+        long number = 0;
+        for (char c; (position < line.length()) && ((c = line.charAt( position )) >= '0') && (c <= '9'); ++position) {
+            number = (number * 10) + (c - '0');
+            if (number > Integer.MAX_VALUE * 2L + 1)
+                return -1;
+        }
+
+        return (position > start)? number: -1;
+    }
+
+    private static boolean isHeader(final String line, final int nameStart, final int nameEnd, final String header) {
+        return ((nameEnd - nameStart) == header.length()) && line.regionMatches( true, nameStart, header, 0, header.length() );
+    }
+
+    private static int parseHeaderInt(final String value) {
+        int number = 0;
+        for (int i = 0; i < value.length(); ++i) {
+            char c = value.charAt( i );
+            if ((c < '0') || (c > '9'))
+                return ConversionUtils.toIntegerNN( value );
+            number = (number * 10) + (c - '0');
+        }
+
+        return number;
+    }
+
+    /**
+     * Parse a timestamp in the fixed {@code yyyy-MM-dd'T'HH:mm:ss} form followed by {@code Z} or a {@code ±HH:mm} offset, which is
+     * how sites are marshalled.  Other forms are left to the general RFC 3339 parser.
+     */
+    static Instant parseInstant(final String line, final int start, final int end) {
+        int length = end - start;
+        if (((length == 20) && (line.charAt( start + 19 ) == 'Z')) || (length == 25)) {
+            int year = digits( line, start, 4 ), month = digits( line, start + 5, 2 ), day = digits( line, start + 8, 2 );
+            int hour = digits( line, start + 11, 2 ), minute = digits( line, start + 14, 2 ), second = digits( line, start + 17, 2 );
+            int offset = 0;
+            if (length == 25) {
+                int offsetHours = digits( line, start + 20, 2 ), offsetMinutes = digits( line, start + 23, 2 );
+                char sign = line.charAt( start + 19 );
+                offset = ((sign != '+') && (sign != '-')) || (line.charAt( start + 22 ) != ':') || (offsetHours < 0) || (offsetHours > 23)
+                         || (offsetMinutes < 0) || (offsetMinutes > 59)? Integer.MIN_VALUE: ((sign == '-')? -1: 1) * ((offsetHours * 60) + offsetMinutes) * 60;
+            }
+
+            if ((line.charAt( start + 4 ) == '-') && (line.charAt( start + 7 ) == '-') && (line.charAt( start + 10 ) == 'T')
+                && (line.charAt( start + 13 ) == ':') && (line.charAt( start + 16 ) == ':') && (offset != Integer.MIN_VALUE)
+                && (year >= 0) && (month >= 1) && (month <= 12) && (day >= 1) && (hour >= 0) && (hour <= 23)
+                && (minute >= 0) && (minute <= 59) && (second >= 0) && (second <= 59)
+                && (day <= (((month == 2) && ((year % 4) == 0) && (((year % 100) != 0) || ((year % 400) == 0)))? 29: daysInMonth[month - 1]))) {
+                // Days since the epoch of the proleptic Gregorian date, counted in 400-year eras that start on March 1st.
+                int eraYear = (month <= 2)? year - 1: year;
+                int era = ((eraYear >= 0)? eraYear: eraYear - 399) / 400;
+                int yearOfEra = eraYear - (era * 400);
+                int dayOfYear = (((153 * (month + ((month > 2)? -3: 9))) + 2) / 5) + day - 1;
+                int dayOfEra = (yearOfEra * 365) + (yearOfEra / 4) - (yearOfEra / 100) + dayOfYear;
+                long days = ((long) era * DAYS_PER_ERA) + dayOfEra - EPOCH_ERA_DAYS;
+
+                return new Instant( (((days * S_PER_DAY) + (hour * 3600L) + (minute * 60L) + second) - offset) * MS_PER_S );
+            }
+        }
+
+        return rfc3339.parseDateTime( line.substring( start, end ) ).toInstant();
+    }
+
+    /**
+     * @return The value of the decimal digits at the offset, or -1 if they aren't all digits.
+     */
+    private static int digits(final String line, final int offset, final int count) {
+        int number = 0;
+        for (int i = offset; i < (offset + count); ++i) {
+            char c = line.charAt( i );
+            if ((c < '0') || (c > '9'))
+                return -1;
+            number = (number * 10) + (c - '0');
+        }
+
+        return number;
+    }
 }
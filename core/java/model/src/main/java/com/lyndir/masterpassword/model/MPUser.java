@@ -8,6 +8,8 @@ import com.lyndir.lhunath.opal.system.CodeUtils;
 import com.lyndir.masterpassword.MPSiteType;
 import com.lyndir.masterpassword.MasterKey;
 import java.util.*;
+import java.util.concurrent.ForkJoinPool;
+import java.util.concurrent.RecursiveAction;
 import javax.annotation.Nonnull;
 import javax.annotation.Nullable;
 import org.joda.time.*;
@@ -18,6 +20,8 @@ import org.joda.time.*;
  */
 public class MPUser implements Comparable<MPUser> {
 
+    private static final ForkJoinPool resultsPool = new ForkJoinPool();
+
     private final String fullName;
     private final Collection<MPSite> sites = Sets.newHashSet();
 
@@ -27,6 +31,7 @@ public class MPUser implements Comparable<MPUser> {
     private       int               avatar;
     private       MPSiteType        defaultType;
     private       ReadableInstant   lastUsed;
+    private       boolean           dirty;
 
     public MPUser(final String fullName) {
         this( fullName, null );
@@ -55,12 +60,39 @@ public class MPUser implements Comparable<MPUser> {
         return results.build();
     }
 
+    /**
+     * Compute the passwords of all of this user's sites at once, in parallel.
+     *
+     * @return The result of each site, in the order of {@link #getSites()}, see {@link MPSite#resultFor(MasterKey)}.
+     */
+    public List<String> resultsFor(final MasterKey masterKey) {
+        return resultsFor( masterKey, ImmutableList.copyOf( getSites() ) );
+    }
+
+    /**
+     * Compute the passwords of many sites at once, in parallel.  The master key signs the sites on every thread with a MAC it
+     * keyed only once for that thread.
+     *
+     * @return The result of each site, in the order of the given sites, see {@link MPSite#resultFor(MasterKey)}.
+     */
+    public static List<String> resultsFor(final MasterKey masterKey, final Collection<MPSite> sites) {
+        List<MPSite> siteList = ImmutableList.copyOf( sites );
+        String[] results = new String[siteList.size()];
+        resultsPool.invoke( new SiteResults( masterKey, siteList, results, 0, results.length ) );
+
+        return Arrays.asList( results );
+    }
+
     public void addSite(final MPSite site) {
+        loadSites();
         sites.add( site );
+        dirty = true;
     }
 
     public void deleteSite(final MPSite site) {
-        sites.remove( site );
+        loadSites();
+        if (sites.remove( site ))
+            dirty = true;
     }
 
     public String getFullName() {
@@ -91,8 +123,10 @@ public class MPUser implements Comparable<MPUser> {
     public MasterKey authenticate(final char[] masterPassword)
             throws IncorrectMasterPasswordException {
         MasterKey masterKey = MasterKey.create( algorithmVersion, getFullName(), masterPassword );
-        if ((keyID == null) || (keyID.length == 0))
+        if ((keyID == null) || (keyID.length == 0)) {
             keyID = masterKey.getKeyID();
+            dirty = true;
+        }
         else if (!Arrays.equals( masterKey.getKeyID(), keyID ))
             throw new IncorrectMasterPasswordException( this );
 
@@ -105,6 +139,7 @@ public class MPUser implements Comparable<MPUser> {
 
     public void setAvatar(final int avatar) {
         this.avatar = avatar;
+        dirty = true;
     }
 
     public MPSiteType getDefaultType() {
@@ -113,6 +148,7 @@ public class MPUser implements Comparable<MPUser> {
 
     public void setDefaultType(final MPSiteType defaultType) {
         this.defaultType = defaultType;
+        dirty = true;
     }
 
     public ReadableInstant getLastUsed() {
@@ -121,12 +157,34 @@ public class MPUser implements Comparable<MPUser> {
 
     public void updateLastUsed() {
         lastUsed = new Instant();
+        dirty = true;
     }
 
     public Iterable<MPSite> getSites() {
+        loadSites();
         return sites;
     }
 
+    /**
+     * Make sure the user's sites are available.  Users hold all their sites from the start, unless they are loaded lazily.
+     *
+     * @return false if the user's sites could not be loaded.
+     */
+    protected boolean loadSites() {
+        return true;
+    }
+
+    /**
+     * @return true if the user or any of its sites changed since the user was last read or saved.
+     */
+    public boolean isDirty() {
+        return dirty;
+    }
+
+    public void setDirty(final boolean dirty) {
+        this.dirty = dirty;
+    }
+
     @Override
     public boolean equals(final Object obj) {
         return (this == obj) || ((obj instanceof MPUser) && Objects.equals( fullName, ((MPUser) obj).fullName ));
@@ -150,4 +208,39 @@ public class MPUser implements Comparable<MPUser> {
 
         return comparison;
     }
+
+    /**
+     * Computes the passwords of a range of sites, splitting it over the pool's threads until the ranges are small.
+     */
+    private static class SiteResults extends RecursiveAction {
+
+        private static final int THRESHOLD = 16;
+
+        private final MasterKey    masterKey;
+        private final List<MPSite> sites;
+        private final String[]     results;
+        private final int          from;
+        private final int          to;
+
+        SiteResults(final MasterKey masterKey, final List<MPSite> sites, final String[] results, final int from, final int to) {
+            this.masterKey = masterKey;
+            this.sites = sites;
+            this.results = results;
+            this.from = from;
+            this.to = to;
+        }
+
+        @Override
+        protected void compute() {
+            if (to - from <= THRESHOLD) {
+                for (int s = from; s < to; ++s)
+                    results[s] = sites.get( s ).resultFor( masterKey );
+                return;
+            }
+
+            int middle = (from + to) >>> 1;
+            invokeAll( new SiteResults( masterKey, sites, results, from, middle ),
+                       new SiteResults( masterKey, sites, results, middle, to ) );
+        }
+    }
 }
@@ -1,13 +1,16 @@
 package com.lyndir.masterpassword.model;
 
 import static com.lyndir.lhunath.opal.system.util.ObjectUtils.*;
+import static com.lyndir.lhunath.opal.system.util.StringUtils.*;
 
 import com.google.common.base.*;
 import com.google.common.collect.*;
-import com.google.common.io.CharSink;
 import com.lyndir.lhunath.opal.system.logging.Logger;
 import com.lyndir.masterpassword.MPConstant;
 import java.io.*;
+import java.nio.file.AtomicMoveNotSupportedException;
+import java.nio.file.Files;
+import java.nio.file.StandardCopyOption;
 import javax.annotation.Nullable;
 
 
@@ -52,12 +55,13 @@ public class MPUserFileManager extends MPUserManager {
             return ImmutableList.of();
         }
 
+        // Only the headers are read now, a user's sites are read from its file when they're first needed.
         return FluentIterable.from( listUserFiles( userFilesDirectory ) ).transform( new Function<File, MPUser>() {
             @Nullable
             @Override
             public MPUser apply(@Nullable final File file) {
                 try {
-                    return MPSiteUnmarshaller.unmarshall( Preconditions.checkNotNull( file ) ).getUser();
+                    return MPSiteUnmarshaller.unmarshallHeader( Preconditions.checkNotNull( file ) ).getUser();
                 }
                 catch (final IOException e) {
                     logger.err( e, "Couldn't read user from: %s", file );
@@ -78,6 +82,7 @@ public class MPUserFileManager extends MPUserManager {
 
     @Override
     public void addUser(final MPUser user) {
+        user.setDirty( true );
         super.addUser( user );
         save();
     }
@@ -85,34 +90,81 @@ public class MPUserFileManager extends MPUserManager {
     @Override
     public void deleteUser(final MPUser user) {
         super.deleteUser( user );
+
+        File userFile = getUserFile( user );
+        if (userFile.exists() && !userFile.delete())
+            logger.err( "Couldn't delete file: %s", userFile );
+        if (user instanceof MPFileUser) {
+            File readFile = ((MPFileUser) user).getFile();
+            if (!readFile.equals( userFile ) && readFile.exists() && !readFile.delete())
+                logger.err( "Couldn't delete file: %s", readFile );
+        }
+
         save();
     }
 
     /**
-     * Write the current user state to disk.
+     * Write the users that changed since they were read or last saved to disk.
      */
-    public void save() {
-        // Save existing users.
+    public synchronized void save() {
         for (final MPUser user : getUsers())
+            if (user.isDirty())
+                try {
+                    save( user );
+                }
+                catch (final IOException e) {
+                    logger.err( e, "Unable to save sites for user: %s", user );
+                }
+    }
+
+    /**
+     * Replace the user's file with its current state.  The state is written to a temporary file first, so the user's file is never
+     * left incomplete.
+     */
+    private void save(final MPUser user)
+            throws IOException {
+        // A user whose sites couldn't be read mustn't overwrite its file without them.
+        if (!user.loadSites())
+            throw new IOException( strf( "Sites for user: %s, were not loaded.", user ) );
+
+        user.setDirty( false );
+        File userFile = getUserFile( user );
+        File tempFile = File.createTempFile( userFile.getName(), ".tmp", userFilesDirectory );
+        try {
+            try (FileOutputStream outputStream = new FileOutputStream( tempFile );
+                 Writer writer = new BufferedWriter( new OutputStreamWriter( outputStream, Charsets.UTF_8 ) )) {
+                MPSiteMarshaller.marshallSafe( user, writer );
+                writer.flush();
+                outputStream.getFD().sync();
+            }
+
             try {
-                new CharSink() {
-                    @Override
-                    public Writer openStream()
-                            throws IOException {
-                        File mpsitesFile = new File( userFilesDirectory, user.getFullName() + ".mpsites" );
-                        return new OutputStreamWriter( new FileOutputStream( mpsitesFile ), Charsets.UTF_8 );
-                    }
-                }.write( MPSiteMarshaller.marshallSafe( user ).getExport() );
+                Files.move( tempFile.toPath(), userFile.toPath(), StandardCopyOption.ATOMIC_MOVE, StandardCopyOption.REPLACE_EXISTING );
             }
-            catch (final IOException e) {
-                logger.err( e, "Unable to save sites for user: %s", user );
+            catch (final AtomicMoveNotSupportedException ignored) {
+                Files.move( tempFile.toPath(), userFile.toPath(), StandardCopyOption.REPLACE_EXISTING );
             }
+        }
+        catch (final IOException e) {
+            user.setDirty( true );
+            throw e;
+        }
+        finally {
+            if (tempFile.exists() && !tempFile.delete())
+                logger.wrn( "Couldn't delete temporary file: %s", tempFile );
+        }
+
+        // The user was read from a file under another name, which now holds a stale copy of the user.
+        if (user instanceof MPFileUser) {
+            MPFileUser fileUser = (MPFileUser) user;
+            if (!fileUser.getFile().equals( userFile ) && !fileUser.getFile().delete())
+                logger.err( "Couldn't delete file: %s", fileUser.getFile() );
+            fileUser.setFile( userFile );
+        }
+    }
 
-        // Remove deleted users.
-        for (final File userFile : listUserFiles( userFilesDirectory ))
-            if (getUserNamed( userFile.getName().replaceFirst( "\\.mpsites$", "" ) ) == null)
-                if (!userFile.delete())
-                    logger.err( "Couldn't delete file: %s", userFile );
+    private File getUserFile(final MPUser user) {
+        return new File( userFilesDirectory, user.getFullName() + ".mpsites" );
     }
 
     /**
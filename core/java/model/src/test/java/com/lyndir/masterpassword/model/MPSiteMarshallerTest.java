@@ -0,0 +1,138 @@
+package com.lyndir.masterpassword.model;
+
+import static org.testng.Assert.*;
+
+import com.google.common.collect.ImmutableList;
+import com.google.common.collect.Maps;
+import com.google.common.primitives.UnsignedInteger;
+import com.lyndir.lhunath.opal.system.CodeUtils;
+import com.lyndir.lhunath.opal.system.logging.Logger;
+import com.lyndir.masterpassword.MPSiteType;
+import com.lyndir.masterpassword.MasterKey;
+import java.io.StringReader;
+import java.io.StringWriter;
+import java.util.Map;
+import org.joda.time.*;
+import org.joda.time.format.DateTimeFormatter;
+import org.joda.time.format.ISODateTimeFormat;
+import org.testng.annotations.Test;
+
+
+/**
+ * Checks the hand-written line formatting and timestamp printer of {@link MPSiteMarshaller} against the formats it replaced.
+ */
+public class MPSiteMarshallerTest {
+
+    @SuppressWarnings("UnusedDeclaration")
+    private static final Logger            logger     = Logger.get( MPSiteMarshallerTest.class );
+    private static final DateTimeFormatter rfc3339    = ISODateTimeFormat.dateTimeNoMillis();
+    private static final long              MS_PER_DAY = 24L * 60 * 60 * 1000;
+
+    @Test
+    public void testPrintInstant()
+            throws Exception {
+
+        for (final long millis : new long[]{
+                0, 999, 1000, -1, -1000, 951782400000L /* 2000-02-29 */, 951868799999L, 1456790399000L /* 2016-02-29T23:59:59 */,
+                1456790400000L, 4107542400000L /* 2100-03-01 */, 1497522030123L, 253402300799000L /* 9999-12-31T23:59:59 */,
+                253402300799999L, 253402300800000L /* 10000-01-01 */, -62135596800000L /* 0001-01-01 */ }) {
+            assertPrinted( new Instant( millis ) );
+            assertPrinted( new DateTime( millis, DateTimeZone.UTC ) );
+            assertPrinted( new DateTime( millis, DateTimeZone.forOffsetHoursMinutes( 5, 45 ) ) );
+            assertPrinted( new DateTime( millis, DateTimeZone.forOffsetHours( -14 ) ) );
+        }
+    }
+
+    @Test
+    public void testPrintInstantDays()
+            throws Exception {
+
+        // Every day from 1970 through 2400 and the last days before 10000, at a different time of day each day.
+        for (long day = 0; day <= 2932896; day = (day == 157420)? 2932000: (day + 1)) {
+            long millis = (day * MS_PER_DAY) + (((day * 7919) % 86400) * 1000);
+            String printed = assertPrinted( new Instant( millis ) );
+
+            assertEquals( MPSiteUnmarshaller.parseInstant( printed, 0, printed.length() ), new Instant( millis ),
+                          "[testPrintInstantDays] Failed to parse printed date: " + printed );
+        }
+    }
+
+    @Test
+    public void testMarshallSite()
+            throws Exception {
+
+        MPUser user = user();
+        String export = MPSiteMarshaller.marshallSafe( user ).getExport();
+
+        // Fields are right-aligned in their columns, like "%s  %8s  %8s  %25s\t%25s\t%s", and those that don't fit aren't cut.
+        for (final String line : new String[]{
+                "2017-06-15T10:20:30Z         5    17:3:7                        rob\t              example.com\t\n",
+                "2017-06-15T10:20:30Z  123456789  18:1:2147483647  robert.lee.mitchell@example.com\t          www.example.com\t\n",
+                "2016-02-29T23:59:59Z         0    16:0:1                           \ta-site-name-longer-than-25-characters.example.com\t\n" })
+            assertTrue( export.contains( line ), "[testMarshallSite] Missing line: " + line + "\nin export:\n" + export );
+
+        StringWriter writer = new StringWriter();
+        MPSiteMarshaller.marshallSafe( user, writer );
+        assertEquals( withoutDate( writer.toString() ), withoutDate( export ), "[testMarshallSite] Writer export differs." );
+    }
+
+    @Test
+    public void testRoundTrip()
+            throws Exception {
+
+        MPUser user = user();
+        MPUser readUser = MPSiteUnmarshaller.unmarshall( new StringReader( MPSiteMarshaller.marshallSafe( user ).getExport() ) ).getUser();
+
+        assertEquals( readUser.getFullName(), user.getFullName(), "[testRoundTrip] Failed full name." );
+        assertEquals( readUser.exportKeyID(), user.exportKeyID(), "[testRoundTrip] Failed key ID." );
+        assertEquals( readUser.getAvatar(), user.getAvatar(), "[testRoundTrip] Failed avatar." );
+        assertEquals( readUser.getDefaultType(), user.getDefaultType(), "[testRoundTrip] Failed default type." );
+
+        Map<String, MPSite> readSites = Maps.newHashMap();
+        for (final MPSite readSite : readUser.getSites())
+            readSites.put( readSite.getSiteName(), readSite );
+        assertEquals( readSites.size(), ImmutableList.copyOf( user.getSites() ).size(), "[testRoundTrip] Failed sites." );
+
+        for (final MPSite site : user.getSites()) {
+            MPSite readSite = readSites.get( site.getSiteName() );
+            assertNotNull( readSite, "[testRoundTrip] Missing site: " + site );
+            assertEquals( readSite.getLastUsed(), new Instant( (site.getLastUsed().getMillis() / 1000) * 1000 ),
+                          "[testRoundTrip] Failed last used: " + site );
+            assertEquals( readSite.getUses(), site.getUses(), "[testRoundTrip] Failed uses: " + site );
+            assertEquals( readSite.getSiteType(), site.getSiteType(), "[testRoundTrip] Failed type: " + site );
+            assertEquals( readSite.getAlgorithmVersion(), site.getAlgorithmVersion(), "[testRoundTrip] Failed algorithm: " + site );
+            assertEquals( readSite.getSiteCounter(), site.getSiteCounter(), "[testRoundTrip] Failed counter: " + site );
+            assertEquals( readSite.getLoginName(), (site.getLoginName() == null)? "": site.getLoginName(),
+                          "[testRoundTrip] Failed login name: " + site );
+        }
+    }
+
+    private static MPUser user() {
+        MPUser user = new MPUser( "Robert Lee Mitchell",
+                                  CodeUtils.decodeHex( "98EEF4D1DF46D849574A82A03C3177056B15DFFCA29BB3899DE4628453675302" ) );
+        user.addSite( new MPSite( user, MasterKey.Version.V3, new Instant( 1497522030000L ), "example.com", MPSiteType.GeneratedLong,
+                                  UnsignedInteger.valueOf( 7 ), 5, "rob", null ) );
+        user.addSite( new MPSite( user, MasterKey.Version.V1, new Instant( 1497522030123L ), "www.example.com", MPSiteType.GeneratedMedium,
+                                  UnsignedInteger.valueOf( Integer.MAX_VALUE ), 123456789, "robert.lee.mitchell@example.com", null ) );
+        user.addSite( new MPSite( user, MasterKey.Version.V0, new Instant( 1456790399000L ),
+                                  "a-site-name-longer-than-25-characters.example.com", MPSiteType.GeneratedMaximum,
+                                  UnsignedInteger.valueOf( 1 ), 0, null, null ) );
+        user.addSite( new MPSite( user, MasterKey.Version.V3, new Instant( 0 ), "Rob's site", MPSiteType.GeneratedPhrase,
+                                  UnsignedInteger.valueOf( 2 ), 1, "Rob Mitchell", null ) );
+
+        return user;
+    }
+
+    private static String assertPrinted(final ReadableInstant instant) {
+        StringBuilder line = new StringBuilder( "site " );
+        MPSiteMarshaller.printInstant( line, instant );
+        String printed = line.substring( "site ".length() );
+
+        assertEquals( printed, rfc3339.print( instant ), "[assertPrinted] Failed instant: " + instant );
+        return printed;
+    }
+
+    private static String withoutDate(final String export) {
+        return export.replaceFirst( "# Date: [^\n]*\n", "" );
+    }
+}
@@ -0,0 +1,183 @@
+package com.lyndir.masterpassword.model;
+
+import static org.testng.Assert.*;
+
+import com.google.common.collect.ImmutableList;
+import com.google.common.primitives.UnsignedInteger;
+import com.lyndir.lhunath.opal.system.logging.Logger;
+import com.lyndir.masterpassword.MPSiteType;
+import com.lyndir.masterpassword.MasterKey;
+import java.util.List;
+import org.joda.time.DateTimeZone;
+import org.joda.time.Instant;
+import org.joda.time.format.DateTimeFormatter;
+import org.joda.time.format.ISODateTimeFormat;
+import org.testng.annotations.Test;
+
+
+/**
+ * Checks the hand-written tokenizer and timestamp parser of {@link MPSiteUnmarshaller} against the formats it replaced.
+ */
+public class MPSiteUnmarshallerTest {
+
+    @SuppressWarnings("UnusedDeclaration")
+    private static final Logger            logger    = Logger.get( MPSiteUnmarshallerTest.class );
+    private static final DateTimeFormatter rfc3339   = ISODateTimeFormat.dateTimeNoMillis();
+    private static final long              S_PER_DAY = 24L * 60 * 60;
+
+    @Test
+    public void testParseInstant()
+            throws Exception {
+
+        for (final String date : new String[]{
+                "1970-01-01T00:00:00Z", "1969-12-31T23:59:59Z", "1970-01-01T00:00:00+00:00", "1970-01-01T00:30:00+01:00",
+                "1969-12-31T23:00:00-01:00", "2000-02-28T23:59:59Z", "2000-02-29T00:00:00Z", "2000-03-01T00:00:00Z",
+                "2016-02-29T23:59:59Z", "2016-02-29T23:59:59+05:45", "2016-03-01T00:00:00-09:30", "1900-02-28T23:59:59Z",
+                "1900-03-01T00:00:00Z", "2100-02-28T23:59:59Z", "2100-03-01T00:00:00Z", "2017-06-15T10:20:30+02:00",
+                "2017-06-15T10:20:30-14:00", "9999-12-31T23:59:59Z", "9999-12-31T23:59:59-14:00", "0000-03-01T00:00:00Z",
+                "0001-01-01T00:00:00Z" })
+            assertEquals( MPSiteUnmarshaller.parseInstant( date, 0, date.length() ), rfc3339.parseDateTime( date ).toInstant(),
+                          "[testParseInstant] Failed date: " + date );
+
+        String line = "site 2016-02-29T12:34:56+01:00 site";
+        assertEquals( MPSiteUnmarshaller.parseInstant( line, 5, 30 ), rfc3339.parseDateTime( "2016-02-29T11:34:56Z" ).toInstant(),
+                      "[testParseInstant] Failed date in line: " + line );
+    }
+
+    @Test
+    public void testParseInstantDays()
+            throws Exception {
+
+        // Every day from 1900 through 2400, at a different time of day and offset each day.
+        for (long day = -25567; day <= 157420; ++day) {
+            long millis = ((day * S_PER_DAY) + ((day * 7919) % S_PER_DAY)) * 1000;
+            DateTimeZone zone = DateTimeZone.forOffsetMillis( (int) ((((day % 57) + 57) % 57) - 28) * 30 * 60 * 1000 );
+            String date = rfc3339.withZone( (day % 3) == 0? DateTimeZone.UTC: zone ).print( millis );
+
+            assertEquals( MPSiteUnmarshaller.parseInstant( date, 0, date.length() ), new Instant( millis ),
+                          "[testParseInstantDays] Failed date: " + date );
+        }
+    }
+
+    @Test
+    public void testParseInvalidInstant()
+            throws Exception {
+
+        for (final String date : new String[]{
+                "2017-02-29T00:00:00Z", "2100-02-29T00:00:00Z", "1900-02-29T00:00:00Z", "2017-13-01T00:00:00Z", "2017-04-31T00:00:00Z",
+                "2017-06-15T24:00:00Z", "2017-06-15T10:60:00Z", "2017-06-15 10:20:30Z", "2017-06-15T10:20:30*02:00",
+                "2017-06-15T10:20:30+99:00", "2017-06-15T10:20:30-24:00", "2O17-06-15T10:20:30Z" })
+            try {
+                MPSiteUnmarshaller.parseInstant( date, 0, date.length() );
+                fail( "[testParseInvalidInstant] Invalid date was parsed: " + date );
+            }
+            catch (final IllegalArgumentException ignored) {
+            }
+    }
+
+    @Test
+    public void testUnmarshallFormat1()
+            throws Exception {
+
+        MPSiteUnmarshaller unmarshaller = MPSiteUnmarshaller.unmarshall( header( 1 ) );
+
+        assertSite( unmarshaller.unmarshallSite(
+                            "2017-06-15T10:20:30Z         5    17:3:7                        rob\t              example.com\tcontent" ),
+                    "2017-06-15T10:20:30Z", 5, MPSiteType.GeneratedLong, MasterKey.Version.V3, 7, "rob", "example.com" );
+        assertSite( unmarshaller.unmarshallSite(
+                            "2017-06-15T10:20:30Z  123456789  18:1:2147483647  robert.lee.mitchell@example.com\t   www.example.com\t" ),
+                    "2017-06-15T10:20:30Z", 123456789, MPSiteType.GeneratedMedium, MasterKey.Version.V1, 2147483647,
+                    "robert.lee.mitchell@example.com", "www.example.com" );
+        assertSite( unmarshaller.unmarshallSite( "2017-06-15T12:20:30+02:00 0 17:0:4294967295 Rob Mitchell\texample.com\t" ), //
+                    "2017-06-15T10:20:30Z", 0, MPSiteType.GeneratedLong, MasterKey.Version.V0, 4294967295L, "Rob Mitchell", "example.com" );
+
+        // Empty login names, padded or not.
+        assertSite( unmarshaller.unmarshallSite(
+                            "2016-02-29T23:59:59Z         1    17:3:1                           \t              example.com\t" ),
+                    "2016-02-29T23:59:59Z", 1, MPSiteType.GeneratedLong, MasterKey.Version.V3, 1, "", "example.com" );
+        assertSite( unmarshaller.unmarshallSite( "2016-02-29T23:59:59Z 1 17:3:1 \texample.com\t" ), //
+                    "2016-02-29T23:59:59Z", 1, MPSiteType.GeneratedLong, MasterKey.Version.V3, 1, "", "example.com" );
+
+        // Missing :counter and :algorithm.
+        assertSite( unmarshaller.unmarshallSite( "1970-01-01T00:00:00Z 2 20:2 rob\texample.com\t" ), //
+                    "1970-01-01T00:00:00Z", 2, MPSiteType.GeneratedShort, MasterKey.Version.V2, 1, "rob", "example.com" );
+        assertSite( unmarshaller.unmarshallSite( "9999-12-31T23:59:59Z 2 21 rob\texample.com\t" ), //
+                    "9999-12-31T23:59:59Z", 2, MPSiteType.GeneratedPIN, MasterKey.Version.V3, 1, "rob", "example.com" );
+
+        for (final String line : new String[]{
+                "", "garbage", "2017-06-15T10:20:30Z", "2017-06-15T10:20:30Z x 17:3:1 rob\texample.com\t",
+                "2017-06-15T10:20:30Z 0 x rob\texample.com\t", "2017-06-15T10:20:30Z 0 17:x rob\texample.com\t",
+                "2017-06-15T10:20:30Z 0 17:3:x rob\texample.com\t", "2017-06-15T10:20:30Z 0 17:3:4294967296 rob\texample.com\t",
+                "2017-06-15T10:20:30Z 0 17:3:1rob\texample.com\t", "2017-06-15T10:20:30Z 0 17:3:1 example.com",
+                "2017-06-15T10:20:30Z 0 17:3:1 rob\t\t", "2017-06-15T10:20:30Z 0 17:3:1 rob\texample.com" })
+            assertNull( unmarshaller.unmarshallSite( line ), "[testUnmarshallFormat1] Invalid line was unmarshalled: " + line );
+    }
+
+    @Test
+    public void testUnmarshallFormat0()
+            throws Exception {
+
+        MPSiteUnmarshaller unmarshaller = MPSiteUnmarshaller.unmarshall( header( 0 ) );
+
+        assertSite( unmarshaller.unmarshallSite( "2012-07-04T12:34:56Z         3    18:1              example.com\tcontent" ),
+                    "2012-07-04T12:34:56Z", 3, MPSiteType.GeneratedMedium, MasterKey.Version.V1, 1, null, "example.com" );
+        assertSite( unmarshaller.unmarshallSite( "2012-07-04T12:34:56-05:00 3 16 example.com\t" ), //
+                    "2012-07-04T17:34:56Z", 3, MPSiteType.GeneratedMaximum, MasterKey.Version.V3, 1, null, "example.com" );
+
+        // Format 0 has no counter or login name.
+        for (final String line : new String[]{
+                "2012-07-04T12:34:56Z 3 18:1:5 example.com\t", "2012-07-04T12:34:56Z 3 18:1 \t", "2012-07-04T12:34:56Z 3 18:1 example.com" })
+            assertNull( unmarshaller.unmarshallSite( line ), "[testUnmarshallFormat0] Invalid line was unmarshalled: " + line );
+    }
+
+    @Test
+    public void testUnmarshallHeader()
+            throws Exception {
+
+        List<String> lines = ImmutableList.<String>builder().addAll( header( 1 ) ) //
+                .add( "2017-06-15T10:20:30Z         5    17:3:7                        rob\t              example.com\t" ) //
+                .add( "2017-06-15T10:20:30Z         1    18:3:1                           \t            other.example\t" ) //
+                .add( "# 2017-06-15T10:20:30Z       1    18:3:1                           \t        comment.example\t" ) //
+                .build();
+        MPUser user = MPSiteUnmarshaller.unmarshall( lines ).getUser();
+
+        assertEquals( user.getFullName(), "Robert Lee Mitchell", "[testUnmarshallHeader] Failed full name." );
+        assertEquals( user.getAvatar(), 4, "[testUnmarshallHeader] Failed avatar." );
+        assertEquals( user.getDefaultType(), MPSiteType.GeneratedMedium, "[testUnmarshallHeader] Failed default type." );
+        assertTrue( user.exportKeyID().equalsIgnoreCase( "98EEF4D1DF46D849574A82A03C3177056B15DFFCA29BB3899DE4628453675302" ),
+                    "[testUnmarshallHeader] Failed key ID: " + user.exportKeyID() );
+        assertEquals( ImmutableList.copyOf( user.getSites() ).size(), 2, "[testUnmarshallHeader] Failed sites." );
+        assertFalse( user.isDirty(), "[testUnmarshallHeader] Unmarshalled user is dirty." );
+    }
+
+    static List<String> header(final int format) {
+        return ImmutableList.of( "# Master Password site export", //
+                                 "#     Export of site names and stored passwords (unless device-private) encrypted with the master key.", //
+                                 "# ", //
+                                 "##", //
+                                 "# Format: " + format, //
+                                 "# Date: 2017-06-15T10:20:30Z", //
+                                 "# User Name: Robert Lee Mitchell", //
+                                 "# Full Name: Robert Lee Mitchell", //
+                                 "# Avatar: 4", //
+                                 "# Key ID: 98EEF4D1DF46D849574A82A03C3177056B15DFFCA29BB3899DE4628453675302", //
+                                 "# Algorithm: 3", //
+                                 "# Default Type: 18", //
+                                 "# Passwords: PROTECTED", //
+                                 "##", //
+                                 "#" );
+    }
+
+    private static void assertSite(final MPSite site, final String lastUsed, final int uses, final MPSiteType siteType,
+                                   final MasterKey.Version algorithmVersion, final long siteCounter, final String loginName,
+                                   final String siteName) {
+        assertNotNull( site, "[assertSite] Site wasn't unmarshalled: " + siteName );
+        assertEquals( site.getLastUsed(), rfc3339.parseDateTime( lastUsed ).toInstant(), "[assertSite] Failed last used: " + site );
+        assertEquals( site.getUses(), uses, "[assertSite] Failed uses: " + site );
+        assertEquals( site.getSiteType(), siteType, "[assertSite] Failed type: " + site );
+        assertEquals( site.getAlgorithmVersion(), algorithmVersion, "[assertSite] Failed algorithm: " + site );
+        assertEquals( site.getSiteCounter(), UnsignedInteger.valueOf( siteCounter ), "[assertSite] Failed counter: " + site );
+        assertEquals( site.getLoginName(), loginName, "[assertSite] Failed login name: " + site );
+        assertEquals( site.getSiteName(), siteName, "[assertSite] Failed site name: " + site );
+    }
+}
@@ -0,0 +1,63 @@
+package com.lyndir.masterpassword.model;
+
+import static org.testng.Assert.*;
+
+import com.google.common.collect.ImmutableList;
+import com.google.common.collect.Lists;
+import com.google.common.primitives.UnsignedInteger;
+import com.lyndir.lhunath.opal.system.logging.Logger;
+import com.lyndir.masterpassword.MPSiteType;
+import com.lyndir.masterpassword.MPSiteTypeClass;
+import com.lyndir.masterpassword.MasterKey;
+import java.util.List;
+import org.joda.time.Instant;
+import org.testng.annotations.Test;
+
+
+/**
+ * Checks that {@link MPUser#resultsFor(MasterKey)} computes the same results in parallel as {@link MPSite#resultFor(MasterKey)}.
+ */
+public class MPUserTest {
+
+    @SuppressWarnings("UnusedDeclaration")
+    private static final Logger logger = Logger.get( MPUserTest.class );
+
+    private static final MPSiteType[] siteTypes = {
+            MPSiteType.GeneratedLong, MPSiteType.GeneratedMaximum, MPSiteType.GeneratedMedium, MPSiteType.GeneratedBasic,
+            MPSiteType.GeneratedShort, MPSiteType.GeneratedPIN, MPSiteType.GeneratedName, MPSiteType.GeneratedPhrase,
+            MPSiteType.StoredPersonal, MPSiteType.StoredDevicePrivate, MPSiteType.GeneratedCustom };
+
+    @Test
+    public void testResultsFor()
+            throws Exception {
+
+        // Enough sites of every type to be split over several tasks of at most 16 sites.
+        MPUser user = new MPUser( "Robert Lee Mitchell" );
+        for (int s = 0; s < 100; ++s)
+            user.addSite( new MPSite( user, MasterKey.Version.values()[s % MasterKey.Version.values().length], new Instant(),
+                                      "site" + s + ".example.com", siteTypes[s % siteTypes.length], UnsignedInteger.valueOf( 1 + (s % 3) ),
+                                      s, null, "Cvcv[!#$%]nnxx" ) );
+        MasterKey masterKey = MasterKey.create( user.getFullName(), "banana colored duckling".toCharArray() );
+
+        List<MPSite> sites = ImmutableList.copyOf( user.getSites() );
+        List<String> results = user.resultsFor( masterKey );
+        assertEquals( results.size(), sites.size(), "[testResultsFor] Failed amount of results." );
+        for (int s = 0; s < sites.size(); ++s) {
+            MPSite site = sites.get( s );
+            assertEquals( results.get( s ), site.resultFor( masterKey ), "[testResultsFor] Failed result: " + site );
+
+            if (site.getSiteType() == MPSiteType.GeneratedCustom)
+                assertEquals( results.get( s ), "Cvcv[!#$%]nnxx", "[testResultsFor] Failed custom site: " + site );
+            else if (site.getSiteType().getTypeClass() != MPSiteTypeClass.Generated)
+                assertNull( results.get( s ), "[testResultsFor] Failed stored site: " + site );
+            else
+                assertNotNull( results.get( s ), "[testResultsFor] Missing result: " + site );
+        }
+
+        // The results follow the order of the given sites.
+        List<MPSite> reversed = Lists.reverse( sites );
+        assertEquals( MPUser.resultsFor( masterKey, reversed ), Lists.reverse( results ), "[testResultsFor] Failed reversed order." );
+        assertEquals( MPUser.resultsFor( masterKey, reversed.subList( 0, 17 ) ), Lists.reverse( results ).subList( 0, 17 ),
+                      "[testResultsFor] Failed sub-list." );
+    }
+}
@@ -20,6 +20,7 @@ package com.lyndir.masterpassword;
 
 import static org.testng.Assert.*;
 
+import com.google.common.primitives.UnsignedInteger;
 import com.lyndir.lhunath.opal.system.CodeUtils;
 import com.lyndir.lhunath.opal.system.logging.Logger;
 import com.lyndir.lhunath.opal.system.util.NNFunctionNN;
@@ -92,6 +93,40 @@ public class MasterKeyTest {
         } );
     }
 
+    @Test
+    public void testSupplementaryFullName()
+            throws Exception {
+
+        // Before V3, the Java implementation counts the full name in UTF-16 units, so this one is 20 long rather than 19.
+        String fullName = "Robert \uD83D\uDE00 Mitchell";
+        char[] masterPassword = testSuite.getTests().getDefaultCase().getMasterPassword();
+
+        for (final MasterKey.Version version : MasterKey.Version.values()) {
+            MasterKey masterKey = MasterKey.create( version, fullName, masterPassword );
+            MasterKey javaKey = MasterKey.newJavaKey( version, fullName ).revalidate( masterPassword );
+            String result = masterKey.encode( "masterpasswordapp.com", MPSiteType.GeneratedLong, UnsignedInteger.ONE,
+                                              MPSiteVariant.Password, null );
+
+            assertEquals( CodeUtils.encodeHex( masterKey.getKeyID() ), CodeUtils.encodeHex( javaKey.getKeyID() ),
+                          "[testSupplementaryFullName] Failed key ID: " + version );
+            assertEquals( result, javaKey.encode( "masterpasswordapp.com", MPSiteType.GeneratedLong, UnsignedInteger.ONE,
+                                                  MPSiteVariant.Password, null ), "[testSupplementaryFullName] Failed result: " + version );
+
+            if (version == MasterKey.Version.V2) {
+                assertEquals( CodeUtils.encodeHex( masterKey.getKeyID() ),
+                              "3A06907784AAD02DB257F0DE97ADCA9B16B22A535CB6F62A37D112FA8FE6EE85",
+                              "[testSupplementaryFullName] Failed key ID: " + version );
+                assertEquals( result, "Vecs5,WepeRigl", "[testSupplementaryFullName] Failed result: " + version );
+            }
+            if (version == MasterKey.Version.V3) {
+                assertEquals( CodeUtils.encodeHex( masterKey.getKeyID() ),
+                              "53B841190F3AE429C5E02A535B308DC47A1A3E02D18B34E39316D31D6F1DA834",
+                              "[testSupplementaryFullName] Failed key ID: " + version );
+                assertEquals( result, "CivuQeqvXoxo0#", "[testSupplementaryFullName] Failed result: " + version );
+            }
+        }
+    }
+
     @Test
     public void testInvalidate()
             throws Exception {
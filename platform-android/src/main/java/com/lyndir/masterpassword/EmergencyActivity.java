@@ -285,21 +285,8 @@ public class EmergencyActivity extends Activity {
 
         sitePasswordField.setText( "" );
         progressView.setVisibility( View.VISIBLE );
-        (masterKeyFuture = executor.submit( new Callable<MasterKey>() {
-            @Override
-            public MasterKey call()
-                    throws Exception {
-                try {
-                    return MasterKey.create( version, fullName, masterPassword );
-                }
-                catch (final Exception e) {
-                    sitePasswordField.setText( "" );
-                    progressView.setVisibility( View.INVISIBLE );
-                    logger.err( e, "While generating master key." );
-                    throw e;
-                }
-            }
-        } )).addListener( new Runnable() {
+        // Superseded derivations were cancelled above, so they don't hold up this one.
+        (masterKeyFuture = MasterKey.createAsync( version, fullName, masterPassword )).addListener( new Runnable() {
             @Override
             public void run() {
                 runOnUiThread( new Runnable() {
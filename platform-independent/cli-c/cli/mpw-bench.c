@@ -6,127 +6,1089 @@
 //  Copyright (c) 2014 Lyndir. All rights reserved.
 //
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
 #include <errno.h>
-#include <sys/time.h>
+#include <getopt.h>
+#include <fnmatch.h>
+#include <sysexits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <ctype.h>
+#include <limits.h>
 
 #include <bcrypt/ow-crypt.h>
+#if MPW_JSON
+#include <json-c/json.h>
+#endif
 
 #include "mpw-algorithm.h"
 #include "mpw-util.h"
+#include "mpw-marshall.h"
+#include "mpw-cli-util.h"
 
 #define MP_N                32768
 #define MP_r                8
 #define MP_p                2
 
-static void mpw_getTime(struct timeval *time) {
+/** The minimum amount of samples to take of each case. */
+#define MPBenchSamplesMin   5
+/** The maximum amount of samples to take of each case. */
+#define MPBenchSamplesMax   1000
+/** The minimum duration of a sample, in seconds.  Fast cases are repeated within a sample to reach it. */
+#define MPBenchSampleTime   0.01
+/** The default slowdown over a baseline's median that is tolerated, in percent. */
+#define MPBenchTolerance    10
+/** The growth in allocations and allocated bytes over a baseline's that is always tolerated, to absorb rounding. */
+#define MPBenchAllocationsSlack 0.5
+#define MPBenchBytesSlack   64
+
+static const char *fullName = "Robert Lee Mitchel";
+static const char *masterPassword = "banana colored duckling";
+static const char *siteName = "masterpasswordapp.com";
+static const MPCounterValue siteCounter = MPCounterValueDefault;
+static const MPKeyPurpose keyPurpose = MPKeyPurposeAuthentication;
+static const char *keyContext = NULL;
+
+/** The master keys used by cases that don't measure the master key derivation itself. */
+static MPMasterKeys masterKeys;
+/** An initialized message of the size of a site's HMAC input. */
+static uint8_t hmacMessage[128];
+/** The encrypted state of a personal password for each algorithm version. */
+static const char *siteStates[MPAlgorithmVersionLast + 1];
+/** The template policy of the custom result type cases, and its compiled form. */
+static const char *sitePolicy = "Cvcv[!#$%]nnxx,nnCvcv[!#$%]xx";
+static const MPTemplatePolicy *siteTemplatePolicy;
+
+typedef struct MPBenchCase {
+    char *name;
+    /** Prepare the case's fixtures, if it has any, before it is measured. */
+    bool (*setup)(const struct MPBenchCase *benchCase);
+    /** Perform one iteration of the case. */
+    void (*run)(const struct MPBenchCase *benchCase);
+    MPAlgorithmVersion algorithmVersion;
+    MPResultType resultType;
+    /** The amount of sites of the synthetic user, for the marshalling cases. */
+    size_t sites;
+    MPMarshallFormat format;
+    bool redacted;
+    /** Leave the master key derivations that the case performs out of its time, allocations and heap peak. */
+    bool excludeKDF;
+} MPBenchCase;
+
+/** A synthetic user and its marshalled forms, for the marshalling cases. */
+typedef struct MPBenchUser {
+    size_t sites;
+    bool redacted;
+    MPMarshalledUser *user;
+    char *marshalled[MPMarshallFormatLast + 1];
+} MPBenchUser;
+static MPBenchUser benchUser;
+
+/** The master key derivations performed while measuring a case that leaves them out. */
+typedef struct MPBenchKDF {
+    double start;
+    MPAllocStats startStats;
+    /** The time, allocations and allocated bytes of the derivations so far. */
+    double time;
+    size_t allocations, allocated;
+    /** The highest heap peak reached outside of the derivations before the last one. */
+    size_t peak;
+} MPBenchKDF;
+static MPBenchKDF benchKDF;
 
-    if (gettimeofday( time, NULL ) != 0)
-        ftl( "Could not get time: %s\n", strerror( errno ) );
+typedef struct MPBenchResult {
+    /** The amount of items processed per second, based on the median (one item per iteration, or a site). */
+    double throughput;
+    /** The growth of the process' resident set size at the peak of one iteration, in KiB, including any master key
+      * derivations. */
+    long peakRSS;
+    /** The heap allocations and allocated bytes of one iteration, or -1 if allocation statistics aren't available. */
+    double allocations, allocated;
+    /** The growth of the process' heap use at the peak of one iteration, in bytes, or -1 if it isn't available. */
+    double peakHeap;
+    /** The heap bytes that an iteration leaves in use, or -1 if it isn't available. */
+    double retained;
+    size_t samples;
+    size_t iterations;
+    /** The time of one iteration, in seconds. */
+    double min, median, p99, mean;
+    /** The half-width of the 95% confidence interval of the mean, in seconds. */
+    double ci95;
+} MPBenchResult;
+
+static void mpw_bench_hmac(const MPBenchCase *benchCase) {
+
+    mpw_free( mpw_hash_hmac_sha256(
+            mpw_masterKeys_get( &masterKeys, MPAlgorithmVersionCurrent ), MPMasterKeySize, hmacMessage, sizeof( hmacMessage ) ),
+            32 );
 }
 
-static const double mpw_showSpeed(struct timeval startTime, const unsigned int iterations, const char *operation) {
+static void mpw_bench_bcrypt(const MPBenchCase *benchCase) {
+
+    char *setting = crypt_gensalt_ra( "$2b$", 9, fullName, (int)strlen( fullName ) );
+    void *data = NULL;
+    int dataSize = 0;
+    if (setting)
+        crypt_ra( masterPassword, setting, &data, &dataSize );
+    free( setting );
+    mpw_free( data, (size_t)dataSize );
+}
 
-    struct timeval endTime;
-    mpw_getTime( &endTime );
+static void mpw_bench_masterKey(const MPBenchCase *benchCase) {
 
-    const time_t dsec = (endTime.tv_sec - startTime.tv_sec);
-    const suseconds_t dusec = (endTime.tv_usec - startTime.tv_usec);
-    const double elapsed = dsec + dusec / 1000000.;
-    const double speed = iterations / elapsed;
+    mpw_free( mpw_masterKey( fullName, masterPassword, benchCase->algorithmVersion ), MPMasterKeySize );
+}
 
-    fprintf( stderr, " done.  " );
-    fprintf( stdout, "%d %s iterations in %llds %lldµs -> %.2f/s\n", iterations, operation, (long long)dsec, (long long)dusec, speed );
+static void mpw_bench_siteResult(const MPBenchCase *benchCase) {
 
-    return speed;
+    mpw_free_string( mpw_siteResult( mpw_masterKeys_get( &masterKeys, benchCase->algorithmVersion ),
+            siteName, siteCounter, keyPurpose, keyContext, benchCase->resultType,
+            benchCase->resultType & MPResultTypeClassStateful? siteStates[benchCase->algorithmVersion]:
+            benchCase->resultType == MPResultTypeTemplateCustom? sitePolicy: NULL,
+            benchCase->algorithmVersion ) );
 }
 
-int main(int argc, char *const argv[]) {
+static bool mpw_bench_sitePolicyResult_setup(const MPBenchCase *benchCase) {
+
+    return siteTemplatePolicy || (siteTemplatePolicy = mpw_templatePolicy( sitePolicy ));
+}
+
+static void mpw_bench_sitePolicyResult(const MPBenchCase *benchCase) {
+
+    mpw_free_string( mpw_sitePolicyResult( mpw_masterKeys_get( &masterKeys, benchCase->algorithmVersion ),
+            siteName, siteCounter, keyPurpose, keyContext, siteTemplatePolicy, benchCase->algorithmVersion ) );
+}
+
+static void mpw_bench_siteState(const MPBenchCase *benchCase) {
+
+    mpw_free_string( mpw_siteState( mpw_masterKeys_get( &masterKeys, benchCase->algorithmVersion ),
+            siteName, siteCounter, keyPurpose, keyContext, benchCase->resultType, masterPassword, benchCase->algorithmVersion ) );
+}
+
+static void mpw_bench_mpw(const MPBenchCase *benchCase) {
+
+    MPMasterKey masterKey = mpw_masterKey( fullName, masterPassword, benchCase->algorithmVersion );
+    mpw_free_string( mpw_siteResult(
+            masterKey, siteName, siteCounter, keyPurpose, keyContext, MPResultTypeDefault, NULL, benchCase->algorithmVersion ) );
+    mpw_free( masterKey, MPMasterKeySize );
+}
+
+/** @return A deterministic pseudo-random number. */
+static uint32_t mpw_bench_random(uint32_t *seed) {
+
+    return *seed = *seed * 1103515245 + 12345;
+}
+
+static bool mpw_bench_marshall_setup(const MPBenchCase *benchCase) {
+
+    if (benchUser.user && benchUser.sites == benchCase->sites && benchUser.redacted == benchCase->redacted)
+        return true;
+
+    // Only one synthetic user is kept at a time.
+    mpw_marshal_free( benchUser.user );
+    for (MPMarshallFormat f = MPMarshallFormatFirst; f <= MPMarshallFormatLast; ++f)
+        mpw_free_string( benchUser.marshalled[f] );
+    benchUser = (MPBenchUser){ .sites = benchCase->sites, .redacted = benchCase->redacted };
+
+    // Generate a user whose sites have a realistic spread of names, types, counters, versions, logins and usage.
+    static const char *words[] = {
+            "mail", "bank", "shop", "news", "cloud", "social", "forum", "games", "travel", "photo",
+            "music", "video", "work", "school", "health", "energy", "phone", "insurance", "jobs", "tickets",
+    };
+    static const char *tlds[] = { "com", "com", "com", "org", "net", "io", "co.uk", "de", "fr", "be" };
+    static const MPResultType types[] = {
+            MPResultTypeTemplateLong, MPResultTypeTemplateLong, MPResultTypeTemplateLong, MPResultTypeTemplateLong,
+            MPResultTypeTemplateLong, MPResultTypeTemplateLong, MPResultTypeTemplateLong, MPResultTypeTemplateMaximum,
+            MPResultTypeTemplateMaximum, MPResultTypeTemplateMedium, MPResultTypeTemplateBasic, MPResultTypeTemplatePIN,
+            MPResultTypeTemplateShort, MPResultTypeTemplateName, MPResultTypeTemplatePhrase, MPResultTypeStatefulPersonal,
+    };
+    uint32_t seed = (uint32_t)benchCase->sites;
+    time_t now = time( NULL );
+    if (!(benchUser.user = mpw_marshall_user( fullName, masterPassword, MPAlgorithmVersionCurrent )))
+        return false;
+    benchUser.user->redacted = benchCase->redacted;
+    benchUser.user->lastUsed = now;
+    for (size_t s = 0; s < benchCase->sites; ++s) {
+        char *name = NULL;
+        asprintf( &name, "%s%zu.%s", words[mpw_bench_random( &seed ) % 20], s, tlds[mpw_bench_random( &seed ) % 10] );
+        uint32_t algorithm = mpw_bench_random( &seed ) % 10;
+        uint32_t counter = mpw_bench_random( &seed ) % 10;
+        MPMarshalledSite *site = mpw_marshall_site( benchUser.user, name,
+                types[mpw_bench_random( &seed ) % 16], counter < 7? MPCounterValueInitial: counter - 5,
+                algorithm < 8? MPAlgorithmVersionCurrent: algorithm == 8? MPAlgorithmVersion2: MPAlgorithmVersion1 );
+        if (!site) {
+            free( name );
+            return false;
+        }
+
+        if (site->type & MPResultTypeClassStateful)
+            site->content = mpw_siteState( mpw_masterKeys_get( &masterKeys, site->algorithm ), site->name, site->counter,
+                    MPKeyPurposeAuthentication, NULL, site->type, name, site->algorithm );
+        uint32_t login = mpw_bench_random( &seed ) % 10;
+        if (login < 3)
+            asprintf( (char **)&site->loginName, "user%u@example.com", mpw_bench_random( &seed ) % 1000 );
+        else if (login == 3)
+            site->loginGenerated = true;
+        if (mpw_bench_random( &seed ) % 10 < 4)
+            asprintf( (char **)&site->url, "https://%s/login", name );
+        if (mpw_bench_random( &seed ) % 20 == 0)
+            mpw_marshal_question( site, "mother" );
+        site->uses = mpw_bench_random( &seed ) % 100;
+        site->lastUsed = now - mpw_bench_random( &seed ) % (2 * 365 * 24 * 3600);
+        free( name );
+    }
+
+    for (MPMarshallFormat f = MPMarshallFormatFirst; f <= MPMarshallFormatLast; ++f) {
+        MPMarshallError error = { .type = MPMarshallSuccess };
+#if !MPW_JSON
+        if (f == MPMarshallFormatJSON)
+            continue;
+#endif
+        if (!mpw_marshall_write( &benchUser.marshalled[f], f, benchUser.user, &error ) || error.type != MPMarshallSuccess) {
+            err( "Couldn't marshall synthetic user: %s\n", error.description );
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void mpw_bench_marshall_write(const MPBenchCase *benchCase) {
+
+    char *out = NULL;
+    MPMarshallError error = { .type = MPMarshallSuccess };
+    mpw_marshall_write( &out, benchCase->format, benchUser.user, &error );
+    mpw_free_string( out );
+}
+
+static void mpw_bench_marshall_read(const MPBenchCase *benchCase) {
+
+    MPMarshallError error = { .type = MPMarshallSuccess };
+    mpw_marshal_free( mpw_marshall_read( benchUser.marshalled[benchCase->format], benchCase->format, masterPassword, &error ) );
+}
+
+static void mpw_bench_marshall_info(const MPBenchCase *benchCase) {
+
+    mpw_marshal_info_free( mpw_marshall_read_info( benchUser.marshalled[benchCase->format] ) );
+}
+
+/** Account for the master key derivations, so they can be subtracted from the case's work. */
+static void mpw_bench_observe(const char *stage, const bool begin) {
+
+    if (strcmp( stage, "scrypt" ) != 0)
+        return;
+
+    MPAllocStats stats = { .allocations = 0 };
+    bool hasAllocStats = mpw_alloc_stats( &stats );
+    if (begin) {
+        benchKDF.startStats = stats;
+        benchKDF.peak = max( benchKDF.peak, stats.peak );
+        benchKDF.start = mpw_now();
+        return;
+    }
+
+    benchKDF.time += mpw_now() - benchKDF.start;
+    if (hasAllocStats) {
+        benchKDF.allocations += stats.allocations - benchKDF.startStats.allocations;
+        benchKDF.allocated += stats.allocated - benchKDF.startStats.allocated;
+    }
+    mpw_alloc_stats_reset_peak();
+}
+
+static void mpw_bench_add(MPBenchCase **cases, size_t *count, MPBenchCase benchCase, const char *nameFormat, ...) {
+
+    va_list args;
+    va_start( args, nameFormat );
+    if (vasprintf( &benchCase.name, nameFormat, args ) < 0)
+        benchCase.name = NULL;
+    va_end( args );
+
+    if (benchCase.name && mpw_realloc( cases, NULL, sizeof( **cases ) * (*count + 1) ))
+        (*cases)[(*count)++] = benchCase;
+}
+
+static MPBenchCase *mpw_bench_cases(size_t *count, const size_t maxSites) {
+
+    MPBenchCase *cases = NULL;
+    *count = 0;
+
+    mpw_bench_add( &cases, count, (MPBenchCase){ .run = mpw_bench_hmac }, "hmac-sha256" );
+    mpw_bench_add( &cases, count, (MPBenchCase){ .run = mpw_bench_bcrypt }, "bcrypt9" );
+    for (MPAlgorithmVersion v = MPAlgorithmVersionFirst; v <= MPAlgorithmVersionLast; ++v)
+        mpw_bench_add( &cases, count, (MPBenchCase){ .run = mpw_bench_masterKey, .algorithmVersion = v },
+                "master-key/v%d", v );
+
+    const MPResultType templateTypes[] = {
+            MPResultTypeTemplateMaximum, MPResultTypeTemplateLong, MPResultTypeTemplateMedium, MPResultTypeTemplateBasic,
+            MPResultTypeTemplateShort, MPResultTypeTemplatePIN, MPResultTypeTemplateName, MPResultTypeTemplatePhrase,
+    };
+    for (size_t t = 0; t < sizeof( templateTypes ) / sizeof( *templateTypes ); ++t)
+        for (MPAlgorithmVersion v = MPAlgorithmVersionFirst; v <= MPAlgorithmVersionLast; ++v)
+            mpw_bench_add( &cases, count, (MPBenchCase){
+                    .run = mpw_bench_siteResult, .algorithmVersion = v, .resultType = templateTypes[t]
+            }, "site-result/%s/v%d", mpw_nameForType( templateTypes[t] ), v );
+    for (MPAlgorithmVersion v = MPAlgorithmVersionFirst; v <= MPAlgorithmVersionLast; ++v) {
+        mpw_bench_add( &cases, count, (MPBenchCase){
+                .run = mpw_bench_siteState, .algorithmVersion = v, .resultType = MPResultTypeStatefulPersonal
+        }, "site-state/%s/v%d", mpw_nameForType( MPResultTypeStatefulPersonal ), v );
+        mpw_bench_add( &cases, count, (MPBenchCase){
+                .run = mpw_bench_siteResult, .algorithmVersion = v, .resultType = MPResultTypeStatefulPersonal
+        }, "site-result/%s/v%d", mpw_nameForType( MPResultTypeStatefulPersonal ), v );
+    }
+    for (MPAlgorithmVersion v = MPAlgorithmVersionFirst; v <= MPAlgorithmVersionLast; ++v) {
+        mpw_bench_add( &cases, count, (MPBenchCase){
+                .run = mpw_bench_siteResult, .algorithmVersion = v, .resultType = MPResultTypeTemplateCustom
+        }, "site-result/%s/v%d", mpw_nameForType( MPResultTypeTemplateCustom ), v );
+        mpw_bench_add( &cases, count, (MPBenchCase){
+                .setup = mpw_bench_sitePolicyResult_setup, .run = mpw_bench_sitePolicyResult,
+                .algorithmVersion = v, .resultType = MPResultTypeTemplateCustom
+        }, "site-policy/%s/v%d", mpw_nameForType( MPResultTypeTemplateCustom ), v );
+    }
+
+    mpw_bench_add( &cases, count, (MPBenchCase){ .run = mpw_bench_mpw, .algorithmVersion = MPAlgorithmVersionCurrent }, "mpw" );
+
+    const size_t sites[] = { 10, 1000, 100000, 1000000 };
+    for (size_t s = 0; s < sizeof( sites ) / sizeof( *sites ) && sites[s] <= maxSites; ++s)
+        for (int redacted = 1; redacted >= 0; --redacted)
+            for (MPMarshallFormat f = MPMarshallFormatFirst; f <= MPMarshallFormatLast; ++f) {
+#if !MPW_JSON
+                if (f == MPMarshallFormatJSON)
+                    continue;
+#endif
+
+                // Writing and reading derive the user's master keys, which the master-key cases measure already.
+                MPBenchCase benchCase = {
+                        .setup = mpw_bench_marshall_setup, .sites = sites[s], .format = f, .redacted = redacted, .excludeKDF = true,
+                };
+                const char *redaction = redacted? "redacted": "clear";
+                benchCase.run = mpw_bench_marshall_write;
+                mpw_bench_add( &cases, count, benchCase, "marshall-write/%s/%s/%zu", mpw_nameForFormat( f ), redaction, sites[s] );
+                benchCase.run = mpw_bench_marshall_read;
+                mpw_bench_add( &cases, count, benchCase, "marshall-read/%s/%s/%zu", mpw_nameForFormat( f ), redaction, sites[s] );
+                benchCase.run = mpw_bench_marshall_info;
+                mpw_bench_add( &cases, count, benchCase, "marshall-info/%s/%s/%zu", mpw_nameForFormat( f ), redaction, sites[s] );
+            }
+
+    return cases;
+}
+
+static int mpw_bench_compare(const void *a, const void *b) {
+
+    double da = *(const double *)a, db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+/** @return The two-sided 95% critical value of Student's t-distribution for the given degrees of freedom. */
+static double mpw_bench_t95(const size_t df) {
+
+    static const double t95[] = {
+            0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+            2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+            2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+    if (df < sizeof( t95 ) / sizeof( *t95 ))
+        return t95[df];
+
+    return 1.960;
+}
+
+/** @return The process' current or peak resident set size, in KiB, or 0 if it isn't known. */
+static long mpw_bench_rss(const bool peak) {
+
+#if __linux__
+    FILE *status = fopen( "/proc/self/status", "r" );
+    char line[128];
+    long rss = 0;
+    while (status && fgets( line, sizeof( line ), status ))
+        if (sscanf( line, peak? "VmHWM: %ld kB": "VmRSS: %ld kB", &rss ) == 1)
+            break;
+    if (status)
+        fclose( status );
+    if (rss)
+        return rss;
+#endif
+    if (!peak)
+        return 0;
+
+    struct rusage usage;
+    if (getrusage( RUSAGE_SELF, &usage ) != 0)
+        return 0;
+#if __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+/** Reset the process' peak resident set size to its current size, where the system supports it (Linux).
+  * @return false if the peak couldn't be reset and only keeps growing. */
+static bool mpw_bench_rss_reset() {
+
+#if __linux__
+    FILE *clearRefs = fopen( "/proc/self/clear_refs", "w" );
+    if (clearRefs) {
+        bool reset = fputs( "5", clearRefs ) >= 0;
+        return fclose( clearRefs ) == 0 && reset;
+    }
+#endif
+
+    return false;
+}
+
+/** Measure a case: warm it up, take samples until the time budget is spent, then measure the memory of one more iteration. */
+static bool mpw_bench(const MPBenchCase *benchCase, const double budget, MPBenchResult *result) {
+
+    if (benchCase->setup && !benchCase->setup( benchCase ))
+        return false;
+
+    double *samples = calloc( MPBenchSamplesMax, sizeof( *samples ) );
+    if (!samples)
+        return false;
+    benchKDF = (MPBenchKDF){ .time = 0 };
+    if (benchCase->excludeKDF)
+        mpw_stage_observer = mpw_bench_observe;
+
+    // Warm up and estimate the duration of an iteration.
+    size_t warmupIterations = 0;
+    double warmupStart = mpw_now(), warmupTime = 0;
+    do {
+        benchCase->run( benchCase );
+        ++warmupIterations;
+    } while ((warmupTime = mpw_now() - warmupStart) < budget / 10);
+
+    // Repeat fast iterations within a sample, so the clock's resolution doesn't dominate.
+    size_t batch = (size_t)ceil( MPBenchSampleTime / (warmupTime / warmupIterations) );
+    if (batch < 1)
+        batch = 1;
 
-    const char *fullName = "Robert Lee Mitchel";
-    const char *masterPassword = "banana colored duckling";
-    const char *siteName = "masterpasswordapp.com";
-    const MPCounterValue siteCounter = MPCounterValueDefault;
-    const MPResultType resultType = MPResultTypeDefault;
-    const MPKeyPurpose keyPurpose = MPKeyPurposeAuthentication;
-    const char *keyContext = NULL;
-    struct timeval startTime;
-    unsigned int iterations;
-    float percent;
-    MPMasterKey masterKey;
-
-    // Start HMAC-SHA-256
-    // Similar to phase-two of mpw
-    uint8_t *sitePasswordInfo = malloc( 128 );
-    iterations = 3000000;
-    masterKey = mpw_masterKey( fullName, masterPassword, MPAlgorithmVersionCurrent );
-    if (!masterKey) {
-        ftl( "Could not allocate master key: %s\n", strerror( errno ) );
-        abort();
-    }
-    mpw_getTime( &startTime );
-    for (int i = 1; i <= iterations; ++i) {
-        free( (void *)mpw_hash_hmac_sha256( masterKey, MPMasterKeySize, sitePasswordInfo, 128 ) );
-
-        if (modff(100.f * i / iterations, &percent) == 0)
-            fprintf( stderr, "\rhmac-sha-256: iteration %d / %d (%.0f%%)..", i, iterations, percent );
-    }
-    const double hmacSha256Speed = mpw_showSpeed( startTime, iterations, "hmac-sha-256" );
-    free( (void *)masterKey );
-
-    // Start BCrypt
-    // Similar to phase-one of mpw
-    int bcrypt_cost = 9;
-    iterations = 1000;
-    mpw_getTime( &startTime );
-    for (int i = 1; i <= iterations; ++i) {
-        crypt( masterPassword, crypt_gensalt( "$2b$", bcrypt_cost, fullName, strlen( fullName ) ) );
-
-        if (modff(100.f * i / iterations, &percent) == 0)
-            fprintf( stderr, "\rbcrypt (cost %d): iteration %d / %d (%.0f%%)..", bcrypt_cost, i, iterations, percent );
-    }
-    const double bcrypt9Speed = mpw_showSpeed( startTime, iterations, "bcrypt9" );
-
-    // Start SCrypt
-    // Phase one of mpw
-    iterations = 50;
-    mpw_getTime( &startTime );
-    for (int i = 1; i <= iterations; ++i) {
-        free( (void *)mpw_masterKey( fullName, masterPassword, MPAlgorithmVersionCurrent ) );
-
-        if (modff(100.f * i / iterations, &percent) == 0)
-            fprintf( stderr, "\rscrypt_mpw: iteration %d / %d (%.0f%%)..", i, iterations, percent );
-    }
-    const double scryptSpeed = mpw_showSpeed( startTime, iterations, "scrypt_mpw" );
-
-    // Start MPW
-    // Both phases of mpw
-    iterations = 50;
-    mpw_getTime( &startTime );
-    for (int i = 1; i <= iterations; ++i) {
-        masterKey = mpw_masterKey( fullName, masterPassword, MPAlgorithmVersionCurrent );
-        if (!masterKey) {
-            ftl( "Could not allocate master key: %s\n", strerror( errno ) );
+    *result = (MPBenchResult){ .allocations = -1, .allocated = -1, .peakHeap = -1, .retained = -1 };
+    MPAllocStats startStats;
+    bool hasAllocStats = mpw_alloc_stats( &startStats );
+    MPBenchKDF startKDF = benchKDF;
+    for (double start = mpw_now();
+         result->samples < MPBenchSamplesMin || (result->samples < MPBenchSamplesMax && mpw_now() - start < budget);) {
+        double sampleStart = mpw_now(), sampleKDFTime = benchKDF.time;
+        for (size_t i = 0; i < batch; ++i)
+            benchCase->run( benchCase );
+        samples[result->samples++] = (mpw_now() - sampleStart - (benchKDF.time - sampleKDFTime)) / batch;
+        result->iterations += batch;
+    }
+    MPAllocStats endStats;
+    if (hasAllocStats && mpw_alloc_stats( &endStats )) {
+        result->allocations = (double)(endStats.allocations - startStats.allocations -
+                                       (benchKDF.allocations - startKDF.allocations)) / result->iterations;
+        result->allocated = (double)(endStats.allocated - startStats.allocated -
+                                     (benchKDF.allocated - startKDF.allocated)) / result->iterations;
+        result->retained = max( ((double)endStats.inUse - (double)startStats.inUse) / result->iterations, 0. );
+    }
+
+    // Measure the peaks of a single iteration, so that memory retained by earlier iterations doesn't count.
+    long rss = mpw_bench_rss_reset()? mpw_bench_rss( false ): mpw_bench_rss( true );
+    MPAllocStats opStats;
+    mpw_alloc_stats( &opStats );
+    mpw_alloc_stats_reset_peak();
+    benchKDF.peak = 0;
+    benchCase->run( benchCase );
+    mpw_stage_observer = NULL;
+    if (hasAllocStats && mpw_alloc_stats( &endStats )) {
+        size_t peak = max( endStats.peak, benchKDF.peak );
+        result->peakHeap = peak > opStats.inUse? (double)(peak - opStats.inUse): 0;
+    }
+    result->peakRSS = max( mpw_bench_rss( true ) - rss, 0L );
+
+    // Summarize the samples.
+    qsort( samples, result->samples, sizeof( *samples ), mpw_bench_compare );
+    size_t n = result->samples;
+    result->min = samples[0];
+    result->median = n % 2? samples[n / 2]: (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    result->p99 = samples[(size_t)ceil( 0.99 * n ) - 1];
+    for (size_t s = 0; s < n; ++s)
+        result->mean += samples[s] / n;
+    double variance = 0;
+    for (size_t s = 0; s < n; ++s)
+        variance += (samples[s] - result->mean) * (samples[s] - result->mean) / (n - 1);
+    result->ci95 = mpw_bench_t95( n - 1 ) * sqrt( variance / n );
+    result->throughput = (benchCase->sites? benchCase->sites: 1) / result->median;
+    free( samples );
+
+    return true;
+}
+
+/** Format a duration in seconds with a suitable unit. */
+static const char *mpw_bench_time(char *buf, const size_t bufSize, const double seconds) {
+
+    if (seconds < 1e-6)
+        snprintf( buf, bufSize, "%.1fns", seconds * 1e9 );
+    else if (seconds < 1e-3)
+        snprintf( buf, bufSize, "%.2fµs", seconds * 1e6 );
+    else if (seconds < 1)
+        snprintf( buf, bufSize, "%.2fms", seconds * 1e3 );
+    else
+        snprintf( buf, bufSize, "%.3fs", seconds );
+
+    return buf;
+}
+
+/** Format an amount of bytes with a suitable unit, or "-" if it isn't known. */
+static const char *mpw_bench_bytes(char *buf, const size_t bufSize, const double bytes) {
+
+    if (bytes < 0)
+        snprintf( buf, bufSize, "-" );
+    else if (bytes < 1024)
+        snprintf( buf, bufSize, "%.0fB", bytes );
+    else if (bytes < 1024 * 1024)
+        snprintf( buf, bufSize, "%.1fKB", bytes / 1024 );
+    else if (bytes < 1024 * 1024 * 1024)
+        snprintf( buf, bufSize, "%.1fMB", bytes / (1024 * 1024) );
+    else
+        snprintf( buf, bufSize, "%.2fGB", bytes / (1024 * 1024 * 1024) );
+
+    return buf;
+}
+
+typedef struct MPScalingWorker {
+    pthread_t thread;
+    double budget;
+    /** The duration of each derivation performed by the worker, in seconds. */
+    double *latencies;
+    size_t count;
+    double end;
+} MPScalingWorker;
+
+static void *mpw_scaling_worker(void *worker_) {
+
+    MPScalingWorker *worker = worker_;
+    for (double start = mpw_now(), now = start; !worker->count || now - start < worker->budget;) {
+        MPMasterKey masterKey = mpw_masterKey( fullName, masterPassword, MPAlgorithmVersionCurrent );
+        mpw_free( masterKey, MPMasterKeySize );
+
+        double end = mpw_now();
+        if (!masterKey || !mpw_realloc( &worker->latencies, NULL, sizeof( *worker->latencies ) * (worker->count + 1) ))
             break;
+        worker->latencies[worker->count++] = end - now;
+        now = end;
+    }
+    worker->end = mpw_now();
+
+    return NULL;
+}
+
+/** Measure the throughput and latency of concurrent master key derivations on 1 to the given amount of threads. */
+static int mpw_scaling(const size_t maxThreads, const double budget, const bool json) {
+
+    // Each scrypt lane writes and then reads its N * 128 * r byte memory block.
+    const double bytesPerDerivation = 2. * MP_p * MP_N * 128 * MP_r;
+
+    if (json)
+        fprintf( stdout, "{ \"budget\": %g, \"bytes_per_derivation\": %.0f, \"steps\": [", budget, bytesPerDerivation );
+    else
+        fprintf( stdout, "%-7s %11s %12s %10s %10s %10s %12s %10s\n",
+                "threads", "derivations", "derivations/s", "p50", "p90", "p99", "est. GB/s", "efficiency" );
+
+    double singleThroughput = 0, previousThroughput = 0, kneeThroughput = 0;
+    size_t knee = 0;
+    for (size_t threads = 1; threads <= maxThreads; ++threads) {
+        inf( "%zu threads..", threads );
+        MPScalingWorker workers[threads];
+        double start = mpw_now(), end = start;
+        size_t started = 0;
+        for (; started < threads; ++started) {
+            workers[started] = (MPScalingWorker){ .budget = budget };
+            if (pthread_create( &workers[started].thread, NULL, mpw_scaling_worker, &workers[started] ) != 0) {
+                ftl( "Couldn't start worker thread: %s\n", strerror( errno ) );
+                break;
+            }
+        }
+
+        // Gather all of the workers' latencies.
+        double *latencies = NULL;
+        size_t count = 0;
+        for (size_t t = 0; t < started; ++t) {
+            pthread_join( workers[t].thread, NULL );
+            end = max( end, workers[t].end );
+            if (mpw_realloc( &latencies, NULL, sizeof( *latencies ) * (count + workers[t].count) )) {
+                memcpy( latencies + count, workers[t].latencies, sizeof( *latencies ) * workers[t].count );
+                count += workers[t].count;
+            }
+            free( workers[t].latencies );
+        }
+        inf( "\r%*s\r", 16, "" );
+        if (started < threads || !count) {
+            free( latencies );
+            return EX_OSERR;
         }
 
-        free( (void *)mpw_siteResult(
-                masterKey, siteName, siteCounter, keyPurpose, keyContext, resultType, NULL, MPAlgorithmVersionCurrent ) );
-        free( (void *)masterKey );
+        qsort( latencies, count, sizeof( *latencies ), mpw_bench_compare );
+        double p50 = latencies[(size_t)ceil( 0.50 * count ) - 1];
+        double p90 = latencies[(size_t)ceil( 0.90 * count ) - 1];
+        double p99 = latencies[(size_t)ceil( 0.99 * count ) - 1];
+        double throughput = count / (end - start);
+        if (threads == 1)
+            singleThroughput = throughput;
+        double efficiency = throughput / (singleThroughput * threads);
+        free( latencies );
 
-        if (modff(100.f * i / iterations, &percent) == 0)
-            fprintf( stderr, "\rmpw: iteration %d / %d (%.0f%%)..", i, iterations, percent );
+        // The knee is the last step where an added thread still contributed at least half a thread's throughput.
+        if (threads == 1 || (knee == threads - 1 && throughput - previousThroughput >= singleThroughput / 2)) {
+            knee = threads;
+            kneeThroughput = throughput;
+        }
+        previousThroughput = throughput;
+
+        if (json)
+            fprintf( stdout, "%s\n  { \"threads\": %zu, \"derivations\": %zu, \"throughput\": %.3f, "
+                             "\"p50_ns\": %.1f, \"p90_ns\": %.1f, \"p99_ns\": %.1f, \"bytes_per_s\": %.0f, \"efficiency\": %.3f }",
+                    threads == 1? "": ",", threads, count, throughput,
+                    p50 * 1e9, p90 * 1e9, p99 * 1e9, throughput * bytesPerDerivation, efficiency );
+        else {
+            char p50s[16], p90s[16], p99s[16];
+            fprintf( stdout, "%-7zu %11zu %12.2f %10s %10s %10s %12.2f %9.0f%%\n",
+                    threads, count, throughput,
+                    mpw_bench_time( p50s, sizeof( p50s ), p50 ),
+                    mpw_bench_time( p90s, sizeof( p90s ), p90 ),
+                    mpw_bench_time( p99s, sizeof( p99s ), p99 ),
+                    throughput * bytesPerDerivation / 1e9, efficiency * 100 );
+        }
     }
-    const double mpwSpeed = mpw_showSpeed( startTime, iterations, "mpw" );
 
-    // Summarize.
-    fprintf( stdout, "\n== SUMMARY ==\nOn this machine,\n" );
-    fprintf( stdout, " - mpw is %f times slower than hmac-sha-256 (reference: 320000 on an MBP Late 2013).\n", hmacSha256Speed / mpwSpeed );
-    fprintf( stdout, " - mpw is %f times slower than bcrypt (cost 9) (reference: 22 on an MBP Late 2013).\n", bcrypt9Speed / mpwSpeed );
-    fprintf( stdout, " - scrypt is %f times slower than bcrypt (cost 9) (reference: 22 on an MBP Late 2013).\n", bcrypt9Speed / scryptSpeed );
+    if (json)
+        fprintf( stdout, "\n], \"knee\": { \"threads\": %zu, \"throughput\": %.3f } }\n", knee, kneeThroughput );
+    else
+        fprintf( stdout, "\nKnee: %zu threads at %.2f derivations/s, "
+                         "beyond it an added thread gains less than half of a single thread's throughput.\n",
+                knee, kneeThroughput );
 
     return 0;
 }
+
+/** A case's result in a baseline, recorded earlier with --json on the same class of machine. */
+typedef struct MPBenchBaseline {
+    char *name;
+    double median;
+    double ci95;
+    /** The case's allocations, allocated and retained bytes per iteration and heap peak, or -1 if they weren't recorded. */
+    double allocations, allocated, retained, peakHeap;
+    /** The case's result in this run, if it was measured. */
+    bool measured;
+    MPBenchResult current;
+} MPBenchBaseline;
+
+/** @return The class of this machine: its operating system, architecture and amount of processors. */
+static const char *mpw_bench_machine() {
+
+    static char machine[256];
+    struct utsname system;
+    if (uname( &system ) != 0)
+        return "unknown";
+
+    snprintf( machine, sizeof( machine ), "%s-%s-%ldcpu",
+            system.sysname, system.machine, max( sysconf( _SC_NPROCESSORS_ONLN ), 1L ) );
+    for (char *c = machine; *c; ++c)
+        *c = (char)tolower( *c );
+
+    return machine;
+}
+
+/** Read the baseline at the given path, or if the path is a directory, the baseline for this machine's class in it.
+  * @return The baseline's cases or NULL if the baseline couldn't be read. */
+static MPBenchBaseline *mpw_bench_baseline(const char *path, size_t *count) {
+
+    *count = 0;
+#if MPW_JSON
+    char machinePath[PATH_MAX];
+    struct stat pathStat;
+    if (stat( path, &pathStat ) == 0 && S_ISDIR( pathStat.st_mode )) {
+        snprintf( machinePath, sizeof( machinePath ), "%s/%s.json", path, mpw_bench_machine() );
+        path = machinePath;
+    }
+
+    json_object *json = json_object_from_file( path ), *json_cases = NULL, *json_machine = NULL;
+    if (!json || !json_object_object_get_ex( json, "cases", &json_cases ) ||
+        !json_object_is_type( json_cases, json_type_array )) {
+        ftl( "Couldn't read the baseline: %s\n", path );
+        json_object_put( json );
+        return NULL;
+    }
+    if (json_object_object_get_ex( json, "machine", &json_machine ) &&
+        strcmp( json_object_get_string( json_machine ), mpw_bench_machine() ) != 0)
+        wrn( "The baseline was recorded on a different class of machine: %s, this is a: %s\n",
+                json_object_get_string( json_machine ), mpw_bench_machine() );
+
+    MPBenchBaseline *baseline = calloc( max( json_object_array_length( json_cases ), 1 ), sizeof( MPBenchBaseline ) );
+    for (size_t c = 0; baseline && c < json_object_array_length( json_cases ); ++c) {
+        json_object *json_case = json_object_array_get_idx( json_cases, c ), *json_name, *json_median, *json_ci95,
+                *json_allocations, *json_allocated, *json_retained, *json_peakHeap;
+        if (!json_object_object_get_ex( json_case, "name", &json_name ) ||
+            !json_object_object_get_ex( json_case, "median_ns", &json_median ))
+            continue;
+
+        baseline[*count] = (MPBenchBaseline){
+                .name = strdup( json_object_get_string( json_name ) ),
+                .median = json_object_get_double( json_median ) / 1e9,
+                .ci95 = json_object_object_get_ex( json_case, "ci95_ns", &json_ci95 )?
+                        json_object_get_double( json_ci95 ) / 1e9: 0,
+                .allocations = json_object_object_get_ex( json_case, "allocations", &json_allocations ) &&
+                               json_object_is_type( json_allocations, json_type_double )?
+                               json_object_get_double( json_allocations ): -1,
+                .allocated = json_object_object_get_ex( json_case, "allocated_bytes", &json_allocated ) &&
+                             json_object_is_type( json_allocated, json_type_double )?
+                             json_object_get_double( json_allocated ): -1,
+                .retained = json_object_object_get_ex( json_case, "retained_bytes", &json_retained ) &&
+                            json_object_is_type( json_retained, json_type_double )?
+                            json_object_get_double( json_retained ): -1,
+                .peakHeap = json_object_object_get_ex( json_case, "peak_heap_bytes", &json_peakHeap ) &&
+                            json_object_is_type( json_peakHeap, json_type_double )?
+                            json_object_get_double( json_peakHeap ): -1,
+        };
+        ++*count;
+    }
+    json_object_put( json );
+
+    return baseline;
+#else
+    ftl( "Comparing against a baseline requires JSON support.\n" );
+    return NULL;
+#endif
+}
+
+/** A case's time regressed when its median is slower than the baseline's by more than both the tolerance
+  * and the noise of both measurements, ie. their 95% confidence intervals. */
+static bool mpw_bench_regressed(const MPBenchBaseline *baseline, const MPBenchResult *result, const double tolerance) {
+
+    double slowdown = result->median - baseline->median;
+    return slowdown > baseline->median * tolerance && slowdown > baseline->ci95 + result->ci95;
+}
+
+/** A case's memory regressed when it allocates more often, allocates or retains more bytes per iteration, or reaches a
+  * higher heap peak, than the baseline by more than the tolerance.  Allocations are deterministic, so they need no allowance for noise. */
+static bool mpw_bench_regressed_memory(const MPBenchBaseline *baseline, const MPBenchResult *result, const double tolerance) {
+
+    if (baseline->allocations >= 0 && result->allocations >= 0 &&
+        result->allocations > baseline->allocations * (1 + tolerance) + MPBenchAllocationsSlack)
+        return true;
+    if (baseline->allocated >= 0 && result->allocated >= 0 &&
+        result->allocated > baseline->allocated * (1 + tolerance) + MPBenchBytesSlack)
+        return true;
+    if (baseline->retained >= 0 && result->retained >= 0 &&
+        result->retained > baseline->retained * (1 + tolerance) + MPBenchBytesSlack)
+        return true;
+    if (baseline->peakHeap >= 0 && result->peakHeap >= 0 &&
+        result->peakHeap > baseline->peakHeap * (1 + tolerance) + MPBenchBytesSlack)
+        return true;
+
+    return false;
+}
+
+static void usage() {
+
+    inf( ""
+            "Usage:\n"
+            "  mpw-bench [--filter pattern] [--time seconds] [--sites count] [--json] [--list] [-h]\n"
+            "  mpw-bench --baseline path [--tolerance percent] [--filter pattern] [--time seconds] [--json]\n"
+            "  mpw-bench --scaling[=threads] [--time seconds] [--json]\n\n" );
+    inf( ""
+            "  --filter pattern\n"
+            "               Only run the cases whose name matches the shell wildcard pattern,\n"
+            "               eg. 'master-key/*', 'site-result/*/v3' or 'marshall-*/json/*/1000'.\n\n" );
+    inf( ""
+            "  --sites count\n"
+            "               The size of the largest synthetic user for the marshalling cases,\n"
+            "               which are run for users of 10, 1000, 100000 and 1000000 sites.\n"
+            "               Defaults to 1000, the largest users take minutes and gigabytes to marshall.\n\n" );
+    inf( ""
+            "  --time seconds\n"
+            "               The time budget for sampling each case.\n"
+            "               Defaults to 1.\n\n" );
+    inf( ""
+            "  --json       Write the results as a JSON document.\n\n" );
+    inf( ""
+            "  --list       List the names of the cases instead of running them.\n\n" );
+    inf( ""
+            "  --baseline path\n"
+            "               Compare the cases against a baseline recorded earlier with --json on the same\n"
+            "               class of machine.  If path is a directory, the baseline in it named after this\n"
+            "               machine's class is used, eg. %s.json.\n"
+            "               Only the cases of the baseline are run.  A case regresses when its median is slower\n"
+            "               than the baseline's by more than the tolerance and by more than the noise of both\n"
+            "               measurements; regressed cases are measured once more to rule out a fluke.\n"
+            "               A case also regresses when it allocates more often, allocates or retains more\n"
+            "               bytes per iteration, or reaches a higher heap peak in an iteration, than the\n"
+            "               baseline by more than the tolerance.\n"
+            "               Exits with status 1 if any case regressed.\n\n", mpw_bench_machine() );
+    inf( ""
+            "  --tolerance percent\n"
+            "               The slowdown over the baseline that is tolerated.\n"
+            "               Defaults to " stringify_def( MPBenchTolerance ) ".\n\n" );
+    inf( ""
+            "  --scaling    Measure concurrent master key derivations on 1 up to the given amount of\n"
+            "               threads instead, with their throughput, latency and estimated memory\n"
+            "               bandwidth, and report the thread count beyond which throughput stops scaling.\n"
+            "               Defaults to the amount of processors.\n\n" );
+    exit( 0 );
+}
+
+int main(int argc, char *const argv[]) {
+
+    const char *filter = NULL, *baselinePath = NULL;
+    double budget = 1, tolerance = MPBenchTolerance / 100.;
+    bool json = false, list = false;
+    long scalingThreads = 0, maxSites = 1000;
+
+    enum {
+        MPBenchOptFilter = 0x100, MPBenchOptTime, MPBenchOptJSON, MPBenchOptList, MPBenchOptScaling, MPBenchOptSites,
+        MPBenchOptBaseline, MPBenchOptTolerance
+    };
+    const struct option longOptions[] = {
+            { "filter", required_argument, NULL, MPBenchOptFilter },
+            { "time", required_argument, NULL, MPBenchOptTime },
+            { "json", no_argument, NULL, MPBenchOptJSON },
+            { "list", no_argument, NULL, MPBenchOptList },
+            { "scaling", optional_argument, NULL, MPBenchOptScaling },
+            { "sites", required_argument, NULL, MPBenchOptSites },
+            { "baseline", required_argument, NULL, MPBenchOptBaseline },
+            { "tolerance", required_argument, NULL, MPBenchOptTolerance },
+            { NULL, 0, NULL, 0 },
+    };
+    for (int opt; (opt = getopt_long( argc, argv, "h", longOptions, NULL )) != EOF;)
+        switch (opt) {
+            case MPBenchOptFilter:
+                filter = optarg;
+                break;
+            case MPBenchOptTime:
+                if ((budget = atof( optarg )) <= 0) {
+                    ftl( "Invalid time budget: %s\n", optarg );
+                    return EX_USAGE;
+                }
+                break;
+            case MPBenchOptJSON:
+                json = true;
+                break;
+            case MPBenchOptList:
+                list = true;
+                break;
+            case MPBenchOptScaling:
+                if ((scalingThreads = optarg? atol( optarg ): max( sysconf( _SC_NPROCESSORS_ONLN ), 1L )) < 1) {
+                    ftl( "Invalid amount of threads: %s\n", optarg );
+                    return EX_USAGE;
+                }
+                break;
+            case MPBenchOptSites:
+                if ((maxSites = atol( optarg )) < 0) {
+                    ftl( "Invalid amount of sites: %s\n", optarg );
+                    return EX_USAGE;
+                }
+                break;
+            case MPBenchOptBaseline:
+                baselinePath = optarg;
+                break;
+            case MPBenchOptTolerance:
+                if ((tolerance = atof( optarg ) / 100) < 0) {
+                    ftl( "Invalid tolerance: %s\n", optarg );
+                    return EX_USAGE;
+                }
+                break;
+            case 'h':
+                usage();
+                break;
+            default:
+                return EX_USAGE;
+        }
+
+    if (scalingThreads)
+        return mpw_scaling( (size_t)scalingThreads, budget, json );
+
+    // Prepare the fixtures.
+    for (size_t b = 0; b < sizeof( hmacMessage ); ++b)
+        hmacMessage[b] = (uint8_t)b;
+    masterKeys = (MPMasterKeys){ .fullName = fullName, .masterPassword = masterPassword };
+    for (MPAlgorithmVersion v = MPAlgorithmVersionFirst; v <= MPAlgorithmVersionLast; ++v) {
+        MPMasterKey masterKey = mpw_masterKeys_get( &masterKeys, v );
+        if (!masterKey || !(siteStates[v] = mpw_siteState( masterKey, siteName, siteCounter,
+                keyPurpose, keyContext, MPResultTypeStatefulPersonal, masterPassword, v ))) {
+            ftl( "Couldn't prepare algorithm version %d: %s\n", v, strerror( errno ) );
+            return EX_SOFTWARE;
+        }
+    }
+
+    size_t baselineCount = 0;
+    MPBenchBaseline *baseline = NULL;
+    if (baselinePath && !(baseline = mpw_bench_baseline( baselinePath, &baselineCount )))
+        return EX_NOINPUT;
+
+    size_t casesCount = 0;
+    MPBenchCase *cases = mpw_bench_cases( &casesCount, baseline? SIZE_MAX: (size_t)maxSites );
+    if (json)
+        fprintf( stdout, "{ \"machine\": \"%s\", \"budget\": %g, \"cases\": [", mpw_bench_machine(), budget );
+    else if (!list)
+        fprintf( stdout, "%-36s %7s %10s %10s %10s %10s %10s %12s %12s %10s %10s %11s %10s %10s\n",
+                "case", "samples", "iterations", "min", "median", "p99", "mean", "± 95% ci", "items/s",
+                "allocs/op", "bytes/op", "retained/op", "peak heap", "peak rss" );
+
+    bool first = true;
+    size_t regressions = 0;
+    double hmacMedian = 0, bcryptMedian = 0, scryptMedian = 0, mpwMedian = 0;
+    for (size_t c = 0; c < casesCount; ++c) {
+        const MPBenchCase *benchCase = &cases[c];
+        if (filter && fnmatch( filter, benchCase->name, 0 ) != 0)
+            continue;
+        MPBenchBaseline *caseBaseline = NULL;
+        for (size_t b = 0; b < baselineCount && !caseBaseline; ++b)
+            if (strcmp( baseline[b].name, benchCase->name ) == 0)
+                caseBaseline = &baseline[b];
+        if (baseline && !caseBaseline)
+            continue;
+        if (list) {
+            fprintf( stdout, "%s\n", benchCase->name );
+            continue;
+        }
+
+        inf( "%s..", benchCase->name );
+        MPBenchResult result;
+        if (!mpw_bench( benchCase, budget, &result )) {
+            ftl( "Couldn't sample %s: %s\n", benchCase->name, strerror( errno ) );
+            return EX_SOFTWARE;
+        }
+        MPBenchResult retry;
+        if (caseBaseline && mpw_bench_regressed( caseBaseline, &result, tolerance ) &&
+            mpw_bench( benchCase, budget, &retry ) && retry.median < result.median)
+            result = retry;
+        inf( "\r%*s\r", (int)strlen( benchCase->name ) + 2, "" );
+        bool regressed = false;
+        if (caseBaseline) {
+            caseBaseline->measured = true;
+            caseBaseline->current = result;
+            if ((regressed = mpw_bench_regressed( caseBaseline, &result, tolerance ) ||
+                             mpw_bench_regressed_memory( caseBaseline, &result, tolerance )))
+                ++regressions;
+        }
+
+        if (json) {
+            fprintf( stdout, "%s\n  { \"name\": \"%s\", \"samples\": %zu, \"iterations\": %zu, "
+                             "\"min_ns\": %.1f, \"median_ns\": %.1f, \"p99_ns\": %.1f, \"mean_ns\": %.1f, \"ci95_ns\": %.1f, "
+                             "\"throughput\": %.3f, \"peak_rss_kb\": %ld",
+                    first? "": ",", benchCase->name, result.samples, result.iterations,
+                    result.min * 1e9, result.median * 1e9, result.p99 * 1e9, result.mean * 1e9, result.ci95 * 1e9,
+                    result.throughput, result.peakRSS );
+            if (result.allocations >= 0)
+                fprintf( stdout, ", \"allocations\": %.3f, \"allocated_bytes\": %.3f, \"retained_bytes\": %.3f, "
+                                 "\"peak_heap_bytes\": %.3f",
+                        result.allocations, result.allocated, result.retained, result.peakHeap );
+            else
+                fprintf( stdout, ", \"allocations\": null, \"allocated_bytes\": null, \"retained_bytes\": null, "
+                                 "\"peak_heap_bytes\": null" );
+            if (caseBaseline)
+                fprintf( stdout, ", \"baseline_median_ns\": %.1f, \"baseline_ci95_ns\": %.1f, \"regressed\": %s",
+                        caseBaseline->median * 1e9, caseBaseline->ci95 * 1e9, regressed? "true": "false" );
+            fprintf( stdout, " }" );
+        }
+        else {
+            char min[16], median[16], p99[16], mean[16], ci95[16], allocations[16], allocated[16], retained[16], peakHeap[16],
+                    peakRSS[16];
+            if (result.allocations >= 0)
+                snprintf( allocations, sizeof( allocations ), "%.1f", result.allocations );
+            else
+                snprintf( allocations, sizeof( allocations ), "-" );
+            fprintf( stdout, "%-36s %7zu %10zu %10s %10s %10s %10s %12s %12.1f %10s %10s %11s %10s %10s\n",
+                    benchCase->name, result.samples, result.iterations,
+                    mpw_bench_time( min, sizeof( min ), result.min ),
+                    mpw_bench_time( median, sizeof( median ), result.median ),
+                    mpw_bench_time( p99, sizeof( p99 ), result.p99 ),
+                    mpw_bench_time( mean, sizeof( mean ), result.mean ),
+                    mpw_bench_time( ci95, sizeof( ci95 ), result.ci95 ),
+                    result.throughput, allocations,
+                    mpw_bench_bytes( allocated, sizeof( allocated ), result.allocated ),
+                    mpw_bench_bytes( retained, sizeof( retained ), result.retained ),
+                    mpw_bench_bytes( peakHeap, sizeof( peakHeap ), result.peakHeap ),
+                    mpw_bench_bytes( peakRSS, sizeof( peakRSS ), result.peakRSS * 1024. ) );
+        }
+        first = false;
+
+        if (benchCase->run == mpw_bench_hmac)
+            hmacMedian = result.median;
+        else if (benchCase->run == mpw_bench_bcrypt)
+            bcryptMedian = result.median;
+        else if (benchCase->run == mpw_bench_masterKey && benchCase->algorithmVersion == MPAlgorithmVersionCurrent)
+            scryptMedian = result.median;
+        else if (benchCase->run == mpw_bench_mpw)
+            mpwMedian = result.median;
+    }
+    if (json)
+        fprintf( stdout, "\n] }\n" );
+
+    // Compare against the baseline.
+    else if (baseline && !list) {
+        fprintf( stdout, "\n== BASELINE ==\n%-36s %12s %12s %12s %12s %8s %12s %12s %12s %12s\n",
+                "case", "baseline", "± 95% ci", "current", "± 95% ci", "change",
+                "allocs/op", "current", "peak heap", "current" );
+        for (size_t b = 0; b < baselineCount; ++b) {
+            MPBenchBaseline *caseBaseline = &baseline[b];
+            if (filter && fnmatch( filter, caseBaseline->name, 0 ) != 0)
+                continue;
+
+            char baselineMedian[16], baselineCI95[16], currentMedian[16], currentCI95[16];
+            char baselineAllocations[16] = "-", currentAllocations[16] = "-", baselinePeakHeap[16], currentPeakHeap[16];
+            mpw_bench_time( baselineMedian, sizeof( baselineMedian ), caseBaseline->median );
+            mpw_bench_time( baselineCI95, sizeof( baselineCI95 ), caseBaseline->ci95 );
+            mpw_bench_bytes( baselinePeakHeap, sizeof( baselinePeakHeap ), caseBaseline->peakHeap );
+            if (caseBaseline->allocations >= 0)
+                snprintf( baselineAllocations, sizeof( baselineAllocations ), "%.1f", caseBaseline->allocations );
+            if (!caseBaseline->measured) {
+                fprintf( stdout, "%-36s %12s %12s %12s %12s %8s %12s %12s %12s %12s  missing\n",
+                        caseBaseline->name, baselineMedian, baselineCI95, "-", "-", "-",
+                        baselineAllocations, "-", baselinePeakHeap, "-" );
+                continue;
+            }
+
+            MPBenchResult *result = &caseBaseline->current;
+            if (result->allocations >= 0)
+                snprintf( currentAllocations, sizeof( currentAllocations ), "%.1f", result->allocations );
+            double change = (result->median - caseBaseline->median) / caseBaseline->median;
+            fprintf( stdout, "%-36s %12s %12s %12s %12s %+7.1f%% %12s %12s %12s %12s  %s\n", caseBaseline->name,
+                    baselineMedian, baselineCI95,
+                    mpw_bench_time( currentMedian, sizeof( currentMedian ), result->median ),
+                    mpw_bench_time( currentCI95, sizeof( currentCI95 ), result->ci95 ), change * 100,
+                    baselineAllocations, currentAllocations, baselinePeakHeap,
+                    mpw_bench_bytes( currentPeakHeap, sizeof( currentPeakHeap ), result->peakHeap ),
+                    mpw_bench_regressed( caseBaseline, result, tolerance )? "REGRESSED":
+                    mpw_bench_regressed_memory( caseBaseline, result, tolerance )? "REGRESSED (memory)":
+                    change < -tolerance? "faster": "ok" );
+        }
+        fprintf( stdout, "\n%zu case%s regressed beyond the tolerance of %g%%.\n",
+                regressions, regressions == 1? "": "s", tolerance * 100 );
+    }
+
+    // Summarize.
+    if (!json && !baseline && mpwMedian && (hmacMedian || bcryptMedian)) {
+        fprintf( stdout, "\n== SUMMARY ==\nOn this machine,\n" );
+        if (hmacMedian)
+            fprintf( stdout, " - mpw is %f times slower than hmac-sha-256 (reference: 320000 on an MBP Late 2013).\n", mpwMedian / hmacMedian );
+        if (bcryptMedian)
+            fprintf( stdout, " - mpw is %f times slower than bcrypt (cost 9) (reference: 22 on an MBP Late 2013).\n", mpwMedian / bcryptMedian );
+        if (bcryptMedian && scryptMedian)
+            fprintf( stdout, " - scrypt is %f times slower than bcrypt (cost 9) (reference: 22 on an MBP Late 2013).\n", scryptMedian / bcryptMedian );
+    }
+
+    for (size_t c = 0; c < casesCount; ++c)
+        free( cases[c].name );
+    free( cases );
+    for (MPAlgorithmVersion v = MPAlgorithmVersionFirst; v <= MPAlgorithmVersionLast; ++v)
+        mpw_free_string( siteStates[v] );
+    mpw_templatePolicy_free( siteTemplatePolicy );
+    mpw_masterKeys_free( &masterKeys );
+    mpw_marshal_free( benchUser.user );
+    for (MPMarshallFormat f = MPMarshallFormatFirst; f <= MPMarshallFormatLast; ++f)
+        mpw_free_string( benchUser.marshalled[f] );
+    for (size_t b = 0; b < baselineCount; ++b)
+        free( baseline[b].name );
+    free( baseline );
+
+    return regressions? 1: 0;
+}
@@ -0,0 +1,295 @@
+//==============================================================================
+// This file is part of Master Password.
+// Copyright (c) 2011-2017, Maarten Billemont.
+//
+// Master Password is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Master Password is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You can find a copy of the GNU General Public License in the
+// LICENSE file.  Alternatively, see <http://www.gnu.org/licenses/>.
+//==============================================================================
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "mpw-util.h"
+
+#include "mpw-cli-util.h"
+
+#define MPTimingDepthMax 32
+
+typedef struct MPTiming {
+    const char *stage;
+    size_t parent;
+    unsigned int depth;
+
+    unsigned int count;
+    double duration;
+    size_t allocations;
+
+    double beginTime;
+    size_t beginAllocations;
+} MPTiming;
+
+static bool mpw_timings_enabled;
+static pthread_t mpw_timings_thread;
+static double mpw_timings_startTime;
+static size_t mpw_timings_startAllocations;
+static MPTiming *mpw_timings;
+static size_t mpw_timings_count;
+static size_t mpw_timings_stack[MPTimingDepthMax];
+static unsigned int mpw_timings_depth;
+/** The stages that began without being recorded, which end without popping a recorded stage. */
+static unsigned int mpw_timings_skipped;
+
+double mpw_now() {
+
+    struct timespec now;
+    if (clock_gettime( CLOCK_MONOTONIC, &now ) != 0)
+        return 0;
+
+    return now.tv_sec + now.tv_nsec / 1000000000.;
+}
+
+static size_t mpw_allocations() {
+
+    MPAllocStats allocStats;
+    return mpw_alloc_stats( &allocStats )? allocStats.allocations: 0;
+}
+
+static void mpw_timings_observe(const char *stage, const bool begin) {
+
+    if (begin)
+        mpw_timing_begin( stage );
+    else
+        mpw_timing_end( stage );
+}
+
+void mpw_timings_start() {
+
+    mpw_timings_enabled = true;
+    mpw_timings_thread = pthread_self();
+    mpw_timings_startTime = mpw_now();
+    mpw_timings_startAllocations = mpw_allocations();
+    mpw_stage_observer = mpw_timings_observe;
+}
+
+void mpw_timing_begin(const char *stage) {
+
+    // Only the stages of the thread that started the timings are recorded.
+    if (!mpw_timings_enabled || !pthread_equal( pthread_self(), mpw_timings_thread ))
+        return;
+    if (mpw_timings_skipped || mpw_timings_depth >= MPTimingDepthMax) {
+        ++mpw_timings_skipped;
+        return;
+    }
+
+    // Accumulate into an earlier timing of this stage at the same position, if there is one.
+    size_t parent = mpw_timings_depth? mpw_timings_stack[mpw_timings_depth - 1]: (size_t)ERR;
+    size_t t = 0;
+    for (; t < mpw_timings_count; ++t)
+        if (mpw_timings[t].parent == parent && strcmp( mpw_timings[t].stage, stage ) == 0)
+            break;
+    if (t == mpw_timings_count) {
+        if (!mpw_realloc( &mpw_timings, NULL, sizeof( MPTiming ) * (mpw_timings_count + 1) )) {
+            ++mpw_timings_skipped;
+            return;
+        }
+
+        mpw_timings[mpw_timings_count++] = (MPTiming){
+                .stage = stage, .parent = parent, .depth = mpw_timings_depth,
+        };
+    }
+
+    mpw_timings_stack[mpw_timings_depth++] = t;
+    mpw_timings[t].beginAllocations = mpw_allocations();
+    mpw_timings[t].beginTime = mpw_now();
+}
+
+void mpw_timing_end(const char *stage) {
+
+    if (!mpw_timings_enabled || !pthread_equal( pthread_self(), mpw_timings_thread ))
+        return;
+    if (mpw_timings_skipped) {
+        --mpw_timings_skipped;
+        return;
+    }
+    if (!mpw_timings_depth)
+        return;
+
+    double endTime = mpw_now();
+    MPTiming *timing = &mpw_timings[mpw_timings_stack[--mpw_timings_depth]];
+    if (strcmp( timing->stage, stage ) != 0)
+        wrn( "Timing stage mismatch, ended: %s, expected: %s\n", stage, timing->stage );
+
+    timing->count++;
+    timing->duration += endTime - timing->beginTime;
+    timing->allocations += mpw_allocations() - timing->beginAllocations;
+}
+
+static void mpw_timings_report_table(FILE *out, const size_t parent, const bool hasAllocations) {
+
+    for (size_t t = 0; t < mpw_timings_count; ++t) {
+        MPTiming *timing = &mpw_timings[t];
+        if (timing->parent != parent)
+            continue;
+
+        fprintf( out, "  %*s%-*s %7u %12.3f", timing->depth * 2, "", 28 - timing->depth * 2, timing->stage,
+                timing->count, timing->duration * 1000 );
+        if (hasAllocations)
+            fprintf( out, " %12zu\n", timing->allocations );
+        else
+            fprintf( out, " %12s\n", "-" );
+
+        mpw_timings_report_table( out, t, hasAllocations );
+    }
+}
+
+static void mpw_timings_report_json(FILE *out, const size_t parent, const bool hasAllocations) {
+
+    fprintf( out, "[" );
+    bool first = true;
+    for (size_t t = 0; t < mpw_timings_count; ++t) {
+        MPTiming *timing = &mpw_timings[t];
+        if (timing->parent != parent)
+            continue;
+
+        fprintf( out, "%s{ \"stage\": \"%s\", \"count\": %u, \"ms\": %.3f, ",
+                first? " ": ", ", timing->stage, timing->count, timing->duration * 1000 );
+        if (hasAllocations)
+            fprintf( out, "\"allocations\": %zu, ", timing->allocations );
+        else
+            fprintf( out, "\"allocations\": null, " );
+        fprintf( out, "\"stages\": " );
+        mpw_timings_report_json( out, t, hasAllocations );
+        fprintf( out, " }" );
+        first = false;
+    }
+    fprintf( out, first? "]": " ]" );
+}
+
+void mpw_timings_report(FILE *out, const bool json) {
+
+    if (!mpw_timings_enabled)
+        return;
+
+    MPAllocStats allocStats;
+    bool hasAllocations = mpw_alloc_stats( &allocStats );
+    double duration = mpw_now() - mpw_timings_startTime;
+    size_t allocations = hasAllocations? allocStats.allocations - mpw_timings_startAllocations: 0;
+
+    if (json) {
+        fprintf( out, "{ \"ms\": %.3f, ", duration * 1000 );
+        if (hasAllocations)
+            fprintf( out, "\"allocations\": %zu, ", allocations );
+        else
+            fprintf( out, "\"allocations\": null, " );
+        fprintf( out, "\"stages\": " );
+        mpw_timings_report_json( out, (size_t)ERR, hasAllocations );
+        fprintf( out, " }\n" );
+    }
+    else {
+        fprintf( out, "  %-28s %7s %12s %12s\n", "stage", "count", "time (ms)", "allocations" );
+        mpw_timings_report_table( out, (size_t)ERR, hasAllocations );
+        fprintf( out, "  %-28s %7s %12.3f", "total", "", duration * 1000 );
+        if (hasAllocations)
+            fprintf( out, " %12zu\n", allocations );
+        else
+            fprintf( out, " %12s\n", "-" );
+    }
+}
+
+typedef struct MPJobs {
+    MPJob job;
+    void *context;
+    size_t count;
+    size_t next;
+} MPJobs;
+
+static void *mpw_parallel_worker(void *jobs_) {
+
+    MPJobs *jobs = jobs_;
+    for (size_t index; (index = __atomic_fetch_add( &jobs->next, 1, __ATOMIC_RELAXED )) < jobs->count;)
+        jobs->job( jobs->context, index );
+
+    return NULL;
+}
+
+void mpw_parallel(const size_t count, const MPJob job, void *context) {
+
+    if (!count)
+        return;
+
+    MPJobs jobs = { .job = job, .context = context, .count = count, .next = 0 };
+    long processors = mpw_verbosity >= trc_level? 1: sysconf( _SC_NPROCESSORS_ONLN );
+    size_t workers = processors > 1? min( (size_t)processors - 1, count - 1 ): 0;
+
+    // Start the workers, the calling thread is the final worker.
+    pthread_t threads[workers + 1];
+    size_t started = 0;
+    for (; started < workers; ++started)
+        if (pthread_create( &threads[started], NULL, mpw_parallel_worker, &jobs ) != 0) {
+            wrn( "Couldn't start worker thread: %s\n", strerror( errno ) );
+            break;
+        }
+    mpw_parallel_worker( &jobs );
+
+    for (size_t t = 0; t < started; ++t)
+        pthread_join( threads[t], NULL );
+}
+
+/** @return The lowest algorithm version that derives the same master key for the user as the given version. */
+static MPAlgorithmVersion mpw_masterKeys_version(const char *fullName, const MPAlgorithmVersion algorithmVersion) {
+
+    // V0 - V2 share the same master key, V3 only differs from them for multi-byte full names.
+    if (algorithmVersion <= MPAlgorithmVersion2 || strlen( fullName ) == mpw_utf8_strlen( fullName ))
+        return MPAlgorithmVersionFirst;
+
+    return algorithmVersion;
+}
+
+MPMasterKey mpw_masterKeys_get(
+        MPMasterKeys *masterKeys, const MPAlgorithmVersion algorithmVersion) {
+
+    if (!masterKeys || !masterKeys->fullName || !masterKeys->masterPassword ||
+        algorithmVersion < MPAlgorithmVersionFirst || algorithmVersion > MPAlgorithmVersionLast)
+        return NULL;
+
+    if (!masterKeys->keys[algorithmVersion]) {
+        MPAlgorithmVersion keyVersion = mpw_masterKeys_version( masterKeys->fullName, algorithmVersion );
+        if (!masterKeys->keys[keyVersion])
+            masterKeys->keys[keyVersion] = mpw_masterKey( masterKeys->fullName, masterKeys->masterPassword, keyVersion );
+        masterKeys->keys[algorithmVersion] = masterKeys->keys[keyVersion];
+    }
+
+    return masterKeys->keys[algorithmVersion];
+}
+
+void mpw_masterKeys_free(
+        MPMasterKeys *masterKeys) {
+
+    if (!masterKeys)
+        return;
+
+    for (MPAlgorithmVersion v = MPAlgorithmVersionFirst; v <= MPAlgorithmVersionLast; ++v) {
+        MPMasterKey masterKey = masterKeys->keys[v];
+        if (!masterKey)
+            continue;
+
+        // Shared keys are freed once.
+        for (MPAlgorithmVersion sv = v; sv <= MPAlgorithmVersionLast; ++sv)
+            if (masterKeys->keys[sv] == masterKey)
+                masterKeys->keys[sv] = NULL;
+        mpw_free( masterKey, MPMasterKeySize );
+    }
+}
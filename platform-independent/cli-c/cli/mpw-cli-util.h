@@ -0,0 +1,69 @@
+//==============================================================================
+// This file is part of Master Password.
+// Copyright (c) 2011-2017, Maarten Billemont.
+//
+// Master Password is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Master Password is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You can find a copy of the GNU General Public License in the
+// LICENSE file.  Alternatively, see <http://www.gnu.org/licenses/>.
+//==============================================================================
+
+#ifndef _MPW_CLI_UTIL_H
+#define _MPW_CLI_UTIL_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "mpw-algorithm.h"
+
+//// Timings.
+
+/** @return The current time of a monotonic clock, in seconds. */
+double mpw_now(void);
+
+/** Start recording the time and allocations spent in each stage of work, including the stages of the core. */
+void mpw_timings_start(void);
+/** Begin a stage of work.  The stage is nested in the stage that is currently in progress, if any.
+  * Repeated stages with the same name and parent are accumulated. */
+void mpw_timing_begin(const char *stage);
+/** End the stage of work that is currently in progress. */
+void mpw_timing_end(const char *stage);
+/** Write out a report of the recorded stages, either as a table or as a JSON document. */
+void mpw_timings_report(FILE *out, const bool json);
+
+//// Parallelism.
+
+/** A unit of work to perform on the item at the given index of a batch. */
+typedef void (*MPJob)(void *context, const size_t index);
+/** Perform the job for every index in the batch on a pool of worker threads, one for each available processor.
+  * The calling thread joins the pool and this function returns once every job has completed.
+  * The jobs run on the calling thread only when tracing, since trace output is not thread-safe. */
+void mpw_parallel(const size_t count, const MPJob job, void *context);
+
+//// Master keys.
+
+/** The master keys of a user for each algorithm version, derived as they are needed. */
+typedef struct MPMasterKeys {
+    const char *fullName;
+    const char *masterPassword;
+    MPMasterKey keys[MPAlgorithmVersionLast + 1];
+} MPMasterKeys;
+
+/** Obtain the user's master key for the given algorithm version.
+  * Versions whose master keys are identical for the user share a single key derivation.
+  * @return A master key owned by masterKeys or NULL if the key couldn't be derived. */
+MPMasterKey mpw_masterKeys_get(
+        MPMasterKeys *masterKeys, const MPAlgorithmVersion algorithmVersion);
+/** Free all master keys derived for the user. */
+void mpw_masterKeys_free(
+        MPMasterKeys *masterKeys);
+
+#endif // _MPW_CLI_UTIL_H
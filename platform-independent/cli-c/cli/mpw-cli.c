@@ -1,6 +1,9 @@
 #include <stdio.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <pwd.h>
+#include <fnmatch.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
@@ -12,9 +15,12 @@
 #include <histedit.h>
 #endif
 
+#include "json-c/json.h"
+
 #include "mpw-algorithm.h"
 #include "mpw-util.h"
 #include "mpw-marshall.h"
+#include "mpw-cli-util.h"
 
 #ifndef MP_VERSION
 #define MP_VERSION ?
@@ -22,6 +28,15 @@
 #define MP_ENV_fullName     "MP_FULLNAME"
 #define MP_ENV_algorithm    "MP_ALGORITHM"
 #define MP_ENV_format       "MP_FORMAT"
+#define MP_OPT_timings      0x100
+#define MP_OPT_audit        0x101
+#define MP_OPT_stale        0x102
+#define MP_OPT_upgrade      0x103
+#define MP_OPT_rotate       0x104
+#define MP_OPT_filter       0x105
+#define MP_OPT_export       0x106
+#define MP_OPT_import       0x107
+#define MPExportBatchSize   256
 
 static void usage() {
 
@@ -31,7 +46,17 @@ static void usage() {
     inf( ""
             "Usage:\n"
             "  mpw [-u|-U full-name] [-t pw-type] [-c counter] [-a algorithm] [-s value]\n"
-            "      [-p purpose] [-C context] [-f|-F format] [-R 0|1] [-v|-q] [-h] site-name\n\n" );
+            "      [-p purpose] [-C context] [-f|-F format] [-R 0|1] [-v|-q] [-h]\n"
+            "      [--timings[=json]] site-name\n"
+            "  mpw [-u|-U full-name] [-f|-F format] [-v|-q] [--timings[=json]]\n"
+            "      --audit[=json] [--stale days]\n"
+            "  mpw [-u|-U full-name] [-f|-F format] [-R 0|1] [-v|-q] [--timings[=json]]\n"
+            "      --upgrade[=algorithm]\n"
+            "  mpw [-u|-U full-name] [-f|-F format] [-R 0|1] [-v|-q] [--timings[=json]]\n"
+            "      --rotate [--filter pattern] [site-name ...]\n"
+            "  mpw [-u|-U full-name] [-f|-F format] [-v|-q] [--timings[=json]]\n"
+            "      --export ndjson|csv\n"
+            "  mpw [-u|-U full-name] [-R 0|1] [-v|-q] [--timings[=json]] --import file.csv\n\n" );
     inf( ""
             "  -u full-name Specify the full name of the user.\n"
             "               -u checks the master password against the config,\n"
@@ -48,6 +73,7 @@ static void usage() {
             "                   i, pin      | 4 numbers.\n"
             "                   n, name     | 9 letter name.\n"
             "                   p, phrase   | 20 character sentence.\n"
+            "                   c, custom   | template policy (set policy -s, eg. 'Cvcv[!#]nnnn').\n"
             "                   K, key      | encryption key (set key size -s bits).\n"
             "                   P, personal | saved personal password (save with -s pw).\n\n" );
     inf( ""
@@ -59,7 +85,10 @@ static void usage() {
             MPAlgorithmVersionFirst, MPAlgorithmVersionLast, MP_ENV_algorithm, MPAlgorithmVersionCurrent );
     inf( ""
             "  -s value     The value to save for -t P or -p i.\n"
-            "               The size of they key to generate for -t K, in bits (eg. 256).\n\n" );
+            "               The size of they key to generate for -t K, in bits (eg. 256).\n"
+            "               The template policy to save for -t c: templates of character\n"
+            "               classes separated by commas, where [...] lists the characters\n"
+            "               of a class of its own.\n\n" );
     inf( ""
             "  -p purpose   The purpose of the generated token.\n"
             "               Defaults to 'auth'.\n"
@@ -87,6 +116,45 @@ static void usage() {
     inf( ""
             "  -v           Increase output verbosity (can be repeated).\n"
             "  -q           Decrease output verbosity (can be repeated).\n\n" );
+    inf( ""
+            "  --timings    Report the time and allocations spent in each stage of the run.\n"
+            "               The report is written to standard error when mpw exits.\n"
+            "               --timings=json writes the report as a JSON document.\n"
+            "               Allocations are only counted by builds with mpw_alloc_stats=1.\n\n" );
+    inf( ""
+            "  --audit      Audit all of the user's sites instead of producing a site's password.\n"
+            "               Reports sites that use a weak password type (basic, short or pin),\n"
+            "               an outdated algorithm version, the same password as another site\n"
+            "               or that haven't been used in a while (see --stale).\n"
+            "               --audit=json writes the report as a JSON document.\n\n" );
+    inf( ""
+            "  --stale days The amount of days after which an unused site is considered stale.\n"
+            "               Defaults to 365.\n\n" );
+    inf( ""
+            "  --upgrade    Upgrade all of the user's sites to the given algorithm version.\n"
+            "               Saved passwords are re-encrypted and a report of the sites' old and\n"
+            "               new passwords is written to standard output.\n"
+            "               Defaults to %d.\n\n", MPAlgorithmVersionCurrent );
+    inf( ""
+            "  --rotate     Give the named sites and the sites that match --filter new passwords\n"
+            "               by incrementing their counter.  The new passwords are written to\n"
+            "               standard output.  Sites with a saved password or a time-based\n"
+            "               counter are not rotated.\n\n" );
+    inf( ""
+            "  --filter pattern\n"
+            "               A shell wildcard pattern for the names of the sites to rotate, eg. '*.com'.\n\n" );
+    inf( ""
+            "  --export format\n"
+            "               Export all of the user's sites with their passwords in clear text\n"
+            "               to standard output, one record per site.\n"
+            "                   ndjson      | One JSON object per line.\n"
+            "                   csv         | Comma-separated values with a header line.\n\n" );
+    inf( ""
+            "  --import file.csv\n"
+            "               Import the sites exported by another password manager as sites with\n"
+            "               saved personal passwords.  The first line of the file names the columns:\n"
+            "               name (or title), url, username (or login) and password.\n"
+            "               Sites that already exist are not changed.  Use - to read standard input.\n\n" );
     inf( ""
             "  ENVIRONMENT\n\n"
             "      %-14s | The full name of the user (see -u).\n"
@@ -129,6 +197,13 @@ static const char *mpw_getpass(const char *prompt) {
     return buf;
 }
 
+static bool mpw_timingsJSON;
+
+static void mpw_timings_atexit() {
+
+    mpw_timings_report( stderr, mpw_timingsJSON );
+}
+
 static char *mpw_path(const char *prefix, const char *extension) {
 
     char *homedir = NULL;
@@ -151,6 +226,1020 @@ static char *mpw_path(const char *prefix, const char *extension) {
     return mpwPath;
 }
 
+static bool mpw_save(MPMarshalledUser *user, const MPMarshallFormat sitesFormat) {
+
+    // Write to a temporary file first, which replaces the sites file only once it has been written completely.
+    int sitesFD = -1;
+    FILE *sitesFile = NULL;
+    char *sitesPath = mpw_path( user->fullName, mpw_marshall_format_extension( sitesFormat ) ), *sitesTmpPath = NULL;
+    dbg( "Updating: %s (%s)\n", sitesPath, mpw_nameForFormat( sitesFormat ) );
+    if (!sitesPath || asprintf( &sitesTmpPath, "%s.XXXXXX", sitesPath ) < 0 ||
+        (sitesFD = mkstemp( sitesTmpPath )) < 0 || !(sitesFile = fdopen( sitesFD, "w" ))) {
+        wrn( "Couldn't create updated configuration file:\n  %s: %s\n", sitesTmpPath?: sitesPath, strerror( errno ) );
+        if (sitesFD >= 0) {
+            close( sitesFD );
+            unlink( sitesTmpPath );
+        }
+        free( sitesTmpPath );
+        free( sitesPath );
+        return false;
+    }
+
+    char *buf = NULL;
+    MPMarshallError marshallError = { .type = MPMarshallSuccess };
+    mpw_timing_begin( "marshall-write" );
+    bool success = mpw_marshall_write( &buf, sitesFormat, user, &marshallError );
+    mpw_timing_end( "marshall-write" );
+    if (!success || marshallError.type != MPMarshallSuccess) {
+        wrn( "Couldn't encode updated configuration file:\n  %s: %s\n", sitesPath, marshallError.description );
+        success = false;
+    }
+
+    else {
+        mpw_timing_begin( "write" );
+        if (fwrite( buf, sizeof( char ), strlen( buf ), sitesFile ) != strlen( buf )) {
+            wrn( "Error while writing updated configuration file:\n  %s: %d\n", sitesPath, ferror( sitesFile ) );
+            success = false;
+        }
+        mpw_timing_end( "write" );
+    }
+
+    mpw_free_string( buf );
+    if (fclose( sitesFile ) != 0 && success) {
+        wrn( "Error while writing updated configuration file:\n  %s: %s\n", sitesPath, strerror( errno ) );
+        success = false;
+    }
+    if (success && rename( sitesTmpPath, sitesPath ) != 0) {
+        wrn( "Couldn't replace configuration file:\n  %s: %s\n", sitesPath, strerror( errno ) );
+        success = false;
+    }
+    if (!success)
+        unlink( sitesTmpPath );
+    free( sitesTmpPath );
+    free( sitesPath );
+
+    return success;
+}
+
+typedef struct MPReencryption {
+    const MPMarshalledUser *user;
+    MPMasterKeys *oldMasterKeys, *newMasterKeys;
+    /** The site's content encrypted with the new master key, if it has any. */
+    const char **newContents;
+    bool *failed;
+} MPReencryption;
+
+static void mpw_reencrypt_site(void *reencryption_, const size_t s) {
+
+    MPReencryption *reencryption = reencryption_;
+    const MPMarshalledSite *site = &reencryption->user->sites[s];
+    if (!(site->type & MPResultTypeClassStateful) || !site->content)
+        return;
+
+    const char *plainText = mpw_siteResult( reencryption->oldMasterKeys->keys[site->algorithm], site->name, site->counter,
+            MPKeyPurposeAuthentication, NULL, site->type, site->content, site->algorithm );
+    const char *newContent = plainText? mpw_siteState( reencryption->newMasterKeys->keys[site->algorithm],
+            site->name, site->counter, MPKeyPurposeAuthentication, NULL, site->type, plainText, site->algorithm ): NULL;
+
+    // Verify that the new content decrypts to the original.
+    const char *newPlainText = newContent? mpw_siteResult( reencryption->newMasterKeys->keys[site->algorithm],
+            site->name, site->counter, MPKeyPurposeAuthentication, NULL, site->type, newContent, site->algorithm ): NULL;
+    if (!newPlainText || strcmp( plainText, newPlainText ) != 0) {
+        reencryption->failed[s] = true;
+        mpw_free_string( newContent );
+        newContent = NULL;
+    }
+
+    reencryption->newContents[s] = newContent;
+    mpw_free_string( plainText );
+    mpw_free_string( newPlainText );
+}
+
+/** Change the user's master password, re-encrypting all of the user's saved site content from the old master password
+  * to the new one.  The user is only updated if all of its content could be re-encrypted. */
+static bool mpw_reencrypt(MPMarshalledUser *user, const char *oldMasterPassword, const char *newMasterPassword) {
+
+    // Derive the old and new master keys for the algorithm versions of the sites with saved content up-front.
+    mpw_timing_begin( "master-keys" );
+    MPMasterKeys oldMasterKeys = { .fullName = user->fullName, .masterPassword = oldMasterPassword };
+    MPMasterKeys newMasterKeys = { .fullName = user->fullName, .masterPassword = newMasterPassword };
+    bool success = true;
+    for (size_t s = 0; success && s < user->sites_count; ++s)
+        if (user->sites[s].type & MPResultTypeClassStateful && user->sites[s].content)
+            success &= mpw_masterKeys_get( &oldMasterKeys, user->sites[s].algorithm ) &&
+                       mpw_masterKeys_get( &newMasterKeys, user->sites[s].algorithm );
+    mpw_timing_end( "master-keys" );
+
+    // Re-encrypt the sites' content.
+    MPReencryption reencryption = {
+            .user = user,
+            .oldMasterKeys = &oldMasterKeys,
+            .newMasterKeys = &newMasterKeys,
+            .newContents = calloc( user->sites_count, sizeof( *reencryption.newContents ) ),
+            .failed = calloc( user->sites_count, sizeof( *reencryption.failed ) ),
+    };
+    if (!success)
+        err( "Couldn't derive master key.\n" );
+    else if (user->sites_count && (!reencryption.newContents || !reencryption.failed)) {
+        err( "Couldn't allocate re-encryption.\n" );
+        success = false;
+    }
+    else if (user->sites_count) {
+        mpw_timing_begin( "site-states" );
+        mpw_parallel( user->sites_count, mpw_reencrypt_site, &reencryption );
+        mpw_timing_end( "site-states" );
+    }
+    mpw_masterKeys_free( &oldMasterKeys );
+    mpw_masterKeys_free( &newMasterKeys );
+
+    // Commit the new content and master password only if all of the sites could be re-encrypted.
+    for (size_t s = 0; success && s < user->sites_count; ++s)
+        if (reencryption.failed[s]) {
+            err( "Couldn't re-encrypt site: %s\n", user->sites[s].name );
+            success = false;
+        }
+    for (size_t s = 0; s < user->sites_count && reencryption.newContents; ++s) {
+        if (success && reencryption.newContents[s]) {
+            mpw_free_string( user->sites[s].content );
+            user->sites[s].content = reencryption.newContents[s];
+        }
+        else
+            mpw_free_string( reencryption.newContents[s] );
+    }
+    if (success) {
+        mpw_free_string( user->masterPassword );
+        user->masterPassword = strdup( newMasterPassword );
+    }
+    free( reencryption.newContents );
+    free( reencryption.failed );
+
+    return success;
+}
+
+typedef struct MPAudit {
+    const MPMarshalledUser *user;
+    MPMasterKeys *masterKeys;
+    /** The site's password or NULL if it has none or it couldn't be determined. */
+    const char **results;
+    /** The index + 1 of the first site that has the same password as the site, or 0 if it is the first. */
+    size_t *duplicates;
+    /** An open-addressed set of site index + 1 values, hashed by their password. */
+    size_t *resultSet;
+    size_t resultSetSize;
+} MPAudit;
+
+static size_t mpw_string_hash(const char *string) {
+
+    // FNV-1a
+    size_t hash = 2166136261U;
+    for (; *string; ++string)
+        hash = (hash ^ (uint8_t)*string) * 16777619U;
+
+    return hash;
+}
+
+static void mpw_audit_site(void *audit_, const size_t s) {
+
+    MPAudit *audit = audit_;
+    const MPMarshalledSite *site = &audit->user->sites[s];
+    if (site->type & MPResultTypeClassDerive || (site->type & MPResultTypeClassStateful && !site->content))
+        // Not a password or no password saved.
+        return;
+
+    const char *result = audit->results[s] = mpw_siteResult(
+            audit->masterKeys->keys[site->algorithm], site->name, site->counter,
+            MPKeyPurposeAuthentication, NULL, site->type, site->content, site->algorithm );
+    if (!result || !strlen( result ))
+        return;
+
+    // Add the site to the result set, unless an earlier site with the same result is already in it.
+    for (size_t slot = mpw_string_hash( result ) % audit->resultSetSize;; slot = (slot + 1) % audit->resultSetSize) {
+        size_t other = 0;
+        if (__atomic_compare_exchange_n( &audit->resultSet[slot], &other, s + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ))
+            break;
+        if (strcmp( audit->results[other - 1], result ) == 0) {
+            audit->duplicates[s] = other;
+            break;
+        }
+    }
+}
+
+static int mpw_audit(const MPMarshalledUser *user, const bool json, const unsigned int staleDays) {
+
+    if (!user->sites_count) {
+        inf( "No sites to audit.\n" );
+        return 0;
+    }
+
+    // Derive the master keys for all of the sites' algorithm versions up-front, so the workers can share them.
+    mpw_timing_begin( "master-keys" );
+    MPMasterKeys masterKeys = { .fullName = user->fullName, .masterPassword = user->masterPassword };
+    for (size_t s = 0; s < user->sites_count; ++s)
+        if (!mpw_masterKeys_get( &masterKeys, user->sites[s].algorithm )) {
+            mpw_timing_end( "master-keys" );
+            ftl( "Couldn't derive master key.\n" );
+            mpw_masterKeys_free( &masterKeys );
+            return EX_SOFTWARE;
+        }
+    mpw_timing_end( "master-keys" );
+
+    // Determine the sites' passwords.
+    mpw_timing_begin( "site-results" );
+    MPAudit audit = {
+            .user = user,
+            .masterKeys = &masterKeys,
+            .results = calloc( user->sites_count, sizeof( *audit.results ) ),
+            .duplicates = calloc( user->sites_count, sizeof( *audit.duplicates ) ),
+            .resultSetSize = user->sites_count * 2 + 1,
+    };
+    audit.resultSet = calloc( audit.resultSetSize, sizeof( *audit.resultSet ) );
+    if (!audit.results || !audit.duplicates || !audit.resultSet) {
+        mpw_timing_end( "site-results" );
+        ftl( "Couldn't allocate audit.\n" );
+        mpw_masterKeys_free( &masterKeys );
+        return EX_SOFTWARE;
+    }
+    mpw_parallel( user->sites_count, mpw_audit_site, &audit );
+    mpw_masterKeys_free( &masterKeys );
+
+    // The site of a password that wins the result set depends on the workers, resolve each group to its first site instead.
+    size_t *firsts = calloc( user->sites_count, sizeof( *firsts ) );
+    for (size_t s = 0; firsts && s < user->sites_count; ++s)
+        if (audit.duplicates[s] && !firsts[audit.duplicates[s] - 1])
+            firsts[audit.duplicates[s] - 1] = min( s, audit.duplicates[s] - 1 ) + 1;
+    for (size_t s = 0; firsts && s < user->sites_count; ++s) {
+        size_t first = firsts[audit.duplicates[s]? audit.duplicates[s] - 1: s];
+        if (first)
+            audit.duplicates[s] = first == s + 1? 0: first;
+    }
+    free( firsts );
+    mpw_timing_end( "site-results" );
+
+    // Report the sites that have issues.
+    mpw_timing_begin( "report" );
+    time_t staleTime = time( NULL ) - (time_t)staleDays * 24 * 3600;
+    size_t weakCount = 0, outdatedCount = 0, staleCount = 0, duplicateCount = 0;
+    json_object *json_report = json_object_new_object(), *json_sites = json_object_new_array();
+    json_object_object_add( json_report, "full_name", json_object_new_string( user->fullName ) );
+    json_object_object_add( json_report, "sites_count", json_object_new_int( (int)user->sites_count ) );
+    json_object_object_add( json_report, "stale_days", json_object_new_int( (int)staleDays ) );
+    json_object_object_add( json_report, "sites", json_sites );
+    if (!json)
+        fprintf( stdout, "%-32s %-9s %-9s %-20s %s\n", "site", "type", "algorithm", "last used", "issues" );
+    for (size_t s = 0; s < user->sites_count; ++s) {
+        const MPMarshalledSite *site = &user->sites[s];
+        bool weak = site->type == MPResultTypeTemplateBasic ||
+                    site->type == MPResultTypeTemplateShort ||
+                    site->type == MPResultTypeTemplatePIN;
+        bool outdated = site->algorithm < MPAlgorithmVersionCurrent;
+        bool stale = site->lastUsed < staleTime;
+        bool missing = !audit.results[s] && !(site->type & MPResultTypeClassDerive);
+        const MPMarshalledSite *duplicate = audit.duplicates[s]? &user->sites[audit.duplicates[s] - 1]: NULL;
+        if (!duplicate)
+            // The first site with a password is also a duplicate if other sites share its password.
+            for (size_t d = s + 1; d < user->sites_count; ++d)
+                if (audit.duplicates[d] == s + 1) {
+                    duplicate = &user->sites[d];
+                    break;
+                }
+        weakCount += weak;
+        outdatedCount += outdated;
+        staleCount += stale;
+        duplicateCount += duplicate != NULL;
+        if (!weak && !outdated && !stale && !duplicate && !missing)
+            continue;
+
+        char lastUsed[21] = "never";
+        if (site->lastUsed)
+            strftime( lastUsed, sizeof( lastUsed ), "%FT%TZ", gmtime( &site->lastUsed ) );
+
+        if (json) {
+            json_object *json_site = json_object_new_object();
+            json_object_array_add( json_sites, json_site );
+            json_object_object_add( json_site, "name", json_object_new_string( site->name ) );
+            json_object_object_add( json_site, "type", json_object_new_string( mpw_nameForType( site->type )?: "" ) );
+            json_object_object_add( json_site, "algorithm", json_object_new_int( (int)site->algorithm ) );
+            json_object_object_add( json_site, "last_used", json_object_new_string( lastUsed ) );
+            json_object_object_add( json_site, "weak_type", json_object_new_boolean( weak ) );
+            json_object_object_add( json_site, "outdated_algorithm", json_object_new_boolean( outdated ) );
+            json_object_object_add( json_site, "stale", json_object_new_boolean( stale ) );
+            json_object_object_add( json_site, "missing_password", json_object_new_boolean( missing ) );
+            if (duplicate)
+                json_object_object_add( json_site, "same_password_as", json_object_new_string( duplicate->name ) );
+        }
+        else {
+            char *issues = NULL;
+            if (weak)
+                mpw_string_pushf( &issues, "%sweak type", issues? ", ": "" );
+            if (outdated)
+                mpw_string_pushf( &issues, "%soutdated algorithm", issues? ", ": "" );
+            if (stale)
+                mpw_string_pushf( &issues, "%sstale", issues? ", ": "" );
+            if (missing)
+                mpw_string_pushf( &issues, "%sno password", issues? ", ": "" );
+            if (duplicate)
+                mpw_string_pushf( &issues, "%ssame password as %s", issues? ", ": "", duplicate->name );
+            fprintf( stdout, "%-32s %-9s %-9u %-20s %s\n",
+                    site->name, mpw_nameForType( site->type ), site->algorithm, lastUsed, issues );
+            free( issues );
+        }
+    }
+
+    if (json) {
+        json_object_object_add( json_report, "weak_type_count", json_object_new_int( (int)weakCount ) );
+        json_object_object_add( json_report, "outdated_algorithm_count", json_object_new_int( (int)outdatedCount ) );
+        json_object_object_add( json_report, "stale_count", json_object_new_int( (int)staleCount ) );
+        json_object_object_add( json_report, "duplicate_count", json_object_new_int( (int)duplicateCount ) );
+        fprintf( stdout, "%s\n", json_object_to_json_string_ext( json_report, JSON_C_TO_STRING_PRETTY | JSON_C_TO_STRING_SPACED ) );
+    }
+    else
+        fprintf( stdout, "\n%zu sites: %zu use a weak type, %zu use an outdated algorithm, "
+                         "%zu weren't used in %u days, %zu share their password with another site.\n",
+                user->sites_count, weakCount, outdatedCount, staleCount, staleDays, duplicateCount );
+    json_object_put( json_report );
+    mpw_timing_end( "report" );
+
+    for (size_t s = 0; s < user->sites_count; ++s)
+        mpw_free_string( audit.results[s] );
+    free( audit.results );
+    free( audit.duplicates );
+    free( audit.resultSet );
+
+    return 0;
+}
+
+typedef struct MPUpgradedSite {
+    /** The site's password before and after the upgrade, NULL if it has none. */
+    const char *oldResult, *newResult;
+    /** The site's content encrypted for the new algorithm version, if it has any. */
+    const char *newContent;
+    /** The site's generated login name before and after the upgrade, NULL if it has none. */
+    const char *oldLogin, *newLogin;
+    bool failed;
+} MPUpgradedSite;
+
+typedef struct MPUpgrade {
+    const MPMarshalledUser *user;
+    MPMasterKeys *masterKeys;
+    MPAlgorithmVersion algorithmVersion;
+    MPUpgradedSite *sites;
+} MPUpgrade;
+
+static void mpw_upgrade_site(void *upgrade_, const size_t s) {
+
+    MPUpgrade *upgrade = upgrade_;
+    const MPMarshalledSite *site = &upgrade->user->sites[s];
+    MPUpgradedSite *upgraded = &upgrade->sites[s];
+    if (site->algorithm >= upgrade->algorithmVersion)
+        return;
+
+    MPMasterKey oldKey = upgrade->masterKeys->keys[site->algorithm];
+    MPMasterKey newKey = upgrade->masterKeys->keys[upgrade->algorithmVersion];
+    if (site->type & MPResultTypeClassTemplate) {
+        upgraded->oldResult = mpw_siteResult( oldKey, site->name, site->counter,
+                MPKeyPurposeAuthentication, NULL, site->type, site->content, site->algorithm );
+        upgraded->newResult = mpw_siteResult( newKey, site->name, site->counter,
+                MPKeyPurposeAuthentication, NULL, site->type, site->content, upgrade->algorithmVersion );
+        upgraded->failed |= !upgraded->oldResult || !upgraded->newResult;
+    }
+    else if (site->type & MPResultTypeClassStateful && site->content) {
+        // The password is unchanged, but its encryption depends on the algorithm version.
+        upgraded->oldResult = mpw_siteResult( oldKey, site->name, site->counter,
+                MPKeyPurposeAuthentication, NULL, site->type, site->content, site->algorithm );
+        if (upgraded->oldResult)
+            upgraded->newContent = mpw_siteState( newKey, site->name, site->counter,
+                    MPKeyPurposeAuthentication, NULL, site->type, upgraded->oldResult, upgrade->algorithmVersion );
+        if (upgraded->newContent)
+            upgraded->newResult = mpw_siteResult( newKey, site->name, site->counter,
+                    MPKeyPurposeAuthentication, NULL, site->type, upgraded->newContent, upgrade->algorithmVersion );
+        upgraded->failed |= !upgraded->newResult || strcmp( upgraded->oldResult, upgraded->newResult ) != 0;
+    }
+    if (site->loginGenerated) {
+        upgraded->oldLogin = mpw_siteResult( oldKey, site->name, site->counter,
+                MPKeyPurposeIdentification, NULL, MPResultTypeTemplateName, NULL, site->algorithm );
+        upgraded->newLogin = mpw_siteResult( newKey, site->name, site->counter,
+                MPKeyPurposeIdentification, NULL, MPResultTypeTemplateName, NULL, upgrade->algorithmVersion );
+        upgraded->failed |= !upgraded->oldLogin || !upgraded->newLogin;
+    }
+}
+
+static int mpw_upgrade(MPMarshalledUser *user, const MPAlgorithmVersion algorithmVersion) {
+
+    // Derive the master keys for the sites' current and the new algorithm version up-front.
+    mpw_timing_begin( "master-keys" );
+    size_t upgradeCount = 0;
+    MPMasterKeys masterKeys = { .fullName = user->fullName, .masterPassword = user->masterPassword };
+    bool success = mpw_masterKeys_get( &masterKeys, algorithmVersion ) != NULL;
+    for (size_t s = 0; success && s < user->sites_count; ++s)
+        if (user->sites[s].algorithm < algorithmVersion) {
+            success &= mpw_masterKeys_get( &masterKeys, user->sites[s].algorithm ) != NULL;
+            ++upgradeCount;
+        }
+    mpw_timing_end( "master-keys" );
+    if (!success) {
+        ftl( "Couldn't derive master key.\n" );
+        mpw_masterKeys_free( &masterKeys );
+        return EX_SOFTWARE;
+    }
+    if (!upgradeCount) {
+        inf( "All sites already use algorithm version %d or later.\n", algorithmVersion );
+        mpw_masterKeys_free( &masterKeys );
+        return 0;
+    }
+
+    // Determine the sites' old and new passwords.
+    mpw_timing_begin( "site-results" );
+    MPUpgrade upgrade = {
+            .user = user,
+            .masterKeys = &masterKeys,
+            .algorithmVersion = algorithmVersion,
+            .sites = calloc( user->sites_count, sizeof( *upgrade.sites ) ),
+    };
+    if (!upgrade.sites) {
+        mpw_timing_end( "site-results" );
+        ftl( "Couldn't allocate upgrade.\n" );
+        mpw_masterKeys_free( &masterKeys );
+        return EX_SOFTWARE;
+    }
+    mpw_parallel( user->sites_count, mpw_upgrade_site, &upgrade );
+    mpw_masterKeys_free( &masterKeys );
+    mpw_timing_end( "site-results" );
+
+    // Apply the upgrade only if all of the sites could be upgraded.
+    for (size_t s = 0; s < user->sites_count; ++s)
+        if (upgrade.sites[s].failed) {
+            ftl( "Couldn't upgrade site: %s\n", user->sites[s].name );
+            success = false;
+        }
+    if (success) {
+        fprintf( stdout, "%-32s %-9s %-9s %-22s %s\n", "site", "type", "algorithm", "old password", "new password" );
+        for (size_t s = 0; s < user->sites_count; ++s) {
+            MPMarshalledSite *site = &user->sites[s];
+            MPUpgradedSite *upgraded = &upgrade.sites[s];
+            if (site->algorithm >= algorithmVersion)
+                continue;
+
+            char *algorithm = NULL;
+            mpw_string_pushf( &algorithm, "%d -> %d", site->algorithm, algorithmVersion );
+            fprintf( stdout, "%-32s %-9s %-9s %-22s %s\n", site->name, mpw_nameForType( site->type ), algorithm,
+                    upgraded->oldResult?: "-", upgraded->newResult?: "-" );
+            if (upgraded->oldLogin)
+                fprintf( stdout, "%-32s %-9s %-9s %-22s %s\n", "", "login", "",
+                        upgraded->oldLogin, upgraded->newLogin );
+            free( algorithm );
+
+            site->algorithm = algorithmVersion;
+            if (upgraded->newContent) {
+                mpw_free_string( site->content );
+                site->content = upgraded->newContent;
+                upgraded->newContent = NULL;
+            }
+        }
+        if (user->algorithm < algorithmVersion)
+            user->algorithm = algorithmVersion;
+        fprintf( stdout, "\n%zu of %zu sites upgraded to algorithm version %d.\n",
+                upgradeCount, user->sites_count, algorithmVersion );
+    }
+
+    for (size_t s = 0; s < user->sites_count; ++s) {
+        MPUpgradedSite *upgraded = &upgrade.sites[s];
+        mpw_free_string( upgraded->oldResult );
+        mpw_free_string( upgraded->newResult );
+        mpw_free_string( upgraded->newContent );
+        mpw_free_string( upgraded->oldLogin );
+        mpw_free_string( upgraded->newLogin );
+    }
+    free( upgrade.sites );
+
+    return success? 0: EX_SOFTWARE;
+}
+
+typedef struct MPRotation {
+    const MPMarshalledUser *user;
+    MPMasterKeys *masterKeys;
+    /** Whether to rotate the site. */
+    bool *selected;
+    /** The site's password for its next counter value. */
+    const char **newResults;
+} MPRotation;
+
+static void mpw_rotate_site(void *rotation_, const size_t s) {
+
+    MPRotation *rotation = rotation_;
+    const MPMarshalledSite *site = &rotation->user->sites[s];
+    if (!rotation->selected[s])
+        return;
+
+    rotation->newResults[s] = mpw_siteResult( rotation->masterKeys->keys[site->algorithm], site->name, site->counter + 1,
+            MPKeyPurposeAuthentication, NULL, site->type, site->content, site->algorithm );
+}
+
+static int mpw_rotate(MPMarshalledUser *user, const char *filter, char *const siteNames[], const size_t siteNamesCount) {
+
+    MPRotation rotation = {
+            .user = user,
+            .selected = calloc( user->sites_count, sizeof( *rotation.selected ) ),
+            .newResults = calloc( user->sites_count, sizeof( *rotation.newResults ) ),
+    };
+    if (user->sites_count && (!rotation.selected || !rotation.newResults)) {
+        ftl( "Couldn't allocate rotation.\n" );
+        free( rotation.selected );
+        free( rotation.newResults );
+        return EX_SOFTWARE;
+    }
+
+    // Select the named sites and the sites that match the filter.
+    size_t rotateCount = 0;
+    for (size_t n = 0; n < siteNamesCount; ++n) {
+        bool found = false;
+        for (size_t s = 0; !found && s < user->sites_count; ++s)
+            if ((found = strcmp( siteNames[n], user->sites[s].name ) == 0))
+                rotation.selected[s] = true;
+        if (!found)
+            wrn( "Unknown site: %s\n", siteNames[n] );
+    }
+    for (size_t s = 0; s < user->sites_count; ++s) {
+        const MPMarshalledSite *site = &user->sites[s];
+        if (filter && fnmatch( filter, site->name, 0 ) == 0)
+            rotation.selected[s] = true;
+        if (rotation.selected[s] && !(site->type & MPResultTypeClassTemplate)) {
+            wrn( "Not rotating site with a %s password: %s\n", mpw_nameForType( site->type ), site->name );
+            rotation.selected[s] = false;
+        }
+        else if (rotation.selected[s] && site->counter == MPCounterValueTOTP) {
+            wrn( "Not rotating site with a time-based counter: %s\n", site->name );
+            rotation.selected[s] = false;
+        }
+        else if (rotation.selected[s] && site->counter == MPCounterValueLast) {
+            wrn( "Site's counter can't be incremented: %s\n", site->name );
+            rotation.selected[s] = false;
+        }
+        rotateCount += rotation.selected[s];
+    }
+    if (!rotateCount) {
+        inf( "No sites to rotate.\n" );
+        free( rotation.selected );
+        free( rotation.newResults );
+        return EX_DATAERR;
+    }
+
+    // Derive the master keys for the selected sites' algorithm versions up-front.
+    mpw_timing_begin( "master-keys" );
+    MPMasterKeys masterKeys = { .fullName = user->fullName, .masterPassword = user->masterPassword };
+    bool success = true;
+    for (size_t s = 0; success && s < user->sites_count; ++s)
+        if (rotation.selected[s])
+            success &= mpw_masterKeys_get( &masterKeys, user->sites[s].algorithm ) != NULL;
+    mpw_timing_end( "master-keys" );
+    if (!success)
+        ftl( "Couldn't derive master key.\n" );
+
+    // Determine the sites' new passwords.
+    else {
+        rotation.masterKeys = &masterKeys;
+        mpw_timing_begin( "site-results" );
+        mpw_parallel( user->sites_count, mpw_rotate_site, &rotation );
+        mpw_timing_end( "site-results" );
+    }
+    mpw_masterKeys_free( &masterKeys );
+
+    // Apply the rotation only if all of the sites could be rotated.
+    for (size_t s = 0; success && s < user->sites_count; ++s)
+        if (rotation.selected[s] && !rotation.newResults[s]) {
+            ftl( "Couldn't generate site result: %s\n", user->sites[s].name );
+            success = false;
+        }
+    if (success) {
+        fprintf( stdout, "%-32s %-9s %-9s %s\n", "site", "type", "counter", "new password" );
+        for (size_t s = 0; s < user->sites_count; ++s) {
+            MPMarshalledSite *site = &user->sites[s];
+            if (!rotation.selected[s])
+                continue;
+
+            site->counter++;
+            fprintf( stdout, "%-32s %-9s %-9u %s\n", site->name, mpw_nameForType( site->type ), site->counter,
+                    rotation.newResults[s] );
+        }
+        fprintf( stdout, "\n%zu of %zu sites rotated.\n", rotateCount, user->sites_count );
+    }
+
+    for (size_t s = 0; s < user->sites_count; ++s)
+        mpw_free_string( rotation.newResults[s] );
+    free( rotation.selected );
+    free( rotation.newResults );
+
+    return success? 0: EX_SOFTWARE;
+}
+
+typedef enum {
+    MPExportFormatNDJSON,
+    MPExportFormatCSV,
+} MPExportFormat;
+
+typedef struct MPExport {
+    const MPMarshalledUser *user;
+    MPMasterKeys *masterKeys;
+    /** The index of the first site in the current batch. */
+    size_t offset;
+    /** The password and generated login name of each site in the current batch. */
+    const char *results[MPExportBatchSize], *logins[MPExportBatchSize];
+} MPExport;
+
+static void mpw_export_site(void *export_, const size_t b) {
+
+    MPExport *export = export_;
+    const MPMarshalledSite *site = &export->user->sites[export->offset + b];
+    MPMasterKey masterKey = export->masterKeys->keys[site->algorithm];
+
+    if (!(site->type & MPResultTypeClassStateful) || site->content)
+        export->results[b] = mpw_siteResult( masterKey, site->name, site->counter,
+                MPKeyPurposeAuthentication, NULL, site->type, site->content, site->algorithm );
+    if (site->loginGenerated)
+        export->logins[b] = mpw_siteResult( masterKey, site->name, site->counter,
+                MPKeyPurposeIdentification, NULL, MPResultTypeTemplateName, NULL, site->algorithm );
+}
+
+/** Write out the whole buffer to the file descriptor. */
+static bool mpw_write(const int fd, const char *buf, const size_t bufSize) {
+
+    for (size_t written = 0; written < bufSize;) {
+        ssize_t writeSize = write( fd, buf + written, bufSize - written );
+        if (writeSize < 0 && errno != EINTR)
+            return false;
+        if (writeSize > 0)
+            written += (size_t)writeSize;
+    }
+
+    return true;
+}
+
+/** Push a CSV field onto a string, quoted if it contains special characters. */
+static void mpw_string_push_csv(char **const string, const char *field, const bool last) {
+
+    if (!field)
+        field = "";
+
+    if (strpbrk( field, ",\"\r\n" )) {
+        mpw_string_push( string, "\"" );
+        for (const char *quote; (quote = strchr( field, '"' )); field = quote + 1)
+            mpw_string_pushf( string, "%.*s\"\"", (int)(quote - field), field );
+        mpw_string_pushf( string, "%s\"", field );
+    }
+    else
+        mpw_string_push( string, field );
+
+    mpw_string_push( string, last? "\n": "," );
+}
+
+static int mpw_export(const MPMarshalledUser *user, const MPExportFormat format, const int fd) {
+
+    // Derive the master keys for all of the sites' algorithm versions up-front.
+    mpw_timing_begin( "master-keys" );
+    MPMasterKeys masterKeys = { .fullName = user->fullName, .masterPassword = user->masterPassword };
+    bool success = true;
+    for (size_t s = 0; success && s < user->sites_count; ++s)
+        success &= mpw_masterKeys_get( &masterKeys, user->sites[s].algorithm ) != NULL;
+    mpw_timing_end( "master-keys" );
+    if (!success) {
+        ftl( "Couldn't derive master key.\n" );
+        mpw_masterKeys_free( &masterKeys );
+        return EX_SOFTWARE;
+    }
+
+    const char *csvHeader = "name,type,counter,algorithm,login_name,password,url,uses,last_used\n";
+    if (format == MPExportFormatCSV && !mpw_write( fd, csvHeader, strlen( csvHeader ) ))
+        success = false;
+
+    // Determine the sites' results in batches, writing out each batch as it completes.
+    MPExport export = { .user = user, .masterKeys = &masterKeys };
+    for (; success && export.offset < user->sites_count; export.offset += MPExportBatchSize) {
+        size_t batchSize = min( (size_t)MPExportBatchSize, user->sites_count - export.offset );
+        mpw_timing_begin( "site-results" );
+        mpw_parallel( batchSize, mpw_export_site, &export );
+        mpw_timing_end( "site-results" );
+
+        mpw_timing_begin( "records" );
+        char *records = NULL;
+        for (size_t b = 0; b < batchSize; ++b) {
+            const MPMarshalledSite *site = &user->sites[export.offset + b];
+            const char *loginName = site->loginGenerated? export.logins[b]: site->loginName;
+            char lastUsed[21] = "";
+            if (site->lastUsed)
+                strftime( lastUsed, sizeof( lastUsed ), "%FT%TZ", gmtime( &site->lastUsed ) );
+
+            if (format == MPExportFormatNDJSON) {
+                json_object *json_site = json_object_new_object();
+                json_object_object_add( json_site, "name", json_object_new_string( site->name ) );
+                json_object_object_add( json_site, "type", json_object_new_string( mpw_nameForType( site->type )?: "" ) );
+                json_object_object_add( json_site, "counter", json_object_new_int64( site->counter ) );
+                json_object_object_add( json_site, "algorithm", json_object_new_int( (int)site->algorithm ) );
+                if (loginName)
+                    json_object_object_add( json_site, "login_name", json_object_new_string( loginName ) );
+                if (export.results[b])
+                    json_object_object_add( json_site, "password", json_object_new_string( export.results[b] ) );
+                if (site->url)
+                    json_object_object_add( json_site, "url", json_object_new_string( site->url ) );
+                json_object_object_add( json_site, "uses", json_object_new_int( (int)site->uses ) );
+                if (site->lastUsed)
+                    json_object_object_add( json_site, "last_used", json_object_new_string( lastUsed ) );
+                mpw_string_pushf( &records, "%s\n", json_object_to_json_string_ext( json_site, JSON_C_TO_STRING_PLAIN ) );
+                json_object_put( json_site );
+            }
+            else {
+                char number[12];
+                mpw_string_push_csv( &records, site->name, false );
+                mpw_string_push_csv( &records, mpw_nameForType( site->type ), false );
+                snprintf( number, sizeof( number ), "%u", site->counter );
+                mpw_string_push_csv( &records, number, false );
+                snprintf( number, sizeof( number ), "%u", site->algorithm );
+                mpw_string_push_csv( &records, number, false );
+                mpw_string_push_csv( &records, loginName, false );
+                mpw_string_push_csv( &records, export.results[b], false );
+                mpw_string_push_csv( &records, site->url, false );
+                snprintf( number, sizeof( number ), "%u", site->uses );
+                mpw_string_push_csv( &records, number, false );
+                mpw_string_push_csv( &records, lastUsed, true );
+            }
+
+            mpw_free_string( export.results[b] );
+            mpw_free_string( export.logins[b] );
+            export.results[b] = export.logins[b] = NULL;
+        }
+        mpw_timing_end( "records" );
+
+        mpw_timing_begin( "write" );
+        if (records && !mpw_write( fd, records, strlen( records ) ))
+            success = false;
+        mpw_timing_end( "write" );
+        mpw_free_string( records );
+    }
+    mpw_masterKeys_free( &masterKeys );
+
+    if (!success) {
+        ftl( "Couldn't write export: %s\n", strerror( errno ) );
+        return EX_IOERR;
+    }
+
+    return 0;
+}
+
+/** Read the next record of comma-separated values.
+  * @return false if there are no more records.  fields should be freed with mpw_csv_free. */
+static bool mpw_csv_record(FILE *in, char ***fields, size_t *fieldsCount) {
+
+    *fields = NULL;
+    *fieldsCount = 0;
+
+    char *field = NULL;
+    size_t fieldSize = 0, fieldLength = 0;
+    bool quoted = false, done = false, any = false;
+    for (int c; !done;) {
+        c = getc( in );
+        if (c == EOF && !any)
+            return false;
+        any = true;
+
+        if (quoted) {
+            if (c == EOF)
+                quoted = false;
+            else if (c != '"')
+                goto push;
+            else if ((c = getc( in )) == '"')
+                goto push;
+            else {
+                quoted = false;
+                ungetc( c, in );
+            }
+            continue;
+        }
+        if (c == '"' && !fieldLength) {
+            quoted = true;
+            continue;
+        }
+        if (c == '\r')
+            continue;
+        if (c != ',' && c != '\n' && c != EOF)
+            goto push;
+
+        // End of field.
+        if (!mpw_realloc( fields, NULL, sizeof( **fields ) * (*fieldsCount + 1) ))
+            break;
+        (*fields)[(*fieldsCount)++] = field? field: strdup( "" );
+        field = NULL;
+        fieldSize = fieldLength = 0;
+        done = c != ',';
+        continue;
+
+        push:
+        if (fieldLength + 1 >= fieldSize && !mpw_realloc( &field, &fieldSize, fieldSize + 64 ))
+            break;
+        field[fieldLength++] = (char)c;
+        field[fieldLength] = '\0';
+    }
+    mpw_free_string( field );
+
+    return true;
+}
+
+static void mpw_csv_free(char **fields, const size_t fieldsCount) {
+
+    for (size_t f = 0; f < fieldsCount; ++f)
+        mpw_free_string( fields[f] );
+    free( fields );
+}
+
+/** @return The index of the first column whose name is one of the given names, or ERR. */
+static size_t mpw_csv_column(char *const columns[], const size_t columnsCount, const char *names[]) {
+
+    for (; *names; ++names)
+        for (size_t c = 0; c < columnsCount; ++c)
+            if (strcasecmp( columns[c], *names ) == 0)
+                return c;
+
+    return (size_t)ERR;
+}
+
+typedef struct MPImport {
+    MPMarshalledUser *user;
+    MPMasterKey masterKey;
+    /** The index of the first imported site. */
+    size_t offset;
+    /** The clear text password of each imported site. */
+    const char **passwords;
+    size_t passwordsCount, passwordsSize;
+    /** An open-addressed set of site index + 1 values, hashed by their name. */
+    size_t *names;
+    size_t namesSize;
+} MPImport;
+
+/** @return The slot of the site's name in the set of names, which is 0 if the set doesn't have the name yet. */
+static size_t *mpw_import_name(const MPImport *import, const char *siteName) {
+
+    size_t slot = mpw_string_hash( siteName ) & (import->namesSize - 1);
+    for (; import->names[slot]; slot = (slot + 1) & (import->namesSize - 1))
+        if (strcmp( import->user->sites[import->names[slot] - 1].name, siteName ) == 0)
+            break;
+
+    return &import->names[slot];
+}
+
+/** Add the user's latest site to the set of names, growing the set and adding all of the sites when it gets half full. */
+static bool mpw_import_index(MPImport *import) {
+
+    const MPMarshalledUser *user = import->user;
+    size_t from = user->sites_count? user->sites_count - 1: 0;
+    if (user->sites_count * 2 >= import->namesSize) {
+        size_t namesSize = max( import->namesSize, (size_t)64 );
+        while (user->sites_count * 2 >= namesSize)
+            namesSize *= 2;
+        free( import->names );
+        if (!(import->names = calloc( namesSize, sizeof( *import->names ) )))
+            return false;
+        import->namesSize = namesSize;
+        from = 0;
+    }
+
+    for (size_t s = from; s < user->sites_count; ++s) {
+        size_t *slot = user->sites[s].name? mpw_import_name( import, user->sites[s].name ): NULL;
+        if (slot && !*slot)
+            *slot = s + 1;
+    }
+
+    return true;
+}
+
+static void mpw_import_site(void *import_, const size_t i) {
+
+    MPImport *import = import_;
+    MPMarshalledSite *site = &import->user->sites[import->offset + i];
+
+    site->content = mpw_siteState( import->masterKey, site->name, site->counter,
+            MPKeyPurposeAuthentication, NULL, site->type, import->passwords[i], site->algorithm );
+}
+
+static int mpw_import(MPMarshalledUser *user, FILE *in) {
+
+    // Map the columns.
+    char **columns = NULL;
+    size_t columnsCount = 0;
+    if (!mpw_csv_record( in, &columns, &columnsCount )) {
+        ftl( "Missing CSV header line.\n" );
+        return EX_DATAERR;
+    }
+    size_t nameColumn = mpw_csv_column( columns, columnsCount, (const char *[]){ "name", "title", "site", NULL } );
+    size_t urlColumn = mpw_csv_column( columns, columnsCount, (const char *[]){ "url", "login_uri", "website", NULL } );
+    size_t loginColumn = mpw_csv_column( columns, columnsCount, (const char *[]){
+            "username", "login", "login_name", "login_username", "user", NULL } );
+    size_t passwordColumn = mpw_csv_column( columns, columnsCount, (const char *[]){ "password", "login_password", NULL } );
+    mpw_csv_free( columns, columnsCount );
+    if (passwordColumn == (size_t)ERR || (nameColumn == (size_t)ERR && urlColumn == (size_t)ERR)) {
+        ftl( "CSV header line needs a password column and a name or url column.\n" );
+        return EX_DATAERR;
+    }
+
+    // Read the records into new sites.
+    mpw_timing_begin( "parse" );
+    MPImport import = { .user = user, .offset = user->sites_count };
+    if (!mpw_import_index( &import )) {
+        mpw_timing_end( "parse" );
+        ftl( "Couldn't allocate import.\n" );
+        return EX_SOFTWARE;
+    }
+    size_t record = 1, skipped = 0;
+    bool success = true;
+    time_t now = time( NULL );
+    char **fields = NULL;
+    size_t fieldsCount = 0;
+    for (; mpw_csv_record( in, &fields, &fieldsCount ); mpw_csv_free( fields, fieldsCount )) {
+        ++record;
+        if (fieldsCount == 1 && !strlen( fields[0] ))
+            // Empty line.
+            continue;
+
+        const char *name = nameColumn < fieldsCount? fields[nameColumn]: NULL;
+        const char *url = urlColumn < fieldsCount? fields[urlColumn]: NULL;
+        const char *login = loginColumn < fieldsCount? fields[loginColumn]: NULL;
+        const char *password = passwordColumn < fieldsCount? fields[passwordColumn]: NULL;
+        char *siteName = NULL;
+        if (name && strlen( name ))
+            siteName = strdup( name );
+        else if (url && strlen( url )) {
+            // Use the URL's host name.
+            const char *host = strstr( url, "://" );
+            host = host? host + 3: url;
+            siteName = strndup( host, strcspn( host, "/:?#" ) );
+        }
+        if (!siteName || !strlen( siteName ) || !password || !strlen( password )) {
+            wrn( "Skipping record %zu: missing site name or password.\n", record );
+            mpw_free_string( siteName );
+            ++skipped;
+            continue;
+        }
+
+        if (*mpw_import_name( &import, siteName )) {
+            wrn( "Skipping record %zu: site already exists: %s\n", record, siteName );
+            mpw_free_string( siteName );
+            ++skipped;
+            continue;
+        }
+
+        MPMarshalledSite *site = mpw_marshall_site( user, siteName, MPResultTypeStatefulPersonal, MPCounterValueDefault, user->algorithm );
+        mpw_free_string( siteName );
+        if (site && sizeof( *import.passwords ) * import.passwordsCount >= import.passwordsSize &&
+            !mpw_realloc( &import.passwords, &import.passwordsSize, max( import.passwordsSize, sizeof( *import.passwords ) * 64 ) ))
+            site = NULL;
+        if (!site || !mpw_import_index( &import )) {
+            ftl( "Couldn't allocate a new site.\n" );
+            success = false;
+            break;
+        }
+        site->loginName = login && strlen( login )? strdup( login ): NULL;
+        site->url = url && strlen( url )? strdup( url ): NULL;
+        site->lastUsed = now;
+        import.passwords[import.passwordsCount++] = strdup( password );
+    }
+    mpw_csv_free( fields, fieldsCount );
+    free( import.names );
+    mpw_timing_end( "parse" );
+    size_t importCount = success? user->sites_count - import.offset: 0;
+    if (success && ferror( in )) {
+        ftl( "Couldn't read CSV records: %s\n", strerror( errno ) );
+        success = false;
+    }
+
+    // Encrypt the imported passwords.
+    else if (importCount) {
+        mpw_timing_begin( "master-key" );
+        import.masterKey = mpw_masterKey( user->fullName, user->masterPassword, user->algorithm );
+        mpw_timing_end( "master-key" );
+        if (!import.masterKey) {
+            ftl( "Couldn't derive master key.\n" );
+            success = false;
+        }
+        else {
+            mpw_timing_begin( "site-states" );
+            mpw_parallel( importCount, mpw_import_site, &import );
+            mpw_timing_end( "site-states" );
+            mpw_free( import.masterKey, MPMasterKeySize );
+        }
+
+        for (size_t i = 0; success && i < importCount; ++i)
+            if (!user->sites[import.offset + i].content) {
+                ftl( "Couldn't encrypt site content: %s\n", user->sites[import.offset + i].name );
+                success = false;
+            }
+    }
+    for (size_t i = 0; i < import.passwordsCount; ++i)
+        mpw_free_string( import.passwords[i] );
+    free( import.passwords );
+
+    if (!success)
+        return EX_DATAERR;
+
+    inf( "Imported %zu sites, skipped %zu records.\n", importCount, skipped );
+    return 0;
+}
+
 int main(int argc, char *const argv[]) {
 
     // Master Password defaults.
@@ -161,6 +1250,13 @@ int main(int argc, char *const argv[]) {
     MPAlgorithmVersion algorithmVersion = MPAlgorithmVersionCurrent;
     MPMarshallFormat sitesFormat = MPMarshallFormatDefault;
     bool allowPasswordUpdate = false, sitesFormatFixed = false, sitesRedacted = true;
+    bool audit = false, auditJSON = false, upgrade = false, rotate = false;
+    const char *rotateFilter = NULL;
+    bool export = false;
+    MPExportFormat exportFormat = MPExportFormatNDJSON;
+    const char *importPath = NULL;
+    MPAlgorithmVersion upgradeVersion = MPAlgorithmVersionCurrent;
+    unsigned int auditStaleDays = 365;
 
     // Read the environment.
     const char *fullNameArg = NULL, *masterPasswordArg = NULL, *siteNameArg = NULL;
@@ -171,7 +1267,18 @@ int main(int argc, char *const argv[]) {
     sitesFormatArg = mpw_getenv( MP_ENV_format );
 
     // Read the command-line options.
-    for (int opt; (opt = getopt( argc, argv, "u:U:M:t:P:c:a:s:p:C:f:F:R:vqh" )) != EOF;)
+    const struct option longOptions[] = {
+            { "timings", optional_argument, NULL, MP_OPT_timings },
+            { "audit", optional_argument, NULL, MP_OPT_audit },
+            { "stale", required_argument, NULL, MP_OPT_stale },
+            { "upgrade", optional_argument, NULL, MP_OPT_upgrade },
+            { "rotate", no_argument, NULL, MP_OPT_rotate },
+            { "filter", required_argument, NULL, MP_OPT_filter },
+            { "export", required_argument, NULL, MP_OPT_export },
+            { "import", required_argument, NULL, MP_OPT_import },
+            { NULL, 0, NULL, 0 },
+    };
+    for (int opt; (opt = getopt_long( argc, argv, "u:U:M:t:P:c:a:s:p:C:f:F:R:vqh", longOptions, NULL )) != EOF;)
         switch (opt) {
             case 'u':
                 fullNameArg = optarg && strlen( optarg )? strdup( optarg ): NULL;
@@ -188,6 +1295,7 @@ int main(int argc, char *const argv[]) {
             case 't':
                 resultTypeArg = optarg && strlen( optarg )? strdup( optarg ): NULL;
                 break;
+            case 's':
             case 'P':
                 resultParamArg = optarg && strlen( optarg )? strdup( optarg ): NULL;
                 break;
@@ -223,6 +1331,64 @@ int main(int argc, char *const argv[]) {
             case 'h':
                 usage();
                 break;
+            case MP_OPT_timings:
+                if (optarg && strcmp( optarg, "json" ) != 0) {
+                    ftl( "Unknown timings format: %s\n", optarg );
+                    return EX_USAGE;
+                }
+                mpw_timingsJSON = optarg != NULL;
+                mpw_timings_start();
+                atexit( mpw_timings_atexit );
+                break;
+            case MP_OPT_audit:
+                if (optarg && strcmp( optarg, "json" ) != 0) {
+                    ftl( "Unknown audit format: %s\n", optarg );
+                    return EX_USAGE;
+                }
+                audit = true;
+                auditJSON = optarg != NULL;
+                break;
+            case MP_OPT_stale: {
+                long long int staleDaysInt = atoll( optarg );
+                if (staleDaysInt < 0 || staleDaysInt > UINT16_MAX) {
+                    ftl( "Invalid amount of days: %s\n", optarg );
+                    return EX_USAGE;
+                }
+                auditStaleDays = (unsigned int)staleDaysInt;
+                break;
+            }
+            case MP_OPT_upgrade: {
+                if (optarg) {
+                    int upgradeVersionInt = atoi( optarg );
+                    if (upgradeVersionInt < MPAlgorithmVersionFirst || upgradeVersionInt > MPAlgorithmVersionLast) {
+                        ftl( "Invalid algorithm version: %s\n", optarg );
+                        return EX_USAGE;
+                    }
+                    upgradeVersion = (MPAlgorithmVersion)upgradeVersionInt;
+                }
+                upgrade = true;
+                break;
+            }
+            case MP_OPT_rotate:
+                rotate = true;
+                break;
+            case MP_OPT_filter:
+                rotateFilter = optarg;
+                break;
+            case MP_OPT_export:
+                if (strcmp( optarg, "ndjson" ) == 0)
+                    exportFormat = MPExportFormatNDJSON;
+                else if (strcmp( optarg, "csv" ) == 0)
+                    exportFormat = MPExportFormatCSV;
+                else {
+                    ftl( "Unknown export format: %s\n", optarg );
+                    return EX_USAGE;
+                }
+                export = true;
+                break;
+            case MP_OPT_import:
+                importPath = optarg;
+                break;
             case '?':
                 switch (optopt) {
                     case 'u':
@@ -246,19 +1412,23 @@ int main(int argc, char *const argv[]) {
         siteNameArg = strdup( argv[optind] );
 
     // Determine fullName, siteName & masterPassword.
+    mpw_timing_begin( "prompt" );
     if (!(fullNameArg && (fullName = strdup( fullNameArg ))) &&
         !(fullName = mpw_getline( "Your full name:" ))) {
+        mpw_timing_end( "prompt" );
         ftl( "Missing full name.\n" );
         return EX_DATAERR;
     }
-    if (!(siteNameArg && (siteName = strdup( siteNameArg ))) &&
+    if (!audit && !upgrade && !rotate && !export && !importPath && !(siteNameArg && (siteName = strdup( siteNameArg ))) &&
         !(siteName = mpw_getline( "Site name:" ))) {
+        mpw_timing_end( "prompt" );
         ftl( "Missing site name.\n" );
         return EX_DATAERR;
     }
     if (!(masterPasswordArg && (masterPassword = strdup( masterPasswordArg ))))
         while (!masterPassword || !strlen( masterPassword ))
             masterPassword = mpw_getpass( "Your master password: " );
+    mpw_timing_end( "prompt" );
     if (sitesFormatArg) {
         sitesFormat = mpw_formatWithName( sitesFormatArg );
         if (ERR == (int)sitesFormat) {
@@ -268,6 +1438,7 @@ int main(int argc, char *const argv[]) {
     }
 
     // Find the user's sites file.
+    mpw_timing_begin( "read" );
     FILE *sitesFile = NULL;
     char *sitesPath = mpw_path( fullName, mpw_marshall_format_extension( sitesFormat ) );
     if (!sitesPath || !(sitesFile = fopen( sitesPath, "r" ))) {
@@ -288,6 +1459,7 @@ int main(int argc, char *const argv[]) {
     MPMarshalledUser *user = NULL;
     MPMarshalledSite *site = NULL;
     if (!sitesFile) {
+        mpw_timing_end( "read" );
         free( sitesPath );
         sitesPath = NULL;
     }
@@ -298,15 +1470,22 @@ int main(int argc, char *const argv[]) {
         while ((mpw_realloc( &sitesInputData, &bufSize, readAmount )) &&
                (bufOffset += (readSize = fread( sitesInputData + bufOffset, 1, readAmount, sitesFile ))) &&
                (readSize == readAmount));
+        if (sitesInputData && bufOffset < bufSize)
+            sitesInputData[bufOffset] = '\0';
         if (ferror( sitesFile ))
             wrn( "Error while reading configuration file:\n  %s: %d\n", sitesPath, ferror( sitesFile ) );
         fclose( sitesFile );
+        mpw_timing_end( "read" );
 
         // Parse file.
+        mpw_timing_begin( "marshall-read-info" );
         MPMarshallInfo *sitesInputInfo = mpw_marshall_read_info( sitesInputData );
+        mpw_timing_end( "marshall-read-info" );
         MPMarshallFormat sitesInputFormat = sitesFormatArg? sitesFormat: sitesInputInfo->format;
         MPMarshallError marshallError = { .type = MPMarshallSuccess };
+        mpw_timing_begin( "marshall-read" );
         user = mpw_marshall_read( sitesInputData, sitesInputFormat, masterPassword, &marshallError );
+        mpw_timing_end( "marshall-read" );
         if (marshallError.type == MPMarshallErrorMasterPassword) {
             // Incorrect master password.
             if (!allowPasswordUpdate) {
@@ -318,21 +1497,38 @@ int main(int argc, char *const argv[]) {
             }
 
             // Update user's master password.
+            const char *importMasterPassword = NULL;
             while (marshallError.type == MPMarshallErrorMasterPassword) {
                 inf( "Given master password does not match configuration.\n" );
                 inf( "To update the configuration with this new master password, first confirm the old master password.\n" );
 
-                const char *importMasterPassword = NULL;
+                mpw_free_string( importMasterPassword );
+                importMasterPassword = NULL;
+                mpw_timing_begin( "prompt" );
                 while (!importMasterPassword || !strlen( importMasterPassword ))
                     importMasterPassword = mpw_getpass( "Old master password: " );
+                mpw_timing_end( "prompt" );
 
                 mpw_marshal_free( user );
+                mpw_timing_begin( "marshall-read" );
                 user = mpw_marshall_read( sitesInputData, sitesInputFormat, importMasterPassword, &marshallError );
+                mpw_timing_end( "marshall-read" );
             }
             if (user) {
-                mpw_free_string( user->masterPassword );
-                user->masterPassword = strdup( masterPassword );
+                // Saved site content is encrypted with the old master password.
+                mpw_timing_begin( "reencrypt" );
+                if (!mpw_reencrypt( user, importMasterPassword, masterPassword )) {
+                    mpw_timing_end( "reencrypt" );
+                    ftl( "Couldn't update configuration to the new master password:\n  %s\n", sitesPath );
+                    mpw_free_string( importMasterPassword );
+                    mpw_marshal_free( user );
+                    mpw_free( sitesInputData, bufSize );
+                    free( sitesPath );
+                    return EX_SOFTWARE;
+                }
+                mpw_timing_end( "reencrypt" );
             }
+            mpw_free_string( importMasterPassword );
         }
         mpw_free( sitesInputData, bufSize );
         if (!user || marshallError.type != MPMarshallSuccess) {
@@ -358,7 +1554,7 @@ int main(int argc, char *const argv[]) {
 
             for (size_t s = 0; s < user->sites_count; ++s) {
                 site = &user->sites[s];
-                if (strcmp( siteName, site->name ) != 0) {
+                if (!siteName || strcmp( siteName, site->name ) != 0) {
                     site = NULL;
                     continue;
                 }
@@ -372,6 +1568,109 @@ int main(int argc, char *const argv[]) {
         }
     }
 
+    // Audit the user's sites.
+    if (audit) {
+        if (!user) {
+            ftl( "Couldn't find a sites configuration to audit for: %s\n", fullName );
+            return EX_DATAERR;
+        }
+
+        mpw_timing_begin( "audit" );
+        int status = mpw_audit( user, auditJSON, auditStaleDays );
+        mpw_timing_end( "audit" );
+        mpw_marshal_free( user );
+        return status;
+    }
+
+    // Upgrade the user's sites.
+    if (upgrade) {
+        if (!user) {
+            ftl( "Couldn't find a sites configuration to upgrade for: %s\n", fullName );
+            return EX_DATAERR;
+        }
+
+        mpw_timing_begin( "upgrade" );
+        int status = mpw_upgrade( user, upgradeVersion );
+        mpw_timing_end( "upgrade" );
+        if (status == 0) {
+            if (sitesRedactedArg)
+                user->redacted = strcmp( sitesRedactedArg, "1" ) == 0;
+            if (!mpw_save( user, sitesFormatFixed? sitesFormat: MPMarshallFormatDefault ))
+                status = EX_CANTCREAT;
+        }
+        mpw_marshal_free( user );
+        return status;
+    }
+
+    // Rotate the passwords of the user's selected sites.
+    if (rotate) {
+        if (!user) {
+            ftl( "Couldn't find a sites configuration to rotate for: %s\n", fullName );
+            return EX_DATAERR;
+        }
+        if (!rotateFilter && optind >= argc) {
+            ftl( "Missing site names or filter for the sites to rotate.\n" );
+            mpw_marshal_free( user );
+            return EX_USAGE;
+        }
+
+        mpw_timing_begin( "rotate" );
+        int status = mpw_rotate( user, rotateFilter, &argv[optind], (size_t)(argc - optind) );
+        mpw_timing_end( "rotate" );
+        if (status == 0) {
+            user->lastUsed = time( NULL );
+            if (sitesRedactedArg)
+                user->redacted = strcmp( sitesRedactedArg, "1" ) == 0;
+            if (!mpw_save( user, sitesFormatFixed? sitesFormat: MPMarshallFormatDefault ))
+                status = EX_CANTCREAT;
+        }
+        mpw_marshal_free( user );
+        return status;
+    }
+
+    // Export the user's sites.
+    if (export) {
+        if (!user) {
+            ftl( "Couldn't find a sites configuration to export for: %s\n", fullName );
+            return EX_DATAERR;
+        }
+
+        mpw_timing_begin( "export" );
+        int status = mpw_export( user, exportFormat, STDOUT_FILENO );
+        mpw_timing_end( "export" );
+        mpw_marshal_free( user );
+        return status;
+    }
+
+    // Import sites into the user's sites.
+    if (importPath) {
+        FILE *importFile = strcmp( importPath, "-" ) == 0? stdin: fopen( importPath, "r" );
+        if (!importFile) {
+            ftl( "Couldn't open import file:\n  %s: %s\n", importPath, strerror( errno ) );
+            mpw_marshal_free( user );
+            return EX_NOINPUT;
+        }
+        if (!user && !(user = mpw_marshall_user( fullName, masterPassword, algorithmVersion ))) {
+            ftl( "Couldn't allocate a new user.\n" );
+            return EX_SOFTWARE;
+        }
+
+        mpw_timing_begin( "import" );
+        int status = mpw_import( user, importFile );
+        mpw_timing_end( "import" );
+        if (importFile != stdin)
+            fclose( importFile );
+        if (status == 0) {
+            user->lastUsed = time( NULL );
+            if (sitesRedactedArg)
+                user->redacted = strcmp( sitesRedactedArg, "1" ) == 0;
+            if (!mpw_save( user, MPMarshallFormatJSON ))
+                status = EX_CANTCREAT;
+        }
+        mpw_marshal_free( user );
+        return status;
+    }
+
     // Parse default/config-overriding command-line parameters.
     if (sitesRedactedArg)
         sitesRedacted = strcmp( sitesRedactedArg, "1" ) == 0;
@@ -441,7 +1740,9 @@ int main(int argc, char *const argv[]) {
     mpw_free_string( sitesRedactedArg );
 
     // Operation summary.
+    mpw_timing_begin( "identicon" );
     const char *identicon = mpw_identicon( fullName, masterPassword );
+    mpw_timing_end( "identicon" );
     if (!identicon)
         wrn( "Couldn't determine identicon.\n" );
     dbg( "-----------------\n" );
@@ -464,8 +1765,10 @@ int main(int argc, char *const argv[]) {
         free( sitesPath );
 
     // Determine master key.
+    mpw_timing_begin( "master-key" );
     MPMasterKey masterKey = mpw_masterKey(
             fullName, masterPassword, algorithmVersion );
+    mpw_timing_end( "master-key" );
     mpw_free_string( masterPassword );
     mpw_free_string( fullName );
     if (!masterKey) {
@@ -474,13 +1777,17 @@ int main(int argc, char *const argv[]) {
     }
 
     // Output the result.
+    const char *sitePolicy = NULL;
     if (keyPurpose == MPKeyPurposeIdentification && site && !site->loginGenerated && site->loginName)
         fprintf( stdout, "%s\n", site->loginName );
 
     else if (resultParam && site && resultType & MPResultTypeClassStateful) {
         mpw_free_string( site->content );
-        if (!(site->content = mpw_siteState( masterKey, siteName, siteCounter,
-                keyPurpose, keyContext, resultType, resultParam, algorithmVersion ))) {
+        mpw_timing_begin( "site-state" );
+        site->content = mpw_siteState( masterKey, siteName, siteCounter,
+                keyPurpose, keyContext, resultType, resultParam, algorithmVersion );
+        mpw_timing_end( "site-state" );
+        if (!site->content) {
             ftl( "Couldn't encrypt site content.\n" );
             mpw_free( masterKey, MPMasterKeySize );
             return EX_SOFTWARE;
@@ -489,10 +1796,12 @@ int main(int argc, char *const argv[]) {
         inf( "saved.\n" );
     }
     else {
-        if (!resultParam && site && site->content && resultType & MPResultTypeClassStateful)
+        if (!resultParam && site && site->content && (resultType & MPResultTypeClassStateful || resultType == MPResultTypeTemplateCustom))
             resultParam = strdup( site->content );
+        mpw_timing_begin( "site-result" );
         const char *siteResult = mpw_siteResult( masterKey, siteName, siteCounter,
                 keyPurpose, keyContext, resultType, resultParam, algorithmVersion );
+        mpw_timing_end( "site-result" );
         if (!siteResult) {
             ftl( "Couldn't generate site result.\n" );
             mpw_free( masterKey, MPMasterKeySize );
@@ -501,6 +1810,8 @@ int main(int argc, char *const argv[]) {
 
         fprintf( stdout, "%s\n", siteResult );
         mpw_free_string( siteResult );
+        if (resultType == MPResultTypeTemplateCustom)
+            sitePolicy = strdup( resultParam );
     }
     if (site && site->url)
         inf( "See: %s\n", site->url );
@@ -520,6 +1831,11 @@ int main(int argc, char *const argv[]) {
                 site->counter = siteCounter;
                 site->algorithm = algorithmVersion;
             }
+            if (site && sitePolicy) {
+                mpw_free_string( site->content );
+                site->content = sitePolicy;
+                sitePolicy = NULL;
+            }
         }
         else if (keyPurpose == MPKeyPurposeIdentification && site) {
             // TODO: We're not persisting the resultType of the generated login
@@ -549,26 +1865,10 @@ int main(int argc, char *const argv[]) {
             sitesFormat = MPMarshallFormatDefault;
         user->redacted = sitesRedacted;
 
-        sitesPath = mpw_path( user->fullName, mpw_marshall_format_extension( sitesFormat ) );
-        dbg( "Updating: %s (%s)\n", sitesPath, mpw_nameForFormat( sitesFormat ) );
-        if (!sitesPath || !(sitesFile = fopen( sitesPath, "w" )))
-            wrn( "Couldn't create updated configuration file:\n  %s: %s\n", sitesPath, strerror( errno ) );
-
-        else {
-            char *buf = NULL;
-            MPMarshallError marshallError = { .type = MPMarshallSuccess };
-            if (!mpw_marshall_write( &buf, sitesFormat, user, &marshallError ) || marshallError.type != MPMarshallSuccess)
-                wrn( "Couldn't encode updated configuration file:\n  %s: %s\n", sitesPath, marshallError.description );
-
-            else if (fwrite( buf, sizeof( char ), strlen( buf ), sitesFile ) != strlen( buf ))
-                wrn( "Error while writing updated configuration file:\n  %s: %d\n", sitesPath, ferror( sitesFile ) );
-
-            mpw_free_string( buf );
-            fclose( sitesFile );
-        }
-        free( sitesPath );
+        mpw_save( user, sitesFormat );
         mpw_marshal_free( user );
     }
+    mpw_free_string( sitePolicy );
 
     return 0;
 }
@@ -10,68 +10,365 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <libxml/xmlreader.h>
+#if MPW_JSON
+#include <json-c/json.h>
+#endif
+
 #include "mpw-util.h"
 
 #include "mpw-tests-util.h"
 
-static xmlChar const *mpw_xmlPath(xmlNodePtr context) {
+/** The values a test case can declare, either as attributes or as child elements of its case element. */
+typedef enum {
+    MPTestFieldID, MPTestFieldParent, MPTestFieldAlgorithm, MPTestFieldFullName, MPTestFieldMasterPassword,
+    MPTestFieldKeyID, MPTestFieldSiteName, MPTestFieldSiteCounter, MPTestFieldResultType, MPTestFieldResultParam,
+    MPTestFieldKeyPurpose, MPTestFieldKeyContext, MPTestFieldResult, MPTestFieldsCount,
+} MPTestField;
+static const char *mpw_tests_fields[MPTestFieldsCount] = {
+        [MPTestFieldID] = "id", [MPTestFieldParent] = "parent", [MPTestFieldAlgorithm] = "algorithm",
+        [MPTestFieldFullName] = "fullName", [MPTestFieldMasterPassword] = "masterPassword",
+        [MPTestFieldKeyID] = "keyID", [MPTestFieldSiteName] = "siteName", [MPTestFieldSiteCounter] = "siteCounter",
+        [MPTestFieldResultType] = "resultType", [MPTestFieldResultParam] = "resultParam",
+        [MPTestFieldKeyPurpose] = "keyPurpose", [MPTestFieldKeyContext] = "keyContext", [MPTestFieldResult] = "result",
+};
+
+typedef struct MPTestCaseFields {
+    char *values[MPTestFieldsCount];
+    /** The case's inherited values are not resolved yet (0), are being resolved (1) or have been resolved (2). */
+    int resolved;
+} MPTestCaseFields;
+
+/** A table of the cases' indexes, hashed by their id. */
+typedef struct MPTestCaseIndex {
+    size_t *slots;
+    size_t capacity;
+} MPTestCaseIndex;
+
+static size_t mpw_tests_hash(const char *id) {
+
+    // FNV-1a
+    size_t hash = 2166136261u;
+    for (; *id; ++id)
+        hash = (hash ^ (uint8_t)*id) * 16777619u;
+
+    return hash;
+}
 
-    if (context->parent) {
-        char *string = calloc( 256, 1 );
-        snprintf( string, 256, "%s/%s", mpw_xmlPath( context->parent ), context->name );
-        return BAD_CAST string;
+static void mpw_tests_set(MPTestCaseFields *fields, const xmlChar *name, const xmlChar *value) {
+
+    for (MPTestField f = MPTestFieldID; f < MPTestFieldsCount; ++f)
+        if (xmlStrcmp( name, BAD_CAST mpw_tests_fields[f] ) == 0) {
+            // A case's first declaration of a value wins, attributes are declared before elements.
+            if (!fields->values[f])
+                fields->values[f] = strdup( value? (const char *)value: "" );
+            return;
+        }
+}
+
+static MPTestCaseFields *mpw_tests_lookup(
+        MPTestCaseFields *cases, const MPTestCaseIndex *index, const char *id) {
+
+    for (size_t s = mpw_tests_hash( id ) & (index->capacity - 1);; s = (s + 1) & (index->capacity - 1)) {
+        if (index->slots[s] == (size_t)ERR)
+            return NULL;
+        if (strcmp( cases[index->slots[s]].values[MPTestFieldID], id ) == 0)
+            return &cases[index->slots[s]];
     }
+}
 
-    return context->name? context->name: (xmlChar const *)"";
+static void mpw_tests_resolve(
+        MPTestCaseFields *cases, const MPTestCaseIndex *index, MPTestCaseFields *testCase) {
+
+    if (testCase->resolved)
+        return;
+
+    testCase->resolved = 1;
+    const char *parentId = testCase->values[MPTestFieldParent];
+    MPTestCaseFields *parent = parentId? mpw_tests_lookup( cases, index, parentId ): NULL;
+    if (parentId && !parent)
+        err( "Missing parent: %s, for case: %s\n", parentId, testCase->values[MPTestFieldID] );
+    else if (parent && parent->resolved == 1)
+        err( "Cyclic parent: %s, for case: %s\n", parentId, testCase->values[MPTestFieldID] );
+    else if (parent) {
+        mpw_tests_resolve( cases, index, parent );
+        for (MPTestField f = MPTestFieldParent + 1; f < MPTestFieldsCount; ++f)
+            if (!testCase->values[f] && parent->values[f])
+                testCase->values[f] = strdup( parent->values[f] );
+    }
+    testCase->resolved = 2;
 }
 
-xmlNodePtr mpw_xmlTestCaseNode(xmlNodePtr testCaseNode, const char *nodeName) {
+MPTestCase *mpw_tests_read(
+        const char *path, size_t *count) {
 
-    // Try to find an attribute node.
-    for (xmlAttrPtr child = testCaseNode->properties; child; child = child->next)
-        if (xmlStrcmp( child->name, BAD_CAST nodeName ) == 0)
-            return (xmlNodePtr)child;
+    *count = 0;
+    xmlTextReaderPtr reader = xmlReaderForFile( path, NULL, 0 );
+    if (!reader)
+        return NULL;
 
-    // Try to find an element node.
-    for (xmlNodePtr child = testCaseNode->children; child; child = child->next)
-        if (xmlStrcmp( child->name, BAD_CAST nodeName ) == 0)
-            return child;
+    // Stream the case elements of the document's root element and collect their values.
+    MPTestCaseFields *cases = NULL, *testCase = NULL;
+    size_t capacity = 0;
+    int status;
+    while ((status = xmlTextReaderRead( reader )) == 1) {
+        if (xmlTextReaderNodeType( reader ) != XML_READER_TYPE_ELEMENT)
+            continue;
 
-    // Missing content, try to find parent case.
-    if (strcmp(nodeName, "parent") == 0)
-        // Was just searching for testCaseNode's parent, none found.
+        int depth = xmlTextReaderDepth( reader );
+        const xmlChar *name = xmlTextReaderConstName( reader );
+        if (depth == 1) {
+            testCase = NULL;
+            if (xmlStrcmp( name, BAD_CAST "case" ) != 0)
+                continue;
+            if (*count == capacity) {
+                // Grow geometrically to keep reading large suites linear.
+                capacity = max( capacity * 2, (size_t)64 );
+                if (!mpw_realloc( &cases, NULL, sizeof( *cases ) * capacity )) {
+                    status = -1;
+                    break;
+                }
+            }
+
+            testCase = &cases[(*count)++];
+            *testCase = (MPTestCaseFields){ .resolved = 0 };
+            while (xmlTextReaderMoveToNextAttribute( reader ) == 1)
+                mpw_tests_set( testCase, xmlTextReaderConstName( reader ), xmlTextReaderConstValue( reader ) );
+            xmlTextReaderMoveToElement( reader );
+        }
+        else if (depth == 2 && testCase) {
+            xmlChar *value = xmlTextReaderReadString( reader );
+            mpw_tests_set( testCase, name, value );
+            xmlFree( value );
+        }
+    }
+    xmlFreeTextReader( reader );
+
+    // Index the cases by their id, the first of cases with the same id wins.
+    MPTestCaseIndex index = { .capacity = 16 };
+    while (index.capacity < *count * 2)
+        index.capacity *= 2;
+    if (status == 0 && (index.slots = malloc( index.capacity * sizeof( *index.slots ) ))) {
+        memset( index.slots, 0xFF, index.capacity * sizeof( *index.slots ) );
+        for (size_t c = 0; c < *count; ++c) {
+            const char *id = cases[c].values[MPTestFieldID];
+            if (!id || mpw_tests_lookup( cases, &index, id ))
+                continue;
+
+            size_t s = mpw_tests_hash( id ) & (index.capacity - 1);
+            while (index.slots[s] != (size_t)ERR)
+                s = (s + 1) & (index.capacity - 1);
+            index.slots[s] = c;
+        }
+    }
+    MPTestCase *testCases = index.slots? calloc( max( *count, (size_t)1 ), sizeof( *testCases ) ): NULL;
+    if (!testCases) {
+        err( "Couldn't read test cases: %s\n", path );
+        free( index.slots );
+        for (size_t c = 0; c < *count; ++c)
+            for (MPTestField f = MPTestFieldID; f < MPTestFieldsCount; ++f)
+                free( cases[c].values[f] );
+        free( cases );
+        *count = 0;
         return NULL;
-    xmlChar *parentId = mpw_xmlTestCaseString( testCaseNode, "parent" );
-    if (!parentId)
-        // testCaseNode has no parent, give up.
+    }
+
+    // Resolve the values each case inherits and convert the cases.
+    for (size_t c = 0; c < *count; ++c)
+        mpw_tests_resolve( cases, &index, &cases[c] );
+    for (size_t c = 0; c < *count; ++c) {
+        char **values = cases[c].values;
+        testCases[c] = (MPTestCase){
+                .id = values[MPTestFieldID],
+                .parent = values[MPTestFieldParent],
+                .algorithm = (MPAlgorithmVersion)(values[MPTestFieldAlgorithm]? atol( values[MPTestFieldAlgorithm] ): 0),
+                .fullName = values[MPTestFieldFullName],
+                .masterPassword = values[MPTestFieldMasterPassword],
+                .keyID = values[MPTestFieldKeyID],
+                .siteName = values[MPTestFieldSiteName],
+                .siteCounter = (MPCounterValue)(values[MPTestFieldSiteCounter]? atol( values[MPTestFieldSiteCounter] ): 0),
+                .resultType = values[MPTestFieldResultType],
+                .resultParam = values[MPTestFieldResultParam],
+                .keyPurpose = values[MPTestFieldKeyPurpose],
+                .keyContext = values[MPTestFieldKeyContext],
+                .result = values[MPTestFieldResult],
+        };
+        free( values[MPTestFieldAlgorithm] );
+        free( values[MPTestFieldSiteCounter] );
+    }
+    free( index.slots );
+    free( cases );
+
+    return testCases;
+}
+
+void mpw_tests_free(
+        MPTestCase *cases, const size_t count) {
+
+    for (size_t c = 0; cases && c < count; ++c) {
+        free( cases[c].id );
+        free( cases[c].parent );
+        free( cases[c].fullName );
+        free( cases[c].masterPassword );
+        free( cases[c].keyID );
+        free( cases[c].siteName );
+        free( cases[c].resultType );
+        free( cases[c].resultParam );
+        free( cases[c].keyPurpose );
+        free( cases[c].keyContext );
+        free( cases[c].result );
+    }
+    free( cases );
+}
+
+#if MPW_JSON
+static char *mpw_tests_json_string(json_object *obj, const char *key) {
+
+    json_object *value = NULL;
+    if (!json_object_object_get_ex( obj, key, &value ) || !value || json_object_is_type( value, json_type_null ))
         return NULL;
 
-    for (xmlNodePtr otherTestCaseNode = testCaseNode->parent->children; otherTestCaseNode; otherTestCaseNode = otherTestCaseNode->next) {
-        xmlChar *id = mpw_xmlTestCaseString( otherTestCaseNode, "id" );
-        int foundParent = id && xmlStrcmp( id, parentId ) == 0;
-        xmlFree( id );
+    return strdup( json_object_get_string( value ) );
+}
+#endif
+
+bool mpw_tests_read_ndjson(
+        FILE *in, MPTestCase *cases, const size_t capacity, size_t *count) {
+
+    *count = 0;
+#if MPW_JSON
+    char *line = NULL;
+    size_t lineSize = 0;
+    bool success = true;
+    while (*count < capacity && getline( &line, &lineSize, in ) > 0) {
+        if (strspn( line, " \t\r\n" ) == strlen( line ))
+            continue;
 
-        if (foundParent) {
-            xmlFree( parentId );
-            return mpw_xmlTestCaseNode( otherTestCaseNode, nodeName );
+        json_object *json = json_tokener_parse( line );
+        if (!json || !json_object_is_type( json, json_type_object )) {
+            err( "Invalid test case: %s", line );
+            json_object_put( json );
+            success = false;
+            break;
         }
+
+        char *algorithm = mpw_tests_json_string( json, "algorithm" ), *siteCounter = mpw_tests_json_string( json, "siteCounter" );
+        cases[(*count)++] = (MPTestCase){
+                .id = mpw_tests_json_string( json, "id" ),
+                .parent = mpw_tests_json_string( json, "parent" ),
+                .algorithm = (MPAlgorithmVersion)(algorithm? atol( algorithm ): 0),
+                .fullName = mpw_tests_json_string( json, "fullName" ),
+                .masterPassword = mpw_tests_json_string( json, "masterPassword" ),
+                .keyID = mpw_tests_json_string( json, "keyID" ),
+                .siteName = mpw_tests_json_string( json, "siteName" ),
+                .siteCounter = (MPCounterValue)(siteCounter? strtoul( siteCounter, NULL, 10 ): 0),
+                .resultType = mpw_tests_json_string( json, "resultType" ),
+                .resultParam = mpw_tests_json_string( json, "resultParam" ),
+                .keyPurpose = mpw_tests_json_string( json, "keyPurpose" ),
+                .keyContext = mpw_tests_json_string( json, "keyContext" ),
+                .result = mpw_tests_json_string( json, "result" ),
+        };
+        free( algorithm );
+        free( siteCounter );
+        json_object_put( json );
     }
+    free( line );
+
+    return success;
+#else
+    err( "Reading NDJSON test cases requires JSON support.\n" );
+    return false;
+#endif
+}
+
+/** Write a string escaped for the format, or a null value if the string is NULL. */
+static void mpw_tests_write_string(FILE *out, const MPTestFormat format, const char *string) {
 
-    err( "Missing parent: %s, for case: %s\n", parentId, mpw_xmlTestCaseString( testCaseNode, "id" ) );
-    return NULL;
+    if (format == MPTestFormatNDJSON && !string) {
+        fputs( "null", out );
+        return;
+    }
+
+    if (format == MPTestFormatNDJSON)
+        fputc( '"', out );
+    for (const char *c = string; c && *c; ++c)
+        switch (format) {
+            case MPTestFormatXML:
+                if (*c == '&')
+                    fputs( "&amp;", out );
+                else if (*c == '<')
+                    fputs( "&lt;", out );
+                else if (*c == '>')
+                    fputs( "&gt;", out );
+                else if (*c == '"')
+                    fputs( "&quot;", out );
+                else
+                    fputc( *c, out );
+                break;
+            case MPTestFormatNDJSON:
+                if (*c == '"' || *c == '\\')
+                    fprintf( out, "\\%c", *c );
+                else if ((unsigned char)*c < 0x20)
+                    fprintf( out, "\\u%04x", (unsigned char)*c );
+                else
+                    fputc( *c, out );
+                break;
+        }
+    if (format == MPTestFormatNDJSON)
+        fputc( '"', out );
 }
 
-xmlChar *mpw_xmlTestCaseString(xmlNodePtr context, const char *nodeName) {
+void mpw_tests_write_begin(
+        FILE *out, const MPTestFormat format) {
 
-    xmlNodePtr child = mpw_xmlTestCaseNode( context, nodeName );
-    return child? xmlNodeGetContent( child ): NULL;
+    if (format == MPTestFormatXML)
+        fprintf( out, "<tests>\n" );
 }
 
-uint32_t mpw_xmlTestCaseInteger(xmlNodePtr context, const char *nodeName) {
+void mpw_tests_write(
+        FILE *out, const MPTestFormat format, const MPTestCase *testCase) {
+
+    const char *names[] = {
+            "fullName", "masterPassword", "keyID", "siteName", "resultType", "resultParam", "keyPurpose", "keyContext", "result"
+    };
+    const char *values[] = {
+            testCase->fullName, testCase->masterPassword, testCase->keyID, testCase->siteName,
+            testCase->resultType, testCase->resultParam, testCase->keyPurpose, testCase->keyContext, testCase->result
+    };
+
+    switch (format) {
+        case MPTestFormatXML: {
+            fprintf( out, "    <case id=\"" );
+            mpw_tests_write_string( out, format, testCase->id );
+            fprintf( out, "\">\n        <algorithm>%d</algorithm>\n        <siteCounter>%lu</siteCounter>\n",
+                    testCase->algorithm, (unsigned long)testCase->siteCounter );
+            for (size_t v = 0; v < sizeof( values ) / sizeof( *values ); ++v)
+                if (values[v]) {
+                    fprintf( out, "        <%s>", names[v] );
+                    mpw_tests_write_string( out, format, values[v] );
+                    fprintf( out, "</%s>\n", names[v] );
+                }
+            fprintf( out, "    </case>\n" );
+            break;
+        }
+        case MPTestFormatNDJSON: {
+            fprintf( out, "{\"id\":" );
+            mpw_tests_write_string( out, format, testCase->id );
+            fprintf( out, ",\"algorithm\":%d,\"siteCounter\":%lu",
+                    testCase->algorithm, (unsigned long)testCase->siteCounter );
+            for (size_t v = 0; v < sizeof( values ) / sizeof( *values ); ++v) {
+                fprintf( out, ",\"%s\":", names[v] );
+                mpw_tests_write_string( out, format, values[v] );
+            }
+            fprintf( out, "}\n" );
+            break;
+        }
+    }
+}
 
-    xmlChar *string = mpw_xmlTestCaseString( context, nodeName );
-    uint32_t integer = string? (uint32_t)atol( (char *)string ): 0;
-    xmlFree( string );
+void mpw_tests_write_end(
+        FILE *out, const MPTestFormat format) {
 
-    return integer;
+    if (format == MPTestFormatXML)
+        fprintf( out, "</tests>\n" );
 }
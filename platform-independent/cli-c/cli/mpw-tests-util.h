@@ -6,11 +6,59 @@
 //  Copyright (c) 2014 Lyndir. All rights reserved.
 //
 
-#include <libxml/parser.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
 
-xmlNodePtr mpw_xmlTestCaseNode(
-        xmlNodePtr testCaseNode, const char *nodeName);
-xmlChar *mpw_xmlTestCaseString(
-        xmlNodePtr context, const char *nodeName);
-uint32_t mpw_xmlTestCaseInteger(
-        xmlNodePtr context, const char *nodeName);
+#include "mpw-algorithm.h"
+
+/** A test case, with the values it doesn't declare itself inherited from its parent case.
+  * Values that are declared by neither the case nor its parents are NULL (or 0). */
+typedef struct MPTestCase {
+    char *id;
+    char *parent;
+    MPAlgorithmVersion algorithm;
+    char *fullName;
+    char *masterPassword;
+    char *keyID;
+    char *siteName;
+    MPCounterValue siteCounter;
+    char *resultType;
+    char *resultParam;
+    char *keyPurpose;
+    char *keyContext;
+    char *result;
+} MPTestCase;
+
+/** Read the test cases of an XML test suite, in the order they're declared in.
+  * The file is streamed and the cases' inheritance is resolved once, in time linear to the amount of cases.
+  * @return A new array of count test cases or NULL if the file couldn't be read. */
+MPTestCase *mpw_tests_read(
+        const char *path, size_t *count);
+/** Free the test cases and their values. */
+void mpw_tests_free(
+        MPTestCase *cases, const size_t count);
+
+/** The formats test cases can be written in. */
+typedef enum {
+    /** An mpw_tests.xml suite, each case declaring all of its values. */
+    MPTestFormatXML,
+    /** Newline-delimited JSON, one object per case with the same keys as the XML elements. */
+    MPTestFormatNDJSON,
+} MPTestFormat;
+
+/** Read the next batch of test cases from a stream of newline-delimited JSON, in the order they're declared in.
+  * @param cases An array of at least capacity test cases, which are overwritten by the batch.
+  * @param count The amount of test cases read into the array, 0 at the end of the stream.
+  * @return false if the stream contains invalid JSON or JSON support is not available. */
+bool mpw_tests_read_ndjson(
+        FILE *in, MPTestCase *cases, const size_t capacity, size_t *count);
+/** Write the start of a document of test cases. */
+void mpw_tests_write_begin(
+        FILE *out, const MPTestFormat format);
+/** Write a test case to a document of test cases. */
+void mpw_tests_write(
+        FILE *out, const MPTestFormat format, const MPTestCase *testCase);
+/** Write the end of a document of test cases. */
+void mpw_tests_write_end(
+        FILE *out, const MPTestFormat format);
@@ -1,88 +1,448 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <sysexits.h>
 
 #define ftl(...) do { fprintf( stderr, __VA_ARGS__ ); exit(2); } while (0)
 
 #include "mpw-algorithm.h"
 #include "mpw-util.h"
 
+#include "mpw-cli-util.h"
 #include "mpw-tests-util.h"
 
-int main(int argc, char *const argv[]) {
+/** The amount of test cases that are streamed, generated and checked at once. */
+#define MPTestsBatchSize    65536
+
+/** The outcome of a test case. */
+typedef struct MPTestRun {
+    /** Don't run the case, eg. because it's abstract. */
+    bool skip;
+    /** The index of the case's master key in the run's master keys. */
+    size_t key;
+    const char *sitePassword;
+} MPTestRun;
+
+/** A master key, derived once for all the cases that share its inputs. */
+typedef struct MPTestKey {
+    char *fullName;
+    char *masterPassword;
+    MPAlgorithmVersion algorithm;
+    MPMasterKey masterKey;
+    /** The user's key ID, which identifies the master key of the current algorithm version, like the suite's keyIDs. */
+    MPMasterKey currentMasterKey;
+    char *keyID;
+} MPTestKey;
+
+typedef struct MPTests {
+    MPTestCase *cases;
+    MPTestRun *runs;
+    size_t casesCount;
+    MPTestKey *keys;
+    size_t keysCount;
+} MPTests;
+
+/** @return true if both strings are NULL or have the same contents. */
+static bool mpw_tests_equal(const char *a, const char *b) {
+
+    return a == b || (a && b && strcmp( a, b ) == 0);
+}
+
+/** @return true if the case is abstract, ie. it only declares values for other cases to inherit. */
+static bool mpw_tests_abstract(const MPTestCase *testCase) {
+
+    return !testCase->result || !strlen( testCase->result );
+}
 
-    int failedTests = 0;
+/** @return The index of the key for the case's master key inputs in the keys or ERR if there is none. */
+static size_t mpw_tests_find_key(const MPTestKey *keys, const size_t keysCount, const MPTestCase *testCase) {
 
-    xmlNodePtr tests = xmlDocGetRootElement( xmlParseFile( "mpw_tests.xml" ) );
-    if (!tests) {
-        ftl( "Couldn't find test case: mpw_tests.xml\n" );
-        abort();
+    // Cases that share a master key tend to be declared together, search the most recent keys first.
+    for (size_t k = keysCount; k > 0; --k) {
+        const MPTestKey *key = &keys[k - 1];
+        if (key->algorithm == testCase->algorithm &&
+            mpw_tests_equal( key->fullName, testCase->fullName ) &&
+            mpw_tests_equal( key->masterPassword, testCase->masterPassword ))
+            return k - 1;
     }
 
-    for (xmlNodePtr testCase = tests->children; testCase; testCase = testCase->next) {
-        if (testCase->type != XML_ELEMENT_NODE || xmlStrcmp( testCase->name, BAD_CAST "case" ) != 0)
-            continue;
+    return (size_t)ERR;
+}
 
-        // Read in the test case.
-        xmlChar *id = mpw_xmlTestCaseString( testCase, "id" );
-        MPAlgorithmVersion algorithm = (MPAlgorithmVersion)mpw_xmlTestCaseInteger( testCase, "algorithm" );
-        xmlChar *fullName = mpw_xmlTestCaseString( testCase, "fullName" );
-        xmlChar *masterPassword = mpw_xmlTestCaseString( testCase, "masterPassword" );
-        xmlChar *keyID = mpw_xmlTestCaseString( testCase, "keyID" );
-        xmlChar *siteName = mpw_xmlTestCaseString( testCase, "siteName" );
-        MPCounterValue siteCounter = (MPCounterValue)mpw_xmlTestCaseInteger( testCase, "siteCounter" );
-        xmlChar *resultTypeString = mpw_xmlTestCaseString( testCase, "resultType" );
-        xmlChar *keyPurposeString = mpw_xmlTestCaseString( testCase, "keyPurpose" );
-        xmlChar *keyContext = mpw_xmlTestCaseString( testCase, "keyContext" );
-        xmlChar *result = mpw_xmlTestCaseString( testCase, "result" );
-
-        MPResultType resultType = mpw_typeWithName( (char *)resultTypeString );
-        MPKeyPurpose keyPurpose = mpw_purposeWithName( (char *)keyPurposeString );
-
-        // Run the test case.
-        fprintf( stdout, "test case %s... ", id );
-        if (!xmlStrlen( result )) {
-            fprintf( stdout, "abstract.\n" );
-            continue;
-        }
+static void mpw_tests_free_keys(MPTestKey *keys, const size_t keysCount) {
+
+    for (size_t k = 0; k < keysCount; ++k) {
+        free( keys[k].fullName );
+        free( keys[k].masterPassword );
+        free( keys[k].keyID );
+        mpw_free( keys[k].masterKey, MPMasterKeySize );
+    }
+    free( keys );
+}
+
+static void mpw_tests_key(void *tests_, const size_t index) {
+
+    MPTests *tests = tests_;
+    MPTestKey *key = &tests->keys[index];
+    if (key->masterKey || !key->fullName || !key->masterPassword)
+        return;
+
+    key->masterKey = mpw_masterKey( key->fullName, key->masterPassword, key->algorithm );
+
+    // Older algorithm versions only derive a different master key than the current version for multi-byte full names.
+    if (key->algorithm != MPAlgorithmVersionCurrent && strlen( key->fullName ) != mpw_utf8_strlen( key->fullName ))
+        key->currentMasterKey = mpw_masterKey( key->fullName, key->masterPassword, MPAlgorithmVersionCurrent );
+}
+
+static void mpw_tests_case(void *tests_, const size_t index) {
+
+    MPTests *tests = tests_;
+    MPTestCase *testCase = &tests->cases[index];
+    MPTestRun *run = &tests->runs[index];
+    if (run->skip || !tests->keys[run->key].masterKey ||
+        !testCase->siteName || !testCase->keyPurpose || !testCase->resultType)
+        return;
 
-        // 1. calculate the master key.
-        MPMasterKey masterKey = mpw_masterKey(
-                (char *)fullName, (char *)masterPassword, algorithm );
-        if (!masterKey) {
-            ftl( "Couldn't derive master key.\n" );
+    run->sitePassword = mpw_siteResult(
+            tests->keys[run->key].masterKey, testCase->siteName, testCase->siteCounter,
+            mpw_purposeWithName( testCase->keyPurpose ), testCase->keyContext,
+            mpw_typeWithName( testCase->resultType ), testCase->resultParam, testCase->algorithm );
+}
+
+/** Run a batch of test cases: group the cases by the inputs of their master key, derive each distinct master key once
+  * and then derive the site results, both on all available processors.
+  * The master keys of the previous batch are reused by this batch, the ones it doesn't need are freed. */
+static void mpw_tests_run(MPTests *tests) {
+
+    MPTestKey *previousKeys = tests->keys;
+    size_t previousKeysCount = tests->keysCount, keysCapacity = 0;
+    tests->keys = NULL;
+    tests->keysCount = 0;
+
+    for (size_t c = 0; c < tests->casesCount; ++c) {
+        MPTestCase *testCase = &tests->cases[c];
+        MPTestRun *run = &tests->runs[c];
+        if (run->skip)
+            continue;
+        if ((run->key = mpw_tests_find_key( tests->keys, tests->keysCount, testCase )) != (size_t)ERR)
             continue;
+
+        if (tests->keysCount == keysCapacity) {
+            keysCapacity = max( keysCapacity * 2, (size_t)16 );
+            if (!mpw_realloc( &tests->keys, NULL, sizeof( *tests->keys ) * keysCapacity ))
+                ftl( "Couldn't allocate master keys.\n" );
         }
 
-        // 2. calculate the site password.
-        const char *sitePassword = mpw_siteResult(
-                masterKey, (char *)siteName, siteCounter, keyPurpose, (char *)keyContext, resultType, NULL, algorithm );
-        mpw_free( masterKey, MPMasterKeySize );
-        if (!sitePassword) {
-            ftl( "Couldn't derive site password.\n" );
-            continue;
+        // Take over the key from the previous batch, if it has one.
+        run->key = tests->keysCount++;
+        size_t previousKey = mpw_tests_find_key( previousKeys, previousKeysCount, testCase );
+        if (previousKey != (size_t)ERR) {
+            tests->keys[run->key] = previousKeys[previousKey];
+            previousKeys[previousKey] = (MPTestKey){ .algorithm = (MPAlgorithmVersion)ERR };
         }
+        else
+            tests->keys[run->key] = (MPTestKey){
+                    .fullName = testCase->fullName? strdup( testCase->fullName ): NULL,
+                    .masterPassword = testCase->masterPassword? strdup( testCase->masterPassword ): NULL,
+                    .algorithm = testCase->algorithm,
+            };
+    }
+    mpw_tests_free_keys( previousKeys, previousKeysCount );
+
+    // 1. calculate each distinct master key, 2. calculate the site passwords.
+    mpw_parallel( tests->keysCount, mpw_tests_key, tests );
+    for (size_t k = 0; k < tests->keysCount; ++k) {
+        MPTestKey *key = &tests->keys[k];
+        if (key->masterKey && !key->keyID)
+            key->keyID = strdup( mpw_id_buf( key->currentMasterKey?: key->masterKey, MPMasterKeySize ) );
+        mpw_free( key->currentMasterKey, MPMasterKeySize );
+        key->currentMasterKey = NULL;
+    }
+    mpw_parallel( tests->casesCount, mpw_tests_case, tests );
+}
+
+/** Check the results of a batch of test cases that has been run, in the order of the cases.
+  * @param verbose Report every case, not just the ones that failed.
+  * @return The amount of failed cases. */
+static size_t mpw_tests_check(MPTests *tests, const bool verbose) {
 
-        // Check the result.
-        if (xmlStrcmp( result, BAD_CAST sitePassword ) == 0)
-            fprintf( stdout, "pass.\n" );
+    size_t failedTests = 0;
+    for (size_t c = 0; c < tests->casesCount; ++c) {
+        MPTestCase *testCase = &tests->cases[c];
+        MPTestRun *run = &tests->runs[c];
+        MPTestKey *key = run->skip? NULL: &tests->keys[run->key];
+        const char *failure = NULL;
+        if (key && !key->masterKey)
+            failure = "couldn't derive master key";
+        else if (key && testCase->keyID && !mpw_id_buf_equals( testCase->keyID, key->keyID ))
+            failure = mpw_str( "got key ID %s != expected %s", key->keyID, testCase->keyID );
+        else if (key && !run->sitePassword)
+            failure = "couldn't derive site password";
+        else if (key && strcmp( testCase->result, run->sitePassword ) != 0)
+            failure = mpw_str( "got %s != expected %s", run->sitePassword, testCase->result );
 
-        else {
+        if (failure) {
             ++failedTests;
-            fprintf( stdout, "FAILED!  (got %s != expected %s)\n", sitePassword, result );
+            fprintf( stdout, "test case %s... FAILED!  (%s)\n", testCase->id, failure );
         }
+        else if (verbose)
+            fprintf( stdout, "test case %s... %s.\n", testCase->id, key? "pass": "abstract" );
+    }
+
+    return failedTests;
+}
+
+/** Free a batch of test cases and their results, but not its master keys. */
+static void mpw_tests_free_batch(MPTests *tests) {
 
-        // Free test case.
-        mpw_free_string( sitePassword );
-        xmlFree( id );
-        xmlFree( fullName );
-        xmlFree( masterPassword );
-        xmlFree( keyID );
-        xmlFree( siteName );
-        xmlFree( resultTypeString );
-        xmlFree( keyPurposeString );
-        xmlFree( keyContext );
-        xmlFree( result );
+    for (size_t c = 0; c < tests->casesCount; ++c)
+        mpw_free_string( tests->runs[c].sitePassword );
+    mpw_tests_free( tests->cases, tests->casesCount );
+    free( tests->runs );
+    tests->cases = NULL;
+    tests->runs = NULL;
+    tests->casesCount = 0;
+}
+
+/** Check the test cases of a suite (mpw_tests.xml) or, streamed in batches, of newline-delimited JSON test vectors.
+  * @return The amount of failed cases. */
+static size_t mpw_tests_check_file(const char *path) {
+
+    MPTests tests = { .cases = NULL };
+    size_t failedTests = 0, casesCount = 0;
+    const char *extension = strrchr( path, '.' );
+    if (extension && (strcmp( extension, ".ndjson" ) == 0 || strcmp( extension, ".json" ) == 0)) {
+        FILE *in = fopen( path, "r" );
+        if (!in)
+            ftl( "Couldn't open test vectors: %s\n", path );
+
+        while (true) {
+            mpw_tests_free_batch( &tests );
+            if (!(tests.cases = calloc( MPTestsBatchSize, sizeof( *tests.cases ) )) ||
+                !(tests.runs = calloc( MPTestsBatchSize, sizeof( *tests.runs ) )))
+                ftl( "Couldn't allocate test cases.\n" );
+            if (!mpw_tests_read_ndjson( in, tests.cases, MPTestsBatchSize, &tests.casesCount ))
+                ftl( "Couldn't read test vectors: %s\n", path );
+            if (!tests.casesCount)
+                break;
+
+            for (size_t c = 0; c < tests.casesCount; ++c)
+                tests.runs[c].skip = mpw_tests_abstract( &tests.cases[c] );
+            mpw_tests_run( &tests );
+            failedTests += mpw_tests_check( &tests, false );
+            casesCount += tests.casesCount;
+        }
+        fclose( in );
+
+        fprintf( stdout, "%zu test cases, %zu failed.\n", casesCount, failedTests );
+    }
+    else {
+        if (!(tests.cases = mpw_tests_read( path, &tests.casesCount )))
+            ftl( "Couldn't find test case: %s\n", path );
+        if (!(tests.runs = calloc( max( tests.casesCount, (size_t)1 ), sizeof( *tests.runs ) )))
+            ftl( "Couldn't allocate test cases.\n" );
+
+        for (size_t c = 0; c < tests.casesCount; ++c)
+            tests.runs[c].skip = mpw_tests_abstract( &tests.cases[c] );
+        mpw_tests_run( &tests );
+        failedTests += mpw_tests_check( &tests, true );
     }
 
+    mpw_tests_free_batch( &tests );
+    mpw_tests_free_keys( tests.keys, tests.keysCount );
+
     return failedTests;
 }
+
+/** @return The next number of a deterministic pseudo-random sequence (splitmix64). */
+static uint64_t mpw_tests_random(uint64_t *state) {
+
+    uint64_t z = (*state += 0x9E3779B97F4A7C15);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    return z ^ (z >> 31);
+}
+
+/** @return A new random word of a few syllables, sometimes including multi-byte characters. */
+static char *mpw_tests_random_word(uint64_t *state) {
+
+    static const char *consonants = "bcdfghjklmnprstvwxz", *vowels = "aeiouy";
+    static const char *multiBytes[] = { "é", "ø", "ß", "Ω", "ж", "日本", "⛄", "🔑" };
+
+    char *word = NULL;
+    for (size_t s = 0, syllables = 1 + mpw_tests_random( state ) % 4; s < syllables; ++s)
+        mpw_string_pushf( &word, "%c%c",
+                consonants[mpw_tests_random( state ) % strlen( consonants )],
+                vowels[mpw_tests_random( state ) % strlen( vowels )] );
+    if (mpw_tests_random( state ) % 5 == 0)
+        mpw_string_push( &word, multiBytes[mpw_tests_random( state ) % (sizeof( multiBytes ) / sizeof( *multiBytes ))] );
+
+    return word;
+}
+
+/** Generate the master key inputs shared by a range of test vectors. */
+static void mpw_tests_generate_key(MPTestCase *testCase, const uint64_t seed, const size_t key) {
+
+    uint64_t state = seed ^ (key * 0xD1B54A32D192ED03);
+    testCase->algorithm = (MPAlgorithmVersion)(mpw_tests_random( &state ) % (MPAlgorithmVersionLast + 1));
+
+    char *firstName = mpw_tests_random_word( &state ), *lastName = mpw_tests_random_word( &state );
+    mpw_string_pushf( &testCase->fullName, "%s %s", firstName, lastName );
+    free( firstName );
+    free( lastName );
+
+    for (size_t w = 0, words = 2 + mpw_tests_random( &state ) % 3; w < words; ++w) {
+        char *word = mpw_tests_random_word( &state );
+        mpw_string_pushf( &testCase->masterPassword, "%s%s", w? " ": "", word );
+        free( word );
+    }
+}
+
+/** Generate the site parameters of a test vector. */
+static void mpw_tests_generate_site(MPTestCase *testCase, const uint64_t seed, const size_t vector) {
+
+    static const char *tlds[] = { "com", "org", "net", "io", "co.uk", "de", "jp", "рф" };
+    static const char *resultTypes[] = {
+            "GeneratedMaximum", "GeneratedLong", "GeneratedMedium", "GeneratedBasic",
+            "GeneratedShort", "GeneratedPIN", "GeneratedName", "GeneratedPhrase",
+    };
+    static const char *keyPurposes[] = { "Authentication", "Identification", "Recovery" };
+
+    uint64_t state = seed ^ (vector * 0x9E3779B97F4A7C15 + 1);
+    mpw_string_pushf( &testCase->id, "vector-%zu", vector );
+
+    char *site = mpw_tests_random_word( &state );
+    mpw_string_pushf( &testCase->siteName, "%s.%s", site, tlds[mpw_tests_random( &state ) % (sizeof( tlds ) / sizeof( *tlds ))] );
+    free( site );
+
+    // Counters are mostly the initial one, sometimes a few rotations and rarely anything up to the last counter.
+    uint64_t counter = mpw_tests_random( &state ) % 10;
+    if (counter < 7)
+        testCase->siteCounter = MPCounterValueInitial;
+    else if (counter < 9)
+        testCase->siteCounter = (MPCounterValue)(2 + mpw_tests_random( &state ) % 9);
+    else
+        testCase->siteCounter = (MPCounterValue)(1 + mpw_tests_random( &state ) % MPCounterValueLast);
+
+    uint64_t purpose = mpw_tests_random( &state ) % 20;
+    testCase->keyPurpose = strdup( keyPurposes[purpose < 14? 0: purpose < 17? 1: 2] );
+    if (mpw_tests_random( &state ) % (purpose < 17? 10: 2) == 0)
+        testCase->keyContext = mpw_tests_random_word( &state );
+    testCase->resultType = strdup( resultTypes[mpw_tests_random( &state ) % (sizeof( resultTypes ) / sizeof( *resultTypes ))] );
+}
+
+/** Generate test vectors, with count / keys vectors sharing each master key, and write them out in batches. */
+static void mpw_tests_generate(const size_t count, const size_t keys, const uint64_t seed, const MPTestFormat format) {
+
+    MPTests tests = { .cases = NULL };
+    mpw_tests_write_begin( stdout, format );
+    for (size_t start = 0; start < count; start += MPTestsBatchSize) {
+        tests.casesCount = min( count - start, (size_t)MPTestsBatchSize );
+        if (!(tests.cases = calloc( tests.casesCount, sizeof( *tests.cases ) )) ||
+            !(tests.runs = calloc( tests.casesCount, sizeof( *tests.runs ) )))
+            ftl( "Couldn't allocate test vectors.\n" );
+
+        for (size_t c = 0; c < tests.casesCount; ++c) {
+            size_t vector = start + c;
+            mpw_tests_generate_key( &tests.cases[c], seed, (size_t)((uint64_t)vector * keys / count) );
+            mpw_tests_generate_site( &tests.cases[c], seed, vector );
+        }
+        mpw_tests_run( &tests );
+
+        for (size_t c = 0; c < tests.casesCount; ++c) {
+            MPTestCase *testCase = &tests.cases[c];
+            MPTestRun *run = &tests.runs[c];
+            if (!run->sitePassword)
+                ftl( "Couldn't derive site password for test vector: %s\n", testCase->id );
+
+            testCase->keyID = strdup( tests.keys[run->key].keyID );
+            testCase->result = (char *)run->sitePassword;
+            run->sitePassword = NULL;
+            mpw_tests_write( stdout, format, testCase );
+        }
+        mpw_tests_free_batch( &tests );
+    }
+    mpw_tests_write_end( stdout, format );
+    mpw_tests_free_keys( tests.keys, tests.keysCount );
+}
+
+static void usage() {
+
+    fprintf( stderr, ""
+            "Usage:\n"
+            "  mpw-tests [path]\n"
+            "  mpw-tests --generate count [--keys count] [--seed number] [--format xml|ndjson]\n\n" );
+    fprintf( stderr, ""
+            "  path         Check the test cases in the file at path, defaults to mpw_tests.xml.\n"
+            "               Files ending in .ndjson or .json are streamed as test vectors,\n"
+            "               one JSON object per line, and only their failures are reported.\n\n" );
+    fprintf( stderr, ""
+            "  --generate count\n"
+            "               Write count test vectors instead, over random (including multi-byte) names,\n"
+            "               counters, purposes, contexts, result types and algorithm versions.\n\n" );
+    fprintf( stderr, ""
+            "  --keys count The amount of distinct master keys to spread the vectors over.\n"
+            "               Defaults to 1 for every 1000 vectors.\n\n" );
+    fprintf( stderr, ""
+            "  --seed number\n"
+            "               The seed of the vectors, the same seed and counts generate the same vectors.\n"
+            "               Defaults to 0.\n\n" );
+    fprintf( stderr, ""
+            "  --format xml|ndjson\n"
+            "               Write the vectors as an mpw_tests.xml suite or as newline-delimited JSON.\n"
+            "               Defaults to xml.\n\n" );
+    exit( 0 );
+}
+
+int main(int argc, char *const argv[]) {
+
+    long long generate = 0, keys = 0;
+    uint64_t seed = 0;
+    MPTestFormat format = MPTestFormatXML;
+
+    enum {
+        MPTestsOptGenerate = 0x100, MPTestsOptKeys, MPTestsOptSeed, MPTestsOptFormat
+    };
+    const struct option longOptions[] = {
+            { "generate", required_argument, NULL, MPTestsOptGenerate },
+            { "keys", required_argument, NULL, MPTestsOptKeys },
+            { "seed", required_argument, NULL, MPTestsOptSeed },
+            { "format", required_argument, NULL, MPTestsOptFormat },
+            { NULL, 0, NULL, 0 },
+    };
+    for (int opt; (opt = getopt_long( argc, argv, "h", longOptions, NULL )) != EOF;)
+        switch (opt) {
+            case MPTestsOptGenerate:
+                if ((generate = atoll( optarg )) <= 0)
+                    ftl( "Invalid amount of test vectors: %s\n", optarg );
+                break;
+            case MPTestsOptKeys:
+                if ((keys = atoll( optarg )) <= 0)
+                    ftl( "Invalid amount of master keys: %s\n", optarg );
+                break;
+            case MPTestsOptSeed:
+                seed = strtoull( optarg, NULL, 10 );
+                break;
+            case MPTestsOptFormat:
+                if (strcmp( optarg, "xml" ) == 0)
+                    format = MPTestFormatXML;
+                else if (strcmp( optarg, "ndjson" ) == 0)
+                    format = MPTestFormatNDJSON;
+                else
+                    ftl( "Invalid format: %s\n", optarg );
+                break;
+            case 'h':
+                usage();
+                break;
+            default:
+                return EX_USAGE;
+        }
+
+    if (generate) {
+        mpw_tests_generate( (size_t)generate, (size_t)min( keys? keys: max( generate / 1000, 1LL ), generate ), seed, format );
+        return EXIT_SUCCESS;
+    }
+
+    return mpw_tests_check_file( optind < argc? argv[optind]: "mpw_tests.xml" )? EXIT_FAILURE: EXIT_SUCCESS;
+}
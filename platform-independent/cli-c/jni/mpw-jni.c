@@ -0,0 +1,202 @@
+//==============================================================================
+// This file is part of Master Password.
+// Copyright (c) 2011-2017, Maarten Billemont.
+//
+// Master Password is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Master Password is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You can find a copy of the GNU General Public License in the
+// LICENSE file.  Alternatively, see <http://www.gnu.org/licenses/>.
+//==============================================================================
+
+// The native backend of com.lyndir.masterpassword.MasterKeyJNI.
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <jni.h>
+
+#if HAS_CPERCIVA
+#include <scrypt/sha256.h>
+#elif HAS_SODIUM
+#include "sodium.h"
+#endif
+
+#include "mpw-algorithm.h"
+#include "mpw-util.h"
+
+/** A master key held on its own locked page of memory, so it is never swapped out or dumped with the process. */
+typedef struct MPJNIKey {
+    uint8_t masterKey[MPMasterKeySize];
+    MPAlgorithmVersion algorithmVersion;
+} MPJNIKey;
+
+static MPJNIKey *mpw_jni_key_alloc() {
+
+    size_t size = (size_t)sysconf( _SC_PAGESIZE );
+    if (size < sizeof( MPJNIKey ))
+        size = sizeof( MPJNIKey );
+
+    MPJNIKey *key = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if (key == MAP_FAILED)
+        return NULL;
+
+    // Locking can fail when the process exceeds its RLIMIT_MEMLOCK; the key is still usable, only less protected.
+    if (mlock( key, size ) != 0)
+        wrn( "Couldn't lock master key memory: %s\n", strerror( errno ) );
+#ifdef MADV_DONTDUMP
+    madvise( key, size, MADV_DONTDUMP );
+#endif
+
+    return key;
+}
+
+static void mpw_jni_key_free(MPJNIKey *key) {
+
+    if (!key)
+        return;
+
+    size_t size = (size_t)sysconf( _SC_PAGESIZE );
+    if (size < sizeof( MPJNIKey ))
+        size = sizeof( MPJNIKey );
+
+    memset( key, 0, sizeof( MPJNIKey ) );
+    munlock( key, size );
+    munmap( key, size );
+}
+
+/** @return The NUL-terminated UTF-8 string in a direct buffer, or NULL if the buffer is NULL, not direct or not terminated. */
+static const char *mpw_jni_string(JNIEnv *env, jobject buffer) {
+
+    if (!buffer)
+        return NULL;
+
+    const char *string = (*env)->GetDirectBufferAddress( env, buffer );
+    jlong capacity = (*env)->GetDirectBufferCapacity( env, buffer );
+    if (!string || capacity <= 0 || !memchr( string, '\0', (size_t)capacity ))
+        return NULL;
+
+    return string;
+}
+
+static void mpw_jni_throw(JNIEnv *env, const char *className, const char *message) {
+
+    jclass exceptionClass = (*env)->FindClass( env, className );
+    if (exceptionClass)
+        (*env)->ThrowNew( env, exceptionClass, message );
+}
+
+JNIEXPORT jlong JNICALL Java_com_lyndir_masterpassword_MasterKeyJNI_masterKey(
+        JNIEnv *env, jclass type, jobject fullNameBuffer, jobject masterPasswordBuffer, jint algorithmVersion) {
+
+    const char *fullName = mpw_jni_string( env, fullNameBuffer );
+    const char *masterPassword = mpw_jni_string( env, masterPasswordBuffer );
+    if (!fullName || !masterPassword ||
+        algorithmVersion < MPAlgorithmVersionFirst || algorithmVersion > MPAlgorithmVersionLast) {
+        mpw_jni_throw( env, "java/lang/IllegalArgumentException", "Missing full name, master password or invalid algorithm." );
+        return 0;
+    }
+
+    MPJNIKey *key = mpw_jni_key_alloc();
+    if (!key) {
+        mpw_jni_throw( env, "java/lang/OutOfMemoryError", "Couldn't allocate master key memory." );
+        return 0;
+    }
+
+    MPMasterKey masterKey = mpw_masterKey( fullName, masterPassword, (MPAlgorithmVersion)algorithmVersion );
+    if (!masterKey) {
+        mpw_jni_key_free( key );
+        return 0;
+    }
+
+    memcpy( key->masterKey, masterKey, MPMasterKeySize );
+    key->algorithmVersion = (MPAlgorithmVersion)algorithmVersion;
+    mpw_free( masterKey, MPMasterKeySize );
+
+    return (jlong)(intptr_t)key;
+}
+
+JNIEXPORT jlong JNICALL Java_com_lyndir_masterpassword_MasterKeyJNI_copy(
+        JNIEnv *env, jclass type, jlong handle, jint algorithmVersion) {
+
+    MPJNIKey *key = (MPJNIKey *)(intptr_t)handle;
+    if (!key || algorithmVersion < MPAlgorithmVersionFirst || algorithmVersion > MPAlgorithmVersionLast) {
+        mpw_jni_throw( env, "java/lang/IllegalArgumentException", "Missing master key or invalid algorithm." );
+        return 0;
+    }
+
+    MPJNIKey *copy = mpw_jni_key_alloc();
+    if (!copy) {
+        mpw_jni_throw( env, "java/lang/OutOfMemoryError", "Couldn't allocate master key memory." );
+        return 0;
+    }
+
+    // The caller has established that the algorithm derives the same master key.
+    memcpy( copy->masterKey, key->masterKey, MPMasterKeySize );
+    copy->algorithmVersion = (MPAlgorithmVersion)algorithmVersion;
+
+    return (jlong)(intptr_t)copy;
+}
+
+JNIEXPORT jbyteArray JNICALL Java_com_lyndir_masterpassword_MasterKeyJNI_keyID(
+        JNIEnv *env, jclass type, jlong handle) {
+
+    MPJNIKey *key = (MPJNIKey *)(intptr_t)handle;
+    if (!key)
+        return NULL;
+
+#if HAS_CPERCIVA
+    uint8_t hash[32];
+    SHA256_Buf( key->masterKey, MPMasterKeySize, hash );
+#elif HAS_SODIUM
+    uint8_t hash[crypto_hash_sha256_BYTES];
+    crypto_hash_sha256( hash, key->masterKey, MPMasterKeySize );
+#else
+#error No crypto support for mpw_jni keyID.
+#endif
+
+    jbyteArray keyID = (*env)->NewByteArray( env, sizeof( hash ) );
+    if (keyID)
+        (*env)->SetByteArrayRegion( env, keyID, 0, sizeof( hash ), (const jbyte *)hash );
+
+    return keyID;
+}
+
+JNIEXPORT jstring JNICALL Java_com_lyndir_masterpassword_MasterKeyJNI_siteResult(
+        JNIEnv *env, jclass type, jlong handle, jobject siteNameBuffer, jlong siteCounter,
+        jint keyPurpose, jobject keyContextBuffer, jint resultType) {
+
+    MPJNIKey *key = (MPJNIKey *)(intptr_t)handle;
+    const char *siteName = mpw_jni_string( env, siteNameBuffer );
+    const char *keyContext = mpw_jni_string( env, keyContextBuffer );
+    if (!key || !siteName || (keyContextBuffer && !keyContext)) {
+        mpw_jni_throw( env, "java/lang/IllegalArgumentException", "Missing master key, site name or invalid context." );
+        return NULL;
+    }
+
+    const char *siteResult = mpw_siteResult( key->masterKey, siteName, (MPCounterValue)siteCounter,
+            (MPKeyPurpose)keyPurpose, keyContext, (MPResultType)resultType, NULL, key->algorithmVersion );
+    if (!siteResult)
+        return NULL;
+
+    // Template results are ASCII, so they're also valid modified UTF-8.
+    jstring result = (*env)->NewStringUTF( env, siteResult );
+    mpw_free_string( siteResult );
+
+    return result;
+}
+
+JNIEXPORT void JNICALL Java_com_lyndir_masterpassword_MasterKeyJNI_free(
+        JNIEnv *env, jclass type, jlong handle) {
+
+    mpw_jni_key_free( (MPJNIKey *)(intptr_t)handle );
+}
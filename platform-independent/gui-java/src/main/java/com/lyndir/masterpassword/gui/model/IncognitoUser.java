@@ -33,6 +33,7 @@ public class IncognitoUser extends User {
     public void authenticate(final char[] masterPassword)
             throws IncorrectMasterPasswordException {
         this.masterPassword = masterPassword.clone();
+        prepareKeys();
     }
 
     @Override
@@ -53,6 +53,7 @@ public class ModelUser extends User {
             throws IncorrectMasterPasswordException {
         putKey( model.authenticate( masterPassword ) );
         this.masterPassword = masterPassword.clone();
+        prepareKeys();
         MPUserFileManager.get().save();
     }
 
@@ -1,7 +1,10 @@
 package com.lyndir.masterpassword.gui.model;
 
 import com.google.common.base.Preconditions;
-import com.google.common.collect.Maps;
+import com.google.common.collect.*;
+import com.google.common.util.concurrent.FutureCallback;
+import com.google.common.util.concurrent.Futures;
+import com.lyndir.lhunath.opal.system.logging.Logger;
 import com.lyndir.masterpassword.MasterKey;
 import com.lyndir.masterpassword.model.IncorrectMasterPasswordException;
 import java.util.*;
@@ -14,9 +17,20 @@ import javax.annotation.Nullable;
  */
 public abstract class User {
 
+    @SuppressWarnings("UnusedDeclaration")
+    private static final Logger logger = Logger.get( User.class );
+
+    /**
+     * The user's master keys by algorithm version, versions whose salts match share their master key.  Guarded by this user.
+     */
     @Nonnull
     private final Map<MasterKey.Version, MasterKey> keyByVersion = Maps.newEnumMap( MasterKey.Version.class  );
 
+    /**
+     * Counts resets, so keys prepared for an earlier authentication are discarded.
+     */
+    private int keyGeneration;
+
     public abstract String getFullName();
 
     @Nullable
@@ -38,24 +52,88 @@ public abstract class User {
     public MasterKey getKey(final MasterKey.Version algorithmVersion) {
         char[] masterPassword = Preconditions.checkNotNull( getMasterPassword(), "User is not authenticated: " + getFullName() );
 
-        MasterKey key = keyByVersion.get( algorithmVersion );
+        MasterKey key = findKey( algorithmVersion );
         if (key == null)
-            putKey( key = MasterKey.create( algorithmVersion, getFullName(), masterPassword ) );
+            // Joins the derivation for the key if it is being prepared.
+            putKey( key = Futures.getUnchecked( MasterKey.createAsync( algorithmVersion, getFullName(), masterPassword ) ) );
         if (!key.isValid())
             key.revalidate( masterPassword );
 
         return key;
     }
 
-    protected void putKey(final MasterKey masterKey) {
+    /**
+     * @return The key for the algorithm version, or a new one that shares the master key of a key for another version.
+     */
+    @Nullable
+    private synchronized MasterKey findKey(final MasterKey.Version algorithmVersion) {
+        MasterKey key = keyByVersion.get( algorithmVersion );
+        if (key != null)
+            return key;
+
+        for (final MasterKey otherKey : keyByVersion.values())
+            if ((key = otherKey.forVersion( algorithmVersion )) != null) {
+                keyByVersion.put( algorithmVersion, key );
+                return key;
+            }
+
+        return null;
+    }
+
+    protected synchronized void putKey(final MasterKey masterKey) {
         MasterKey oldKey = keyByVersion.put( masterKey.getAlgorithmVersion(), masterKey );
-        if (oldKey != null)
+        if ((oldKey != null) && (oldKey != masterKey))
             oldKey.invalidate();
     }
 
-    public void reset() {
+    /**
+     * Make the keys for all algorithm versions available in the background after authenticating, so that switching versions
+     * doesn't need a key derivation.  Only versions whose salt differs from every key we hold are derived, the current version
+     * first and one at a time, since the keys for the versions after it can then be shared.
+     */
+    protected synchronized void prepareKeys() {
+        final char[] masterPassword = getMasterPassword();
+        if (masterPassword == null)
+            return;
+
+        for (final MasterKey.Version algorithmVersion : Iterables.concat( ImmutableList.of( MasterKey.Version.CURRENT ),
+                                                                          Arrays.asList( MasterKey.Version.values() ) ))
+            if (findKey( algorithmVersion ) == null) {
+                final int generation = keyGeneration;
+                Futures.addCallback( MasterKey.createAsync( algorithmVersion, getFullName(), masterPassword ), new FutureCallback<MasterKey>() {
+                    @Override
+                    public void onSuccess(@Nullable final MasterKey key) {
+                        synchronized (User.this) {
+                            if ((key == null) || (generation != keyGeneration)) {
+                                if (key != null)
+                                    key.invalidate();
+                                return;
+                            }
+
+                            // getKey may have put a key for this version meanwhile.  Each request gets a key of its own, so ours is
+                            // then a spare copy.
+                            if (keyByVersion.containsKey( algorithmVersion ))
+                                key.invalidate();
+                            else
+                                keyByVersion.put( algorithmVersion, key );
+                            prepareKeys();
+                        }
+                    }
+
+                    @Override
+                    public void onFailure(@Nonnull final Throwable t) {
+                        logger.err( t, "Couldn't prepare %s key for: %s", algorithmVersion, getFullName() );
+                    }
+                } );
+                return;
+            }
+    }
+
+    public synchronized void reset() {
+        ++keyGeneration;
         for (final MasterKey key : keyByVersion.values())
             key.invalidate();
+        keyByVersion.clear();
     }
 
     public abstract Iterable<Site> findSitesByName(String siteName);
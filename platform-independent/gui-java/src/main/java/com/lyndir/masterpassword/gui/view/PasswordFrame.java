@@ -4,7 +4,9 @@ import static com.lyndir.lhunath.opal.system.util.ObjectUtils.ifNotNullElse;
 import static com.lyndir.lhunath.opal.system.util.StringUtils.*;
 
 import com.google.common.base.Predicate;
+import com.google.common.cache.*;
 import com.google.common.collect.FluentIterable;
+import com.google.common.collect.ImmutableList;
 import com.google.common.collect.Iterables;
 import com.google.common.primitives.UnsignedInteger;
 import com.google.common.util.concurrent.*;
@@ -16,6 +18,7 @@ import com.lyndir.masterpassword.gui.util.UnsignedIntegerModel;
 import java.awt.*;
 import java.awt.datatransfer.StringSelection;
 import java.awt.event.*;
+import java.util.List;
 import java.util.concurrent.Callable;
 import javax.annotation.Nonnull;
 import javax.annotation.Nullable;
@@ -28,6 +31,12 @@ import javax.swing.event.*;
  */
 public class PasswordFrame extends JFrame implements DocumentListener {
 
+    /**
+     * How long typing must pause before the password is recomputed.
+     */
+    private static final int  UPDATE_DELAY_MS   = 200;
+    private static final long RESULT_CACHE_SIZE = 100;
+
     @SuppressWarnings("FieldCanBeLocal")
     private final Components.GradientPanel     root;
     private final JTextField                   siteNameField;
@@ -42,14 +51,36 @@ public class PasswordFrame extends JFrame implements DocumentListener {
     private final char                         passwordEchoChar;
     private final Font                         passwordEchoFont;
     private final User                         user;
+    private final Timer                        updateTimer;
+
+    /**
+     * Recent site results for each master key, by site name, type, counter, algorithm version and variant.
+     */
+    private final LoadingCache<MasterKey, Cache<List<?>, String>> resultsByKey = CacheBuilder.newBuilder().weakKeys().build(
+            new CacheLoader<MasterKey, Cache<List<?>, String>>() {
+                @Override
+                public Cache<List<?>, String> load(@Nonnull final MasterKey masterKey) {
+                    return CacheBuilder.newBuilder().maximumSize( RESULT_CACHE_SIZE ).build();
+                }
+            } );
 
     @Nullable
-    private Site    currentSite;
-    private boolean updatingUI;
+    private Site                     currentSite;
+    @Nullable
+    private ListenableFuture<String> passwordFuture;
+    private boolean                  updatingUI;
+    private boolean                  updateAllowsNameCompletion;
 
     public PasswordFrame(final User user) {
         super( "Master Password" );
         this.user = user;
+        updateTimer = new Timer( UPDATE_DELAY_MS, new ActionListener() {
+            @Override
+            public void actionPerformed(final ActionEvent e) {
+                updatePassword( updateAllowsNameCompletion );
+            }
+        } );
+        updateTimer.setRepeats( false );
 
         setDefaultCloseOperation( DISPOSE_ON_CLOSE );
         setContentPane( root = Components.gradientPanel( new FlowLayout(), Res.colors().frameBg() ) );
@@ -76,6 +107,7 @@ public class PasswordFrame extends JFrame implements DocumentListener {
         siteNameField.addActionListener( new ActionListener() {
             @Override
             public void actionPerformed(final ActionEvent e) {
+                updateTimer.stop();
                 Futures.addCallback( updatePassword( true ), new FutureCallback<String>() {
                     @Override
                     public void onSuccess(@Nullable final String sitePassword) {
@@ -197,17 +229,42 @@ public class PasswordFrame extends JFrame implements DocumentListener {
         setLocationRelativeTo( null );
     }
 
+    @Override
+    public void dispose() {
+        updateTimer.stop();
+        super.dispose();
+    }
+
     private void updateMask() {
         passwordField.setEchoChar( maskPasswordField.isSelected()? passwordEchoChar: (char) 0 );
         passwordField.setFont( maskPasswordField.isSelected()? passwordEchoFont: Res.bigValueFont().deriveFont( 40f ) );
     }
 
+    /**
+     * Recompute the password once typing pauses.
+     */
+    private void schedulePasswordUpdate(final boolean allowNameCompletion) {
+        if (updatingUI)
+            return;
+
+        updateAllowsNameCompletion = allowNameCompletion;
+        updateTimer.restart();
+    }
+
+    /**
+     * Recompute the password now, abandoning the computation for any earlier input.
+     */
     @Nonnull
     private ListenableFuture<String> updatePassword(final boolean allowNameCompletion) {
 
         final String siteNameQuery = siteNameField.getText();
         if (updatingUI)
             return Futures.immediateCancelledFuture();
+        updateTimer.stop();
+        if (passwordFuture != null) {
+            passwordFuture.cancel( true );
+            passwordFuture = null;
+        }
         if ((siteNameQuery == null) || siteNameQuery.isEmpty() || !user.isKeyAvailable()) {
             siteActionButton.setVisible( false );
             tipLabel.setText( null );
@@ -235,20 +292,33 @@ public class PasswordFrame extends JFrame implements DocumentListener {
             site.setSiteCounter( siteCounter );
         }
 
-        ListenableFuture<String> passwordFuture = Res.execute( this, new Callable<String>() {
+        final ListenableFuture<String> sitePasswordFuture = passwordFuture = Res.execute( this, new Callable<String>() {
             @Override
             public String call()
                     throws Exception {
-                return user.getKey( site.getAlgorithmVersion() )
-                           .encode( site.getSiteName(), site.getSiteType(), site.getSiteCounter(), MPSiteVariant.Password, null );
+                final MasterKey masterKey = user.getKey( site.getAlgorithmVersion() );
+                List<?> siteResultKey = ImmutableList.of( site.getSiteName(), site.getSiteType(), site.getSiteCounter(),
+                                                          site.getAlgorithmVersion(), MPSiteVariant.Password );
+
+                return resultsByKey.getUnchecked( masterKey ).get( siteResultKey, new Callable<String>() {
+                    @Override
+                    public String call() {
+                        return masterKey.encode( site.getSiteName(), site.getSiteType(), site.getSiteCounter(), MPSiteVariant.Password,
+                                                 null );
+                    }
+                } );
             }
         } );
-        Futures.addCallback( passwordFuture, new FutureCallback<String>() {
+        Futures.addCallback( sitePasswordFuture, new FutureCallback<String>() {
             @Override
             public void onSuccess(@Nullable final String sitePassword) {
                 SwingUtilities.invokeLater( new Runnable() {
                     @Override
                     public void run() {
+                        // The input changed since this password was requested.
+                        if (passwordFuture != sitePasswordFuture)
+                            return;
+
                         updatingUI = true;
                         currentSite = site;
                         siteActionButton.setVisible( user instanceof ModelUser );
@@ -275,21 +345,21 @@ public class PasswordFrame extends JFrame implements DocumentListener {
             }
         } );
 
-        return passwordFuture;
+        return sitePasswordFuture;
     }
 
     @Override
     public void insertUpdate(final DocumentEvent e) {
-        updatePassword( true );
+        schedulePasswordUpdate( true );
     }
 
     @Override
     public void removeUpdate(final DocumentEvent e) {
-        updatePassword( false );
+        schedulePasswordUpdate( false );
     }
 
     @Override
     public void changedUpdate(final DocumentEvent e) {
-        updatePassword( true );
+        schedulePasswordUpdate( true );
     }
 }